@@ -22,11 +22,80 @@ function getFloat() {
 }
 
 /**
- * The parser to decode the file.
+ * Adds the rows of a weights matrix of cols x rows floats, read from the
+ * current offset.
  */
-registerParser(() => {
-	addStandardHeader();
-	// Network Values
+function addWeights(name, cols, rows) {
+	read(cols * rows * 4);
+	addRow(name + ' Weights');
+	addDetails(() => {
+		for (let i = 0; i < rows; i++) {
+			for (let j = 0; j < cols; j++) {
+				read(4);
+				addRow(`${i}-${j}`, getFloat());
+			}
+		}
+	});
+}
+
+/**
+ * Version 2: 64-byte header, block table and 64-byte aligned blocks
+ * (see src/deep_learning/ModelFormat.hpp).
+ */
+function parseVersion2() {
+	addRow('Magic', 'NNMD', 'Model file magic');
+	read(4);
+	addRow('Version', getNumberValue(), 'Format version');
+	read(4);
+	const endian = getNumberValue();
+	addRow('Endian Marker', '0x' + endian.toString(16), '0x1020304 when written with the same byte order as this viewer (little endian)');
+	read(4);
+	const blockCount = getNumberValue();
+	addRow('Blocks', blockCount, 'Number of weight blocks');
+	read(4);
+	addRow('Inputs', getNumberValue(), 'Number of inputs neurons');
+	read(4);
+	addRow('Hidden', getNumberValue(), 'Number of hidden neurons on the first hidden layer');
+	read(4);
+	addRow('Output', getNumberValue(), 'Number of output neurons');
+	read(4);
+	addRow('Learning Rate', getFloat(), 'Value of the Learning Rate');
+	read(8);
+	const tableOffset = getNumberValue();
+	addRow('Table Offset', tableOffset, 'Offset of the block table');
+	read(8);
+	addRow('File Size', getNumberValue(), 'Size of the model, padded to 64 bytes');
+	read(8);
+	addRow('Checksum', getHexValue(), 'Fletcher-64 of the file with this field set to 0');
+
+	const kinds = ['Hidden', 'Output', 'Dense', 'Hidden Bias', 'Output Bias', 'Dense Bias', 'Optimizer State', 'Optimizer Settings'];
+	const blocks = [];
+	setOffset(tableOffset);
+	for (let b = 0; b < blockCount; b++) {
+		read(4);
+		const kind = getNumberValue();
+		read(4);
+		const cols = getNumberValue();
+		read(4);
+		const rows = getNumberValue();
+		read(4);
+		read(8);
+		const offset = getNumberValue();
+		read(8);
+		const name = kinds[kind] ?? `Block ${kind}`;
+		addRow(name + ' Block', `${cols} x ${rows} at ${offset}`, 'Cols, rows and offset of the block');
+		blocks.push({ name, cols, rows, offset });
+	}
+	for (const block of blocks) {
+		setOffset(block.offset);
+		addWeights(block.name, block.cols, block.rows);
+	}
+}
+
+/**
+ * Version 1: headerless layout with size_t matrix shapes.
+ */
+function parseVersion1() {
 	read(4);
 	addRow('Inputs', getNumberValue(), 'Number of inputs neurons');
 	read(4);
@@ -43,36 +112,28 @@ registerParser(() => {
 	read(8);
 	const rowsHidden = getNumberValue();
 	addRow('Rows Hidden Weights', rowsHidden, 'Number of rows on hidden weights');
-	const hiddenSize = colsHidden * rowsHidden;
-	read(hiddenSize * 4);
-	addRow('Hidden Weights');
-	addDetails(() => {
-		for (let i = 0; i < rowsHidden; i++) {
-			for (let j = 0; j < colsHidden; j++) {
-				read(4);
-				addRow(`${i}-${j}`, getFloat());
-			}
-		}
-	});
+	addWeights('Hidden', colsHidden, rowsHidden);
 
-	// Network Outout Weights
+	// Network Output Weights
 	read(8);
-	const colsOutout = getNumberValue();
-	addRow('Cols Outout Weights', colsOutout, 'Number of cols on Outout weights');
+	const colsOutput = getNumberValue();
+	addRow('Cols Output Weights', colsOutput, 'Number of cols on output weights');
 	read(8);
-	const rowsOutout = getNumberValue();
-	addRow('Rows Outout Weights', rowsOutout, 'Number of rows on Outout weights');
-	const OutoutSize = colsOutout * rowsOutout;
-	read(OutoutSize * 4);
-	addRow('Outout Weights');
-	addDetails(() => {
-		for (let i = 0; i < rowsOutout; i++) {
-			for (let j = 0; j < colsOutout; j++) {
-				read(4);
-				addRow(`${i}-${j}`, getFloat());
-			}
-		}
-	});
-
+	const rowsOutput = getNumberValue();
+	addRow('Rows Output Weights', rowsOutput, 'Number of rows on output weights');
+	addWeights('Output', colsOutput, rowsOutput);
+}
 
+/**
+ * The parser to decode the file.
+ */
+registerParser(() => {
+	addStandardHeader();
+	read(4);
+	if (getStringValue() == 'NNMD') {
+		parseVersion2();
+	} else {
+		setOffset(0);
+		parseVersion1();
+	}
 });
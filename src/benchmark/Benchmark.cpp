@@ -0,0 +1,128 @@
+#include "Benchmark.hpp"
+
+#include <algorithm> // sort
+#include <cmath>     // ceil && llround
+#include <ctime>     // time && gmtime && strftime
+#include <iomanip>   // setw && setprecision
+#include <numeric>   // accumulate
+#include <thread>    // hardware_concurrency
+
+#include "../math/Simd.hpp"
+
+namespace {
+
+// Nearest-rank percentile of sorted times
+double percentile(const std::vector<double> &sorted, double p) {
+    std::size_t rank = std::size_t(std::ceil(p * double(sorted.size())));
+    return sorted[std::max<std::size_t>(rank, 1) - 1];
+}
+
+std::string escape(const std::string &s) {
+    std::string escaped;
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+        }
+        escaped += c;
+    }
+    return escaped;
+}
+
+// Rates are null in the JSON when they do not apply
+void write_rate(std::ostream &json, double work, double value) {
+    if (work > 0.0) {
+        json << value;
+    } else {
+        json << "null";
+    }
+}
+
+long long nanoseconds(double seconds) { return std::llround(seconds * 1e9); }
+
+} // namespace
+
+void BenchmarkRunner::record(const std::string &name,
+                             std::vector<double> &times, const Work &work) {
+    std::sort(times.begin(), times.end());
+    BenchmarkResult result = {
+        name,
+        times.size(),
+        times.front(),
+        std::accumulate(times.begin(), times.end(), 0.0) / double(times.size()),
+        percentile(times, 0.50),
+        percentile(times, 0.90),
+        percentile(times, 0.99),
+        times.back(),
+        work};
+
+    // Table columns, with the rates that do not apply shown as -
+    if (results.empty()) {
+        out << std::left << std::setw(36) << "benchmark" << std::right
+            << std::setw(7) << "reps" << std::setw(12) << "p50 (us)"
+            << std::setw(12) << "p90 (us)" << std::setw(12) << "p99 (us)"
+            << std::setw(10) << "GFLOP/s" << std::setw(10) << "GB/s"
+            << std::setw(14) << "items/s" << std::endl;
+    }
+    auto column = [this](double work, double value, int width) {
+        if (work > 0.0) {
+            out << std::setw(width) << value;
+        } else {
+            out << std::setw(width) << "-";
+        }
+    };
+    const std::ios_base::fmtflags flags = out.flags();
+    out << std::left << std::setw(36) << name << std::right << std::setw(7)
+        << result.repetitions << std::fixed << std::setprecision(2)
+        << std::setw(12) << result.p50 * 1e6 << std::setw(12)
+        << result.p90 * 1e6 << std::setw(12) << result.p99 * 1e6;
+    column(work.flops, result.gflops(), 10);
+    column(work.bytes, result.gbytes(), 10);
+    column(work.items, result.items_per_second(), 14);
+    out << std::endl;
+    out.flags(flags);
+    results.push_back(std::move(result));
+}
+
+void BenchmarkRunner::write_json(std::ostream &json) const {
+    char date[32];
+    std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+#ifdef NN_AVX2
+    const char *simd = "avx2";
+#else
+    const char *simd = "scalar";
+#endif
+#ifdef NDEBUG
+    const char *build = "release";
+#else
+    const char *build = "debug";
+#endif
+
+    json << "{\n  \"context\": {\n"
+         << "    \"date\": \"" << date << "\",\n"
+         << "    \"hardware_threads\": " << std::thread::hardware_concurrency()
+         << ",\n"
+         << "    \"simd\": \"" << simd << "\",\n"
+         << "    \"build\": \"" << build << "\",\n"
+         << "    \"warmup\": " << options.warmup << ",\n"
+         << "    \"min_seconds\": " << options.min_seconds << "\n"
+         << "  },\n  \"benchmarks\": [";
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const BenchmarkResult &r = results[i];
+        json << (i == 0 ? "\n" : ",\n") << "    {\"name\": \""
+             << escape(r.name) << "\", \"repetitions\": " << r.repetitions
+             << ", \"min_ns\": " << nanoseconds(r.min)
+             << ", \"mean_ns\": " << nanoseconds(r.mean)
+             << ", \"p50_ns\": " << nanoseconds(r.p50)
+             << ", \"p90_ns\": " << nanoseconds(r.p90)
+             << ", \"p99_ns\": " << nanoseconds(r.p99)
+             << ", \"max_ns\": " << nanoseconds(r.max) << ", \"gflops\": ";
+        write_rate(json, r.work.flops, r.gflops());
+        json << ", \"gbytes_per_second\": ";
+        write_rate(json, r.work.bytes, r.gbytes());
+        json << ", \"items_per_second\": ";
+        write_rate(json, r.work.items, r.items_per_second());
+        json << "}";
+    }
+    json << "\n  ]\n}\n";
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <chrono>  // steady_clock && duration
+#include <cstddef> // size_t
+#include <ostream> // ostream
+#include <string>  // string
+#include <utility> // move
+#include <vector>  // vector
+
+// Work done by one call of a benchmarked function, turned into rates; 0 when
+// the measure does not apply
+struct Work {
+    double flops = 0.0; // Floating point (or integer multiply-add) operations
+    double bytes = 0.0; // Bytes read and written
+    double items = 0.0; // Samples, images... processed
+};
+
+// Timings of one benchmark, in seconds per call
+struct BenchmarkResult {
+    std::string name;
+    std::size_t repetitions;
+    double min;
+    double mean;
+    double p50;
+    double p90;
+    double p99;
+    double max;
+    Work work;
+
+    // Rates at the median time
+    double gflops() const { return work.flops / p50 * 1e-9; }
+    double gbytes() const { return work.bytes / p50 * 1e-9; }
+    double items_per_second() const { return work.items / p50; }
+};
+
+struct BenchmarkOptions {
+    std::size_t warmup = 3;            // Untimed calls first
+    std::size_t min_repetitions = 10;  // Timed calls, at least
+    std::size_t max_repetitions = 1000;
+    double min_seconds = 0.5;          // Timed calls go on until this long
+    std::string filter;                // Only names containing it
+};
+
+// Times functions and collects the results:
+//
+//     BenchmarkRunner runner(options, std::cout);
+//     runner.run("gemm/256", [&]() { c.assign_dot(a, b); }, {2.0 * n * n * n});
+//     runner.write_json(file);
+//
+// Each call is timed on its own, so the percentiles show the spread (page
+// faults, frequency changes, other processes) that a single total hides.
+class BenchmarkRunner {
+    BenchmarkOptions options;
+    std::ostream &out;
+    std::vector<BenchmarkResult> results;
+
+    // Computes the statistics, prints them as one line of a table on out
+    void record(const std::string &name, std::vector<double> &times,
+                const Work &work);
+
+  public:
+    BenchmarkRunner(BenchmarkOptions options, std::ostream &out)
+        : options(std::move(options)), out(out) {}
+
+    // Whether name passes the filter, to skip the setup of unused benchmarks
+    bool selected(const std::string &name) const {
+        return name.find(options.filter) != std::string::npos;
+    }
+
+    template <typename F> void run(const std::string &name, F &&f,
+                                   const Work &work = {}) {
+        if (!selected(name)) {
+            return;
+        }
+        for (std::size_t i = 0; i < options.warmup; ++i) {
+            f();
+        }
+        std::vector<double> times;
+        double total = 0.0;
+        while (times.size() < options.max_repetitions &&
+               (times.size() < options.min_repetitions ||
+                total < options.min_seconds)) {
+            auto start = std::chrono::steady_clock::now();
+            f();
+            double seconds = std::chrono::duration<double>(
+                                 std::chrono::steady_clock::now() - start)
+                                 .count();
+            times.push_back(seconds);
+            total += seconds;
+        }
+        record(name, times, work);
+    }
+
+    // {"context": {...}, "benchmarks": [{...}, ...]}, times in nanoseconds
+    void write_json(std::ostream &json) const;
+
+    const std::vector<BenchmarkResult> &getResults() const { return results; }
+};
+
+// Keeps the compiler from discarding a result that is never used
+template <typename T> void do_not_optimize(const T &value) {
+    [[maybe_unused]] static volatile T sink;
+    sink = value;
+}
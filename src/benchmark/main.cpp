@@ -0,0 +1,519 @@
+#include "../deep_learning/FixedNeuralNetwork.hpp"
+#include "../deep_learning/LayerStack.hpp"
+#include "../deep_learning/NeuralNetwork.hpp"
+#include "../deep_learning/QuantizedNetwork.hpp"
+#include "../math/Kernels.hpp"
+#include "../utils/CompressedDataset.hpp"
+#include "Benchmark.hpp"
+
+#include <algorithm>  // min && none_of
+#include <cstdlib>    // strtod && strtoull
+#include <format>     // format
+#include <filesystem> // file_size && temp_directory_path && create_directories && remove_all
+#include <fstream>    // ofstream
+#include <functional> // function
+#include <iostream>   // cout && cerr && endl
+#include <random>     // mt19937
+#include <string>     // string
+#include <thread>     // hardware_concurrency
+#include <vector>     // vector
+
+namespace fs = std::filesystem;
+
+// Network measured by the training, inference and model benchmarks
+constexpr int input = 784;
+constexpr int hidden = 300;
+constexpr int output = 10;
+
+// Multiply-adds of one sample through the network, counted twice
+constexpr double forward_flops = 2.0 * (input * hidden + hidden * output);
+// Forward pass, the hidden deltas (output weights transposed times the
+// output deltas) and both weight gradients
+constexpr double train_flops =
+    forward_flops + 2.0 * hidden * output + 2.0 * (input * hidden + hidden * output);
+
+// MNIST-like images: a few bright strokes on a mostly zero background, so
+// the compressed formats see realistic sparsity
+std::vector<Img> synthetic_imgs(std::size_t count) {
+    std::mt19937 generator(42);
+    std::vector<Img> imgs(count);
+    for (Img &img : imgs) {
+        img.label = int(generator() % 10);
+        img.img_data = Matrix2D(28, 28);
+        MatrixStorage &pixels = img.img_data.getData();
+        for (int stroke = 0; stroke < 4; ++stroke) {
+            std::size_t start = 28 * (4 + generator() % 20) + 4 + generator() % 20;
+            for (std::size_t j = 0; j < 40 && start + j < pixels.size(); ++j) {
+                pixels[start + j] = float(1 + generator() % 255) / 256.0f;
+            }
+        }
+    }
+    return imgs;
+}
+
+void MatrixBenchmarks(BenchmarkRunner &runner) {
+    // GEMM: square sizes, then the layer shapes of training (batch of 32)
+    // and single-image inference. Bytes count each operand once
+    struct Shape {
+        std::size_t m, n, k;
+        const char *name;
+    };
+    for (Shape s : {Shape{64, 64, 64, "64"}, Shape{128, 128, 128, "128"},
+                    Shape{256, 256, 256, "256"}, Shape{512, 512, 512, "512"},
+                    Shape{hidden, 32, input, "300x32x784"},
+                    Shape{hidden, 1, input, "300x1x784"}}) {
+        std::string name = std::format("matrix/gemm/{}", s.name);
+        if (!runner.selected(name)) {
+            continue;
+        }
+        Matrix2D a(s.m, s.k), b(s.k, s.n), c(s.m, s.n);
+        a.randomize(-1.0f, 1.0f);
+        b.randomize(-1.0f, 1.0f);
+        runner.run(name, [&]() { c.assign_dot(a, b); },
+                   {2.0 * s.m * s.n * s.k,
+                    4.0 * (s.m * s.k + s.k * s.n + s.m * s.n)});
+    }
+
+    // Dense layer, sigmoid(weights * inputs + bias): the GEMM then separate
+    // passes for the bias and the activation, against one fused GEMM. The
+    // last shape has a short K, so the passes over C dominate
+    for (Shape s : {Shape{hidden, 32, input, "300x32x784"},
+                    Shape{hidden, 256, input, "300x256x784"},
+                    Shape{256, 16384, 32, "256x16384x32"}}) {
+        std::string unfused = std::format("matrix/dense/unfused/{}", s.name);
+        std::string fused = std::format("matrix/dense/fused/{}", s.name);
+        if (!runner.selected(unfused) && !runner.selected(fused)) {
+            continue;
+        }
+        Matrix2D a(s.m, s.k), b(s.k, s.n), bias(s.m, 1), c(s.m, s.n);
+        a.randomize(-1.0f, 1.0f);
+        b.randomize(-1.0f, 1.0f);
+        bias.randomize(-1.0f, 1.0f);
+        const Work work = {2.0 * s.m * s.n * s.k,
+                           4.0 * (s.m * s.k + s.k * s.n + s.m * s.n)};
+        runner.run(unfused,
+                   [&]() {
+                       c.assign_dot(a, b);
+                       float *row = c.getData().data();
+                       for (std::size_t i = 0; i < s.m; ++i, row += s.n) {
+                           for (std::size_t j = 0; j < s.n; ++j) {
+                               row[j] += bias[i];
+                           }
+                       }
+                       c.apply(kernels::sigmoid);
+                   },
+                   work);
+        runner.run(fused,
+                   [&]() {
+                       c.assign_dot(a, b,
+                                    gemm::bias_activation(
+                                        bias.getData().data(), kernels::sigmoid));
+                   },
+                   work);
+    }
+
+    // SGD weight update of the hidden layer, weights += step * deltas *
+    // inputs^T for a batch of k: a beta = 1 GEMM against the rank-k update,
+    // which streams over the weights once for small k
+    for (std::size_t k : {1, 8, 32}) {
+        std::string shape = std::format("{}x{}x{}", hidden, input, k);
+        std::string beta = "matrix/update/gemm/" + shape;
+        std::string outer = "matrix/update/outer/" + shape;
+        if (!runner.selected(beta) && !runner.selected(outer)) {
+            continue;
+        }
+        Matrix2D x(hidden, k), y(input, k), w(hidden, input);
+        x.randomize(-1.0f, 1.0f);
+        y.randomize(-1.0f, 1.0f);
+        const Work work = {2.0 * hidden * input * k,
+                           4.0 * (hidden * k + input * k + 2 * hidden * input)};
+        runner.run(beta,
+                   [&]() {
+                       w.assign_dot(x, y, gemm::Op::N, gemm::Op::T, 1e-3f,
+                                    1.0f);
+                   },
+                   work);
+        runner.run(outer, [&]() { w.add_outer(1e-3f, x, y); }, work);
+    }
+
+    for (std::size_t n : {256, 1024}) {
+        std::string name = std::format("matrix/transpose/{}", n);
+        if (!runner.selected(name)) {
+            continue;
+        }
+        Matrix2D a(n, n);
+        a.randomize(-1.0f, 1.0f);
+        runner.run(name, [&]() { do_not_optimize(a.transpose()[0]); },
+                   {0.0, 8.0 * n * n});
+    }
+
+    // Element-wise and reductions, in and out of the caches
+    for (std::size_t n : {std::size_t(1) << 14, std::size_t(1) << 22}) {
+        Matrix2D a(n, 1), b(n, 1), c(n, 1);
+        a.randomize(-1.0f, 1.0f);
+        b.randomize(-1.0f, 1.0f);
+        runner.run(std::format("matrix/add/{}", n), [&]() { c = a + b; },
+                   {double(n), 12.0 * n});
+        runner.run(std::format("matrix/axpy/{}", n),
+                   [&]() { c = 0.5f * a + b; }, {2.0 * n, 12.0 * n});
+        runner.run(std::format("matrix/sigmoid/{}", n),
+                   [&]() { c.apply(kernels::sigmoid); }, {0.0, 8.0 * n});
+        runner.run(std::format("matrix/sum/{}", n),
+                   [&]() { do_not_optimize(a.reduce(0.0f, kernels::sum)); },
+                   {double(n), 4.0 * n});
+        runner.run(std::format("matrix/sum_squares/{}", n),
+                   [&]() {
+                       do_not_optimize(a.reduce(0.0f, kernels::sum_squares));
+                   },
+                   {2.0 * n, 4.0 * n});
+    }
+}
+
+void TrainingBenchmarks(BenchmarkRunner &runner) {
+    // One SGD step of the network on a batch already in memory
+    for (std::size_t batch : {1, 32, 256}) {
+        std::string name = std::format("train/step/{}", batch);
+        if (!runner.selected(name)) {
+            continue;
+        }
+        NeuralNetwork net(input, hidden, output, 0.1f);
+        Matrix2D inputs(input, batch), targets(output, batch);
+        inputs.randomize(0.0f, 1.0f);
+        for (std::size_t i = 0; i < batch; ++i) {
+            targets[(i % output) * batch + i] = 1.0f; // One-hot columns
+        }
+        runner.run(name, [&]() { net.train(inputs, targets); },
+                   {train_flops * batch, 0.0, double(batch)});
+    }
+
+    // Optimizers: the update of the hidden weights alone, one fused pass
+    // over the gradient, the state and the weights, then whole steps. SGD
+    // steps add the gradients to the weights as they are computed, the
+    // others store them first
+    struct Rule {
+        OptimizerKind kind;
+        const char *name;
+        double bytes; // Per weight: floats read and written
+    };
+    for (Rule rule : {Rule{OptimizerKind::Sgd, "sgd", 12.0},
+                      Rule{OptimizerKind::Momentum, "momentum", 20.0},
+                      Rule{OptimizerKind::Nesterov, "nesterov", 20.0},
+                      Rule{OptimizerKind::Adam, "adam", 28.0}}) {
+        std::string update = std::format("train/update/{}", rule.name);
+        std::string step = std::format("train/step/32/{}", rule.name);
+        if (!runner.selected(update) && !runner.selected(step)) {
+            continue;
+        }
+        Matrix2D weights(hidden, input), gradient(hidden, input);
+        weights.randomize(-0.1f, 0.1f);
+        gradient.randomize(-1.0f, 1.0f);
+        Optimizer optimizer({rule.kind});
+        const double n = double(hidden) * input;
+        runner.run(update,
+                   [&]() {
+                       optimizer.begin_step();
+                       optimizer.update(0, weights, gradient, 1e-4f, 32);
+                   },
+                   {0.0, rule.bytes * n});
+
+        NeuralNetwork net(input, hidden, output,
+                          rule.kind == OptimizerKind::Adam ? 1e-3f : 0.1f);
+        net.set_optimizer({rule.kind});
+        Matrix2D inputs(input, 32), targets(output, 32);
+        inputs.randomize(0.0f, 1.0f);
+        for (std::size_t i = 0; i < 32; ++i) {
+            targets[(i % output) * 32 + i] = 1.0f;
+        }
+        runner.run(step, [&]() { net.train(inputs, targets); },
+                   {train_flops * 32, 0.0, 32.0});
+    }
+
+    // SGD steps on single images: train_img skips the blank pixels in the
+    // first layer, the dense step multiplies them all, and MnistNetwork
+    // runs the kernels unrolled for its compile-time shapes
+    if (runner.selected("train/image/dense") ||
+        runner.selected("train/image/sparse") ||
+        runner.selected("train/image/fixed")) {
+        const std::vector<Img> imgs = synthetic_imgs(64);
+        std::vector<Matrix2D> inputs, targets;
+        for (const Img &img : imgs) {
+            inputs.push_back(img.img_data.flatten(0));
+            targets.emplace_back(output, 1);
+            targets.back()[img.label] = 1.0f;
+        }
+        NeuralNetwork net(input, hidden, output, 0.1f);
+        const Work work = {train_flops * imgs.size(), 0.0, double(imgs.size())};
+        runner.run("train/image/dense",
+                   [&]() {
+                       for (std::size_t i = 0; i < imgs.size(); ++i) {
+                           net.train(inputs[i], targets[i]);
+                       }
+                   },
+                   work);
+        runner.run("train/image/sparse",
+                   [&]() {
+                       for (const Img &img : imgs) {
+                           net.train_img(img);
+                       }
+                   },
+                   work);
+        MnistNetwork fixed(net);
+        runner.run("train/image/fixed",
+                   [&]() {
+                       for (const Img &img : imgs) {
+                           fixed.train_img(img);
+                       }
+                   },
+                   work);
+    }
+}
+
+void ParallelTrainingBenchmarks(BenchmarkRunner &runner) {
+    // Data-parallel epochs on one thread and on every core. The shards, and
+    // so the work, do not depend on the thread count: the ratio of the times
+    // is the speedup
+    const unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+    const std::string single = "train/parallel/1";
+    const std::string parallel = std::format("train/parallel/{}", cores);
+    if (!runner.selected(single) && !runner.selected(parallel)) {
+        return;
+    }
+    const Dataset dataset(synthetic_imgs(2048));
+    const double count = double(dataset.size());
+    NeuralNetwork net(input, hidden, output, 0.1f);
+    // Epochs draw a progress bar, silenced meanwhile
+    std::streambuf *console = std::clog.rdbuf(nullptr);
+    runner.run(single, [&]() { net.train_parallel(dataset, 256, 1, 1); },
+               {train_flops * count, 0.0, count});
+    if (cores > 1) {
+        runner.run(parallel,
+                   [&]() { net.train_parallel(dataset, 256, 1, cores); },
+                   {train_flops * count, 0.0, count});
+    }
+    std::clog.rdbuf(console);
+
+    auto p50 = [&runner](const std::string &name) {
+        for (const BenchmarkResult &result : runner.getResults()) {
+            if (result.name == name) {
+                return result.p50;
+            }
+        }
+        return 0.0;
+    };
+    if (cores > 1 && p50(single) > 0.0 && p50(parallel) > 0.0) {
+        std::cout << "train/parallel speedup on " << cores
+                  << " threads: " << p50(single) / p50(parallel) << "x"
+                  << std::endl;
+    }
+}
+
+void InferenceBenchmarks(BenchmarkRunner &runner,
+                         const std::vector<Img> &imgs) {
+    if (!runner.selected("classify/fp32/vector") &&
+        !runner.selected("classify/fp32/dataset") &&
+        !runner.selected("classify/fixed/vector") &&
+        !runner.selected("classify/stack/dataset") &&
+        !runner.selected("classify/int8/dataset")) {
+        return;
+    }
+    NeuralNetwork net(input, hidden, output, 0.1f);
+    Dataset dataset(imgs);
+    const std::size_t calibration = std::min<std::size_t>(imgs.size(), 1000);
+    const double count = double(imgs.size());
+    runner.run("classify/fp32/vector", [&]() { net.classify_imgs(imgs); },
+               {forward_flops * count, 0.0, count});
+    runner.run("classify/fp32/dataset", [&]() { net.classify_imgs(dataset); },
+               {forward_flops * count, 0.0, count});
+    // One image at a time, with the compile-time topology
+    MnistNetwork fixed(net);
+    runner.run("classify/fixed/vector", [&]() { fixed.classify_imgs(imgs); },
+               {forward_flops * count, 0.0, count});
+    LayerStack stack(net);
+    runner.run("classify/stack/dataset",
+               [&]() { stack.classify_imgs(dataset); },
+               {forward_flops * count, 0.0, count});
+    if (runner.selected("classify/int8")) {
+        QuantizedNetwork quantized(net, dataset.batch(0, calibration));
+        runner.run("classify/int8/dataset",
+                   [&]() { quantized.classify_imgs(dataset); },
+                   {forward_flops * count, 0.0, count});
+    }
+}
+
+// Loaders read files written once into dir; the page cache is warm after
+// the warmup calls, so these measure parsing and copying, not the disk
+void LoaderBenchmarks(BenchmarkRunner &runner, const std::vector<Img> &imgs,
+                      const fs::path &dir) {
+    struct Loader {
+        const char *name;
+        std::string file;
+        std::function<void()> load;
+        double items;
+    };
+    auto file = [&dir](const char *name) { return (dir / name).string(); };
+    auto run_all = [&runner](const std::vector<Loader> &loaders,
+                             auto &&write_files) {
+        if (std::none_of(loaders.begin(), loaders.end(),
+                         [&runner](const Loader &l) { return runner.selected(l.name); })) {
+            return;
+        }
+        write_files();
+        for (const Loader &l : loaders) {
+            runner.run(l.name, l.load,
+                       {0.0, double(fs::file_size(l.file)), l.items});
+        }
+    };
+
+    const double count = double(imgs.size());
+    run_all(
+        {{"load/dataset/binary_imgs", file("imgs.bin"),
+          [&]() { do_not_optimize(load_binary_imgs(file("imgs.bin")).size()); },
+          count},
+         {"load/dataset/binary_compact_imgs", file("imgs_compact.bin"),
+          [&]() {
+              do_not_optimize(
+                  load_binary_compact_imgs(file("imgs_compact.bin")).size());
+          },
+          count},
+         {"load/dataset/binary_compact_dataset", file("imgs_compact.bin"),
+          [&]() {
+              do_not_optimize(
+                  load_binary_compact_dataset(file("imgs_compact.bin")).size());
+          },
+          count},
+         {"load/dataset/mapped_dataset", file("imgs.dataset"),
+          [&]() { do_not_optimize(MappedDataset(file("imgs.dataset")).size()); },
+          count},
+         {"load/dataset/mapped_to_dataset", file("imgs.dataset"),
+          [&]() {
+              do_not_optimize(
+                  Dataset(MappedDataset(file("imgs.dataset"))).size());
+          },
+          count},
+         {"load/dataset/compressed_dataset", file("imgs.zdataset"),
+          [&]() {
+              do_not_optimize(
+                  load_compressed_dataset(file("imgs.zdataset")).size());
+          },
+          count}},
+        [&]() {
+            save_binary_imgs(file("imgs.bin"), imgs);
+            save_binary_compact_imgs(file("imgs_compact.bin"), imgs);
+            save_dataset(file("imgs.dataset"), imgs);
+            save_compressed_dataset(file("imgs.zdataset"), imgs);
+        });
+
+    // Model loaders print a line per call, silenced meanwhile
+    std::streambuf *console = std::cout.rdbuf(nullptr);
+    NeuralNetwork loaded;
+    LayerStack stack;
+    QuantizedNetwork loaded_quantized;
+    run_all(
+        {{"load/model/text", file("net.txt"),
+          [&]() { loaded.load(file("net.txt")); }, 0.0},
+         {"load/model/binary", file("net.net-bin"),
+          [&]() { loaded.load_bin(file("net.net-bin")); }, 0.0},
+         {"load/model/stack", file("net.net-bin"),
+          [&]() { stack.load_bin(file("net.net-bin")); }, 0.0},
+         // Loading reads the whole file once for its checksum: touching
+         // every weight afterwards adds the reads of first use
+         {"load/model/binary_touched", file("net.net-bin"),
+          [&]() {
+              loaded.load_bin(file("net.net-bin"));
+              do_not_optimize(
+                  loaded.getHiddenWeights().reduce(0.0f, kernels::sum) +
+                  loaded.getOutputWeights().reduce(0.0f, kernels::sum));
+          },
+          0.0},
+         {"load/model/int8", file("net.net-q8"),
+          [&]() { loaded_quantized.load(file("net.net-q8")); }, 0.0}},
+        [&]() {
+            NeuralNetwork net(input, hidden, output, 0.1f);
+            net.save(file("net.txt"));
+            net.save_bin(file("net.net-bin"));
+            QuantizedNetwork(net, Dataset(imgs).batch(
+                                      0, std::min<std::size_t>(imgs.size(), 1000)))
+                .save(file("net.net-q8"));
+        });
+    std::cout.rdbuf(console);
+}
+
+void usage() {
+    std::cerr << "Usage: neural-net-benchmark [options]\n"
+                 "  --filter=TEXT    only benchmarks whose name contains TEXT\n"
+                 "  --json=FILE      write the results as JSON to FILE\n"
+                 "  --warmup=N       untimed calls before timing (default 3)\n"
+                 "  --reps=N         timed calls, at least (default 10)\n"
+                 "  --max-reps=N     timed calls, at most (default 1000)\n"
+                 "  --min-time=S     time each benchmark for S seconds, at "
+                 "least (default 0.5)\n"
+                 "  --images=N       images for the inference and loader "
+                 "benchmarks (default 10000)\n";
+}
+
+int main(int argc, char *argv[]) {
+    BenchmarkOptions options;
+    std::string json_file;
+    std::size_t image_count = 10000;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto value = [&arg](const char *flag) -> const char * {
+            std::size_t length = std::char_traits<char>::length(flag);
+            return arg.compare(0, length, flag) == 0 ? arg.c_str() + length
+                                                     : nullptr;
+        };
+        if (const char *v = value("--filter=")) {
+            options.filter = v;
+        } else if (const char *v = value("--json=")) {
+            json_file = v;
+        } else if (const char *v = value("--warmup=")) {
+            options.warmup = std::strtoull(v, nullptr, 10);
+        } else if (const char *v = value("--reps=")) {
+            options.min_repetitions = std::strtoull(v, nullptr, 10);
+        } else if (const char *v = value("--max-reps=")) {
+            options.max_repetitions = std::strtoull(v, nullptr, 10);
+        } else if (const char *v = value("--min-time=")) {
+            options.min_seconds = std::strtod(v, nullptr);
+        } else if (const char *v = value("--images=")) {
+            image_count = std::strtoull(v, nullptr, 10);
+        } else {
+            usage();
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+    if (options.max_repetitions < options.min_repetitions ||
+        options.min_repetitions == 0 || image_count == 0) {
+        usage();
+        return 1;
+    }
+
+    const fs::path dir = fs::temp_directory_path() / "neural-net-benchmark";
+    try {
+        fs::create_directories(dir);
+        // The table has its own stream on stdout, which stays open while
+        // std::cout is silenced around the model loaders
+        std::ostream table(std::cout.rdbuf());
+        BenchmarkRunner runner(options, table);
+        std::vector<Img> imgs = synthetic_imgs(image_count);
+
+        MatrixBenchmarks(runner);
+        TrainingBenchmarks(runner);
+        ParallelTrainingBenchmarks(runner);
+        InferenceBenchmarks(runner, imgs);
+        LoaderBenchmarks(runner, imgs, dir);
+
+        if (!json_file.empty()) {
+            std::ofstream json(json_file);
+            runner.write_json(json);
+            if (!json) {
+                throw std::runtime_error("Cannot write '" + json_file + "'");
+            }
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "Exception: " << e.what() << std::endl;
+        fs::remove_all(dir);
+        return 1;
+    }
+    fs::remove_all(dir);
+    return 0;
+}
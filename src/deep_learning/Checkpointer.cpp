@@ -0,0 +1,99 @@
+#include "Checkpointer.hpp"
+
+#include <filesystem> // exists
+#include <utility>    // exchange && move
+
+Checkpointer::Checkpointer(std::string path, std::size_t every_samples,
+                           double every_seconds)
+    : path(std::move(path)), every_samples(every_samples),
+      every(std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::duration<double>(every_seconds))),
+      last(std::chrono::steady_clock::now()) {
+    writer = std::thread([this]() { write_loop(); });
+}
+
+Checkpointer::~Checkpointer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    changed.notify_all();
+    writer.join();
+}
+
+void Checkpointer::write_loop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        changed.wait(lock, [this]() { return pending >= 0 || stopping; });
+        if (pending < 0) {
+            break; // Stopping with nothing left to write
+        }
+        writing = std::exchange(pending, -1);
+        lock.unlock();
+
+        // save_bin writes aside then renames over the previous checkpoint,
+        // so a crash mid-write leaves the previous one intact
+        std::exception_ptr failure;
+        try {
+            snapshots[writing].save_bin(path);
+        } catch (...) {
+            failure = std::current_exception();
+        }
+
+        lock.lock();
+        if (failure) {
+            error = failure;
+        } else {
+            ++written;
+        }
+        writing = -1;
+        changed.notify_all();
+    }
+}
+
+void Checkpointer::step(const NeuralNetwork &net, std::size_t count) {
+    samples += count;
+    const auto now = std::chrono::steady_clock::now();
+    if ((every_samples > 0 && samples >= every_samples) ||
+        (every.count() > 0 && now - last >= every)) {
+        save(net);
+    }
+}
+
+void Checkpointer::save(const NeuralNetwork &net) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (error) {
+            std::rethrow_exception(std::exchange(error, nullptr));
+        }
+        // The writer only touches the snapshot it is writing
+        const int target = writing == 0 ? 1 : 0;
+        net.snapshot(snapshots[target]);
+        pending = target;
+    }
+    changed.notify_all();
+    samples = 0;
+    last = std::chrono::steady_clock::now();
+}
+
+void Checkpointer::flush() {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this]() { return pending < 0 && writing < 0; });
+    if (error) {
+        std::rethrow_exception(std::exchange(error, nullptr));
+    }
+}
+
+bool Checkpointer::resume(NeuralNetwork &net) const {
+    if (!std::filesystem::exists(path)) {
+        return false;
+    }
+    net.load_bin(path);
+    net.own_weights();
+    return true;
+}
+
+std::size_t Checkpointer::getWritten() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return written;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <chrono>             // steady_clock
+#include <condition_variable> // condition_variable
+#include <cstddef>            // size_t
+#include <exception>          // exception_ptr
+#include <mutex>              // mutex
+#include <string>             // string
+#include <thread>             // thread
+
+#include "NeuralNetwork.hpp"
+
+// Periodic checkpoints of a network in training, written without stalling
+// the training loop:
+//
+//     Checkpointer checkpointer("data/net.ckpt", 10000, 60.0);
+//     checkpointer.resume(net); // Continue an interrupted run, if any
+//     net.set_checkpointer(&checkpointer);
+//     net.train_minibatch(imgs, 32, 4);
+//
+// When a checkpoint is due, the weights, the optimizer state and the training
+// position are copied into one of two snapshot buffers and handed to a
+// background thread, which writes them as a binary model (see
+// ModelFormat.hpp) to a temporary file renamed over the checkpoint: the
+// checkpoint on disk is always complete. The trainer only pays for the copy.
+// While one snapshot is being written the other one takes the next
+// checkpoint; a checkpoint due before the writer is free replaces the one
+// still waiting.
+class Checkpointer {
+    std::string path;
+    std::size_t every_samples;
+    std::chrono::steady_clock::duration every;
+    std::size_t samples = 0; // Trained since the last snapshot
+    std::chrono::steady_clock::time_point last;
+
+    // Snapshot buffers, passed to the writer by index
+    ModelSnapshot snapshots[2];
+    int writing = -1;
+    int pending = -1;
+    std::size_t written = 0;
+    mutable std::mutex mutex;
+    std::condition_variable changed;
+    bool stopping = false;
+    std::exception_ptr error;
+    std::thread writer;
+
+    void write_loop();
+
+  public:
+    // A checkpoint at path every every_samples trained samples or every
+    // every_seconds seconds, whichever comes first; 0 disables either
+    Checkpointer(std::string path, std::size_t every_samples,
+                 double every_seconds = 0.0);
+    // Writes the last snapshot before returning
+    ~Checkpointer();
+
+    Checkpointer(const Checkpointer &) = delete;
+    Checkpointer &operator=(const Checkpointer &) = delete;
+
+    // Counts count trained samples and snapshots net when a checkpoint is
+    // due. Rethrows the std::runtime_error of a failed write
+    void step(const NeuralNetwork &net, std::size_t count);
+    // Snapshots net now
+    void save(const NeuralNetwork &net);
+    // Waits until the last snapshot is on disk. Rethrows the
+    // std::runtime_error of a failed write
+    void flush();
+    // Loads the checkpoint into net, training position included; false when
+    // there is none yet. The weights are copied to owned memory, as the
+    // next checkpoints replace the file. Throws std::runtime_error when it
+    // is malformed
+    bool resume(NeuralNetwork &net) const;
+
+    // getters
+    const std::string &getPath() const { return path; }
+    // Checkpoints written so far
+    std::size_t getWritten() const;
+};
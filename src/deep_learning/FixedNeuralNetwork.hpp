@@ -0,0 +1,159 @@
+#pragma once
+
+#include <algorithm> // copy_n
+#include <cmath>     // exp
+#include <cstddef>   // size_t
+#include <iostream>  // clog
+#include <stdexcept> // invalid_argument
+#include <string>    // to_string
+#include <vector>    // vector
+
+#include "../math/Calculus.hpp"
+#include "../math/Kernels.hpp"
+#include "../math/Matrix.hpp"
+#include "../utils/Img.hpp"
+#include "../utils/ProgressBar.hpp"
+#include "NeuralNetwork.hpp"
+
+// NeuralNetwork with the topology fixed at compile time (Input-Hidden-Output
+// neurons), for deployments that always run the same model.
+//
+// Every matrix has a constexpr shape, so layer mismatches are compile errors
+// and the products run the unrolled kernels of Matrix.hpp. It converts to and
+// from the dynamic NeuralNetwork, which is still used to load and save.
+template <std::size_t Input, std::size_t Hidden, std::size_t Output>
+class FixedNeuralNetwork {
+    float learning_rate;
+    Matrix<Hidden, Input> hidden_weights;
+    Matrix<Output, Hidden> output_weights;
+    Matrix<Hidden, 1> hidden_bias;
+    Matrix<Output, 1> output_bias;
+
+    // Training/inference buffers, allocated once with the network
+    Matrix<Input, 1> inputs;
+    Matrix<Output, 1> targets;
+    Matrix<Hidden, 1> hidden_outputs;
+    Matrix<Output, 1> final_outputs;
+    Matrix<Output, 1> output_errors;
+    Matrix<Hidden, 1> hidden_errors;
+
+    void load_img(const Img &img) {
+        const MatrixStorage &pixels = img.img_data.getData();
+        if (pixels.size() != Input) {
+            throw std::invalid_argument("Image with " +
+                                        std::to_string(pixels.size()) +
+                                        " pixels, expected " +
+                                        std::to_string(Input));
+        }
+        std::copy_n(pixels.data(), Input, inputs.data());
+    }
+
+    void feed_forward(const Matrix<Input, 1> &input_data) {
+        fixed::dot(hidden_weights, input_data, hidden_bias, hidden_outputs);
+        hidden_outputs.apply(kernels::sigmoid);
+        fixed::dot(output_weights, hidden_outputs, output_bias, final_outputs);
+        final_outputs.apply(kernels::sigmoid);
+    }
+
+  public:
+    // Randomly initialized, like NeuralNetwork(Input, Hidden, Output, lr)
+    explicit FixedNeuralNetwork(float lr)
+        : FixedNeuralNetwork(NeuralNetwork(int(Input), int(Hidden),
+                                           int(Output), lr)) {}
+
+    // Copies the weights and biases of a dynamic network with the same
+    // topology
+    explicit FixedNeuralNetwork(const NeuralNetwork &net)
+        : learning_rate(net.getLearningRate()),
+          hidden_weights(net.getHiddenWeights()),
+          output_weights(net.getOutputWeights()),
+          hidden_bias(net.getHiddenBias()), output_bias(net.getOutputBias()) {}
+
+    // Dynamic copy of this network, e.g. to save it
+    NeuralNetwork to_dynamic() const {
+        return NeuralNetwork(learning_rate, Matrix2D(hidden_weights),
+                             Matrix2D(output_weights), Matrix2D(hidden_bias),
+                             Matrix2D(output_bias));
+    }
+
+    // One SGD step on a single sample, same math as NeuralNetwork::train
+    float train(const Matrix<Input, 1> &input_data,
+                const Matrix<Output, 1> &output_data) {
+        feed_forward(input_data);
+
+        // Find errors
+        output_errors = output_data - final_outputs;
+        fixed::dot_tn(output_weights, output_errors, hidden_errors);
+
+        float cost = output_errors.reduce(0.0f, kernels::sum_squares);
+
+        // Backpropogate: errors * sigmoid' in place, then rank-1 updates
+        output_errors = output_errors.multiply(sigmoidPrime(final_outputs));
+        hidden_errors = hidden_errors.multiply(sigmoidPrime(hidden_outputs));
+        fixed::add_outer(output_weights, learning_rate, output_errors,
+                         hidden_outputs);
+        fixed::add_outer(hidden_weights, learning_rate, hidden_errors,
+                         input_data);
+        output_bias += learning_rate * output_errors;
+        hidden_bias += learning_rate * hidden_errors;
+        return cost;
+    }
+
+    float train_img(const Img &img) {
+        load_img(img);
+        targets.fill(0.0f);
+        targets[std::size_t(img.label)] = 1.0f; // Setting the result
+        return train(inputs, targets);
+    }
+
+    void train_batch_imgs(const std::vector<Img> &imgs,
+                          unsigned int epochs = 1) {
+        for (unsigned int e = 1; e <= epochs; e++) {
+            int i = 0;
+            double avg_cost = 0;
+            char title[32], message[32];
+            ProgressBar progress(format_text(title, "Epoch {}/{}", e, epochs),
+                                 int(imgs.size()));
+            progress.update(i);
+            for (const Img &cur_img : imgs) {
+                float cost = train_img(cur_img);
+                avg_cost += cost;
+                i++;
+                if (progress.is_due(i)) {
+                    progress.update(i, format_text(message, "Cost: {}", cost));
+                }
+            }
+            avg_cost /= imgs.size();
+            std::clog << " Avg Cost: " << avg_cost << std::endl;
+        }
+    }
+
+    // Most likely label and its softmax probability
+    Prediction classify(const Matrix<Input, 1> &input_data) {
+        feed_forward(input_data);
+        std::size_t best = final_outputs.argmax();
+        float total = 0.0f;
+        for (std::size_t o = 0; o < Output; ++o) {
+            total += std::exp(final_outputs[o] - final_outputs[best]);
+        }
+        return {best, 1.0f / total};
+    }
+
+    Prediction classify_img(const Img &img) {
+        load_img(img);
+        return classify(inputs);
+    }
+
+    double classify_imgs(const std::vector<Img> &imgs) {
+        int n_correct = 0;
+        for (const Img &cur_img : imgs) {
+            if (classify_img(cur_img).label == std::size_t(cur_img.label)) {
+                n_correct++;
+            }
+        }
+        return 1.0 * n_correct / imgs.size();
+    }
+};
+
+// Production MNIST topology
+using MnistNetwork = FixedNeuralNetwork<784, 300, 10>;
@@ -0,0 +1,321 @@
+#include "LayerStack.hpp"
+
+#include <algorithm> // max && min && sort
+#include <cassert>   // assert
+#include <cmath>     // exp
+#include <fstream>   // ifstream
+#include <iostream>  // cout && endl
+#include <stdexcept> // runtime_error
+
+#include "../math/Gemm.hpp"
+#include "../math/Kernels.hpp"
+#include "../utils/Serialization.hpp"
+#include "../utils/ThreadPool.hpp"
+#include "ModelFormat.hpp"
+
+LayerStack::LayerStack(const NeuralNetwork &net) {
+    add_layer(net.getHiddenWeights(), Activation::Sigmoid, net.getHiddenBias());
+    add_layer(net.getOutputWeights(), Activation::Sigmoid, net.getOutputBias());
+}
+
+void LayerStack::add_layer(Matrix2D weights, Activation activation,
+                           Matrix2D bias) {
+    assert(layers.empty() || weights.getRows() == getOutputs());
+    if (bias.getCols() == 0) {
+        bias = Matrix2D(weights.getCols(), 1);
+    }
+    assert(bias.getCols() == weights.getCols() && bias.getRows() == 1);
+    layers.push_back({std::move(weights), std::move(bias), activation});
+    compile(default_batch);
+}
+
+ExecutionPlan LayerStack::make_plan(std::size_t max_batch) const {
+    assert(max_batch > 0);
+    ExecutionPlan plan;
+    plan.max_batch = max_batch;
+    plan.inputs = getInputs();
+
+    // Each arena is as large as the widest layer written to it
+    std::size_t arena_size[2] = {0, 0};
+    for (std::size_t l = 0; l < layers.size(); ++l) {
+        arena_size[l % 2] = std::max(arena_size[l % 2], layers[l].getOutputs());
+    }
+    const std::size_t input_floats = plan.inputs * max_batch;
+    const std::size_t arena_offset[2] = {
+        input_floats, input_floats + arena_size[0] * max_batch};
+    for (std::size_t l = 0; l < layers.size(); ++l) {
+        plan.output_offsets.push_back(arena_offset[l % 2]);
+    }
+    plan.memory.resize(arena_offset[1] + arena_size[1] * max_batch);
+    return plan;
+}
+
+void LayerStack::compile(std::size_t max_batch) {
+    plans.clear();
+    plans.push_back(make_plan(max_batch));
+}
+
+const float *LayerStack::forward(ExecutionPlan &plan,
+                                 std::size_t count) const {
+    return run(plan, count, 0.0f);
+}
+
+const float *LayerStack::run(ExecutionPlan &plan, std::size_t count,
+                             float input_scale) const {
+    assert(count <= plan.max_batch && plan.output_offsets.size() == layers.size());
+    const float *in = plan.memory.data();
+    for (std::size_t l = 0; l < layers.size(); ++l) {
+        const DenseLayer &layer = layers[l];
+        float *out = plan.memory.data() + plan.output_offsets[l];
+        const float *bias = layer.bias.getData().data();
+        // One GEMM per layer, the bias and activation in its epilogue
+        auto dense = [&](const auto *inputs, float alpha) {
+            auto fused = [&](auto activation) {
+                gemm::sgemm(gemm::Op::N, gemm::Op::N, layer.getOutputs(),
+                            count, layer.getInputs(), alpha,
+                            layer.weights.getData().data(), layer.getInputs(),
+                            inputs, count, 0.0f, out, count,
+                            gemm::bias_activation(bias, activation));
+            };
+            switch (layer.activation) {
+            case Activation::Identity:
+                fused(kernels::identity);
+                break;
+            case Activation::Sigmoid:
+                fused(kernels::sigmoid);
+                break;
+            case Activation::Relu:
+                fused(kernels::relu);
+                break;
+            }
+        };
+        if (l == 0 && input_scale != 0.0f) {
+            dense(reinterpret_cast<const std::uint8_t *>(in), 1.0f / input_scale);
+        } else {
+            dense(in, 1.0f);
+        }
+        in = out;
+    }
+    return in;
+}
+
+template <typename Images>
+float LayerStack::load_input(const Images &imgs, std::size_t first,
+                             std::size_t count, ExecutionPlan &plan) {
+    // Images become the columns of the input in one tiled transpose; uint8
+    // datasets stay bytes, at the start of the float input region
+    ImgView first_img = imgs[first];
+    assert(first_img.size() == plan.inputs);
+    if (first_img.bytes != nullptr) {
+        gather_columns(
+            [&](std::size_t i) { return ImgView(imgs[first + i]).bytes; },
+            count, plan.inputs, reinterpret_cast<std::uint8_t *>(plan.input()));
+        return first_img.scale;
+    }
+    gather_columns(
+        [&](std::size_t i) { return ImgView(imgs[first + i]).pixels; },
+        count, plan.inputs, plan.input());
+    return 0.0f;
+}
+
+template <typename Images>
+void LayerStack::classify_batch(const Images &imgs,
+                                std::span<Prediction> predictions,
+                                unsigned int threads) {
+    assert(predictions.size() >= imgs.size() && !plans.empty());
+    ThreadPool pool(threads);
+    const std::size_t batch_size = plans[0].getMaxBatch();
+    const std::size_t n_batches = (imgs.size() + batch_size - 1) / batch_size;
+    const std::size_t n_shards = std::min<std::size_t>(pool.size(), n_batches);
+    while (plans.size() < n_shards) {
+        plans.push_back(plans[0]);
+    }
+    const std::size_t output = getOutputs();
+
+    // Each shard scores a contiguous run of batches with its own plan
+    pool.parallel_for(n_shards, [&](std::size_t s) {
+        ExecutionPlan &plan = plans[s];
+        for (std::size_t b = n_batches * s / n_shards;
+             b < n_batches * (s + 1) / n_shards; ++b) {
+            std::size_t first = b * batch_size;
+            std::size_t count = std::min<std::size_t>(batch_size, imgs.size() - first);
+            float scale = load_input(imgs, first, count, plan);
+            const float *outputs = run(plan, count, scale);
+
+            // Argmax and its softmax probability, column by column
+            for (std::size_t c = 0; c < count; ++c) {
+                std::size_t best = 0;
+                for (std::size_t o = 1; o < output; ++o) {
+                    if (outputs[o * count + c] > outputs[best * count + c]) {
+                        best = o;
+                    }
+                }
+                float max_score = outputs[best * count + c];
+                float total = 0.0f;
+                for (std::size_t o = 0; o < output; ++o) {
+                    total += std::exp(outputs[o * count + c] - max_score);
+                }
+                predictions[first + c] = {best, 1.0f / total};
+            }
+        }
+    });
+}
+
+template <typename Images>
+double LayerStack::classify_imgs(const Images &imgs) {
+    std::vector<Prediction> predictions(imgs.size());
+    classify_batch(imgs, predictions);
+    int n_correct = 0;
+    for (std::size_t i = 0; i < imgs.size(); ++i) {
+        if (predictions[i].label == std::size_t(imgs[i].label)) {
+            n_correct++;
+        }
+    }
+    return 1.0 * n_correct / imgs.size();
+}
+
+void LayerStack::save_bin(const std::string &file_string) {
+    using namespace model_format;
+    if (model_file) {
+        // Copies are always owned
+        for (DenseLayer &layer : layers) {
+            layer.weights = Matrix2D(layer.weights);
+            layer.bias = Matrix2D(layer.bias);
+        }
+        model_file.reset();
+    }
+    ModelHeader header = {};
+    header.input = std::int32_t(getInputs());
+    header.output = std::int32_t(getOutputs());
+    std::vector<Block> blocks;
+    for (std::size_t l = 0; l < layers.size(); ++l) {
+        BlockEntry entry{};
+        entry.kind = BlockKind::DenseWeights;
+        entry.layer = std::uint32_t(l);
+        entry.activation = std::uint32_t(layers[l].activation);
+        blocks.push_back({entry, &layers[l].weights});
+        BlockEntry bias{};
+        bias.kind = BlockKind::DenseBias;
+        bias.layer = std::uint32_t(l);
+        blocks.push_back({bias, &layers[l].bias});
+    }
+    write_model(file_string, header, blocks);
+    std::cout << "Successfully written to '" << file_string << "'" << std::endl;
+}
+
+void LayerStack::load_bin(const std::string &file_string) {
+    using namespace model_format;
+    auto file = std::make_shared<MappedFile>(file_string,
+                                             MappedFile::Access::CopyOnWrite);
+    if (!file->is_open()) {
+        throw std::runtime_error("Cannot open model '" + file_string + "'");
+    }
+    auto invalid = [&file_string](const char *reason) {
+        return std::runtime_error("Invalid model '" + file_string +
+                                  "': " + reason);
+    };
+    // Replaces the layers only once the whole file is read
+    std::vector<DenseLayer> loaded;
+    if (!has_magic(*file)) {
+        // Former headerless NeuralNetwork layout, imported into owned weights
+        std::ifstream legacy(file_string, std::ios::binary | std::ios::in);
+        int input, hidden, output;
+        float learning_rate;
+        read(legacy, input);
+        read(legacy, hidden);
+        read(legacy, output);
+        read(legacy, learning_rate);
+        Matrix2D hidden_weights, output_weights;
+        hidden_weights.load_bin(legacy);
+        output_weights.load_bin(legacy);
+        if (!legacy || output_weights.getRows() != hidden_weights.getCols()) {
+            throw invalid("truncated");
+        }
+        Matrix2D hidden_bias(hidden_weights.getCols(), 1);
+        Matrix2D output_bias(output_weights.getCols(), 1);
+        loaded.push_back({std::move(hidden_weights), std::move(hidden_bias),
+                          Activation::Sigmoid});
+        loaded.push_back({std::move(output_weights), std::move(output_bias),
+                          Activation::Sigmoid});
+        file.reset();
+    } else {
+        check_model(*file, file_string);
+        std::vector<BlockEntry> dense;
+        std::vector<BlockEntry> biases;
+        const BlockEntry *hidden_entry = nullptr;
+        const BlockEntry *output_entry = nullptr;
+        for (const BlockEntry &entry : block_table(*file)) {
+            if (entry.kind == BlockKind::DenseWeights) {
+                dense.push_back(entry);
+            } else if (entry.kind == BlockKind::DenseBias) {
+                biases.push_back(entry);
+            } else if (entry.kind == BlockKind::HiddenWeights) {
+                hidden_entry = &entry;
+            } else if (entry.kind == BlockKind::OutputWeights) {
+                output_entry = &entry;
+            } else if (entry.kind == BlockKind::HiddenBias ||
+                       entry.kind == BlockKind::OutputBias) {
+                BlockEntry bias = entry;
+                bias.layer = entry.kind == BlockKind::HiddenBias ? 0 : 1;
+                biases.push_back(bias);
+            }
+        }
+        if (dense.empty()) {
+            // Saved by a NeuralNetwork: two sigmoid layers
+            if (hidden_entry == nullptr || output_entry == nullptr) {
+                throw invalid("missing weights");
+            }
+            dense = {*hidden_entry, *output_entry};
+            for (std::uint32_t l = 0; l < 2; ++l) {
+                dense[l].layer = l;
+                dense[l].activation = std::uint32_t(Activation::Sigmoid);
+            }
+        } else {
+            std::sort(dense.begin(), dense.end(),
+                      [](const BlockEntry &a, const BlockEntry &b) {
+                          return a.layer < b.layer;
+                      });
+        }
+        for (std::size_t l = 0; l < dense.size(); ++l) {
+            if (dense[l].layer != l) {
+                throw invalid("missing layer");
+            }
+            if (dense[l].activation > std::uint32_t(Activation::Relu)) {
+                throw invalid("unknown activation");
+            }
+            if (l > 0 && dense[l].rows != dense[l - 1].cols) {
+                throw invalid("mismatched layers");
+            }
+            // Models saved before biases existed have none
+            Matrix2D bias(dense[l].cols, 1);
+            for (const BlockEntry &entry : biases) {
+                if (entry.layer == l) {
+                    if (entry.cols != dense[l].cols || entry.rows != 1) {
+                        throw invalid("mismatched bias");
+                    }
+                    bias = map_block(*file, entry);
+                }
+            }
+            loaded.push_back({map_block(*file, dense[l]), std::move(bias),
+                              Activation(dense[l].activation)});
+        }
+    }
+    layers = std::move(loaded);
+    model_file = std::move(file);
+    compile(default_batch);
+    std::cout << "Successfully loaded from '" << file_string << "'"
+              << std::endl;
+}
+
+// Supported image containers
+#define INSTANTIATE_FOR_IMAGES(Images)                                         \
+    template void LayerStack::classify_batch(                                  \
+        const Images &, std::span<Prediction>, unsigned int);                  \
+    template double LayerStack::classify_imgs(const Images &);
+
+INSTANTIATE_FOR_IMAGES(std::vector<Img>)
+INSTANTIATE_FOR_IMAGES(MappedDataset)
+INSTANTIATE_FOR_IMAGES(Dataset)
+INSTANTIATE_FOR_IMAGES(Dataset::Batch)
+
+#undef INSTANTIATE_FOR_IMAGES
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstddef> // size_t
+#include <cstdint> // uint32_t
+#include <memory>  // shared_ptr
+#include <span>    // span
+#include <string>  // string
+#include <vector>  // vector
+
+#include "../math/Matrix2D.hpp"
+#include "../utils/MappedFile.hpp"
+#include "NeuralNetwork.hpp"
+
+// Activation of a layer, stored in the model file
+enum class Activation : std::uint32_t { Identity = 0, Sigmoid = 1, Relu = 2 };
+
+// Fully connected layer: outputs = activation(weights * inputs + bias)
+struct DenseLayer {
+    Matrix2D weights; // outputs x inputs
+    Matrix2D bias;    // outputs x 1
+    Activation activation = Activation::Sigmoid;
+
+    std::size_t getInputs() const { return weights.getRows(); }
+    std::size_t getOutputs() const { return weights.getCols(); }
+};
+
+// Buffers of a forward pass through a LayerStack, laid out once for a
+// maximum batch size in a single allocation:
+//   input     inputs x max_batch, floats or bytes
+//   arena 0   outputs of layers 0, 2, 4, ...
+//   arena 1   outputs of layers 1, 3, 5, ...
+// Each layer reads the arena the previous one wrote and writes the other, so
+// each arena is sized for the widest layer it holds and the memory does not
+// grow with the depth of the stack.
+class ExecutionPlan {
+    friend class LayerStack;
+
+    std::size_t max_batch = 0;
+    std::size_t inputs = 0;
+    std::vector<std::size_t> output_offsets; // Per layer, into memory
+    MatrixStorage memory;
+
+  public:
+    // Input of a pass of count samples: inputs x count, one sample per
+    // column
+    float *input() { return memory.data(); }
+
+    // getters
+    std::size_t getMaxBatch() const { return max_batch; }
+    // Floats allocated
+    std::size_t size() const { return memory.size(); }
+};
+
+// Inference engine for a stack of dense layers of any depth and activations.
+//
+// The stack is compiled into an ExecutionPlan when it is loaded or built, so
+// a forward pass is a sequence of GEMMs between fixed buffers, each adding
+// the bias and applying the activation in its epilogue, and does not
+// allocate. Models saved by NeuralNetwork (two
+// sigmoid layers) load unchanged; deeper stacks are saved with one block per
+// layer (see ModelFormat.hpp). Like NeuralNetwork::load_bin, weights are
+// used in place from the mapped model file.
+class LayerStack {
+    std::vector<DenseLayer> layers;
+    // Copy-on-write mapping of the model file the weights were loaded from
+    std::shared_ptr<MappedFile> model_file;
+    // One plan per classification thread, plans[0] compiled with the stack
+    std::vector<ExecutionPlan> plans;
+
+    // Copies images [first, first + count) into the input of plan. Returns
+    // the scale of uint8 images, kept as bytes, or 0 for float images
+    template <typename Images>
+    static float load_input(const Images &imgs, std::size_t first,
+                            std::size_t count, ExecutionPlan &plan);
+    // forward on an input of floats (input_scale == 0) or of bytes, pixel =
+    // byte / input_scale, dequantized inside the first GEMM
+    const float *run(ExecutionPlan &plan, std::size_t count,
+                     float input_scale) const;
+
+  public:
+    static constexpr std::size_t default_batch = 256;
+
+    LayerStack() = default;
+    // The two sigmoid layers of net
+    explicit LayerStack(const NeuralNetwork &net);
+
+    // Appends a layer, whose inputs must match the outputs of the last one,
+    // and recompiles the plan. An empty bias is zero
+    void add_layer(Matrix2D weights, Activation activation,
+                   Matrix2D bias = {});
+
+    // Plan for batches of up to max_batch samples
+    ExecutionPlan make_plan(std::size_t max_batch) const;
+    // Replaces the plans used by classify_batch
+    void compile(std::size_t max_batch);
+
+    // Forward pass of count samples written to plan.input(). Returns the
+    // outputs (outputs x count, one sample per column), inside the plan
+    const float *forward(ExecutionPlan &plan, std::size_t count) const;
+
+    // Labels and softmax confidences of all images (a std::vector<Img>,
+    // MappedDataset, Dataset or Dataset::Batch, instantiated in
+    // LayerStack.cpp), in batches of the compiled size spread over threads
+    // threads (0 = one per hardware core). Each thread has its own plan,
+    // allocated on its first use
+    template <typename Images>
+    void classify_batch(const Images &imgs, std::span<Prediction> predictions,
+                        unsigned int threads = 0);
+    // Fraction of correctly classified images
+    template <typename Images> double classify_imgs(const Images &imgs);
+
+    // Binary model in the format of ModelFormat.hpp, replacing the file
+    // once written. Weights borrowed from a model file are copied to owned
+    // memory first, so the file can be replaced. Throws std::runtime_error
+    // when the file cannot be written
+    void save_bin(const std::string &file_string);
+    // Maps a binary model, written by a LayerStack or a NeuralNetwork
+    // (former headerless layout included), and compiles it for
+    // default_batch. Throws std::runtime_error when the file is missing or
+    // malformed
+    void load_bin(const std::string &file_string);
+
+    // getters
+    const std::vector<DenseLayer> &getLayers() const { return layers; }
+    std::size_t getInputs() const {
+        return layers.empty() ? 0 : layers.front().getInputs();
+    }
+    std::size_t getOutputs() const {
+        return layers.empty() ? 0 : layers.back().getOutputs();
+    }
+};
@@ -0,0 +1,144 @@
+#include "ModelFormat.hpp"
+
+#include <algorithm>    // equal
+#include <filesystem>   // rename
+#include <fstream>      // ofstream
+#include <stdexcept>    // runtime_error
+#include <system_error> // error_code
+#include <vector>       // vector
+
+#include "../utils/Checksum.hpp"
+
+namespace model_format {
+
+using namespace file_format;
+
+void write_model(const std::string &file_string, ModelHeader header,
+                 std::span<Block> blocks) {
+    // Written aside then renamed over the target, so a model mapped from the
+    // target keeps its pages and a failed write leaves the target intact
+    const std::string temporary = file_string + ".tmp";
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc | std::ios::out);
+    if (!file.is_open()) {
+        throw std::runtime_error("Cannot write model '" + file_string + "'");
+    }
+    stamp_header(header, magic, version);
+    header.block_count = std::uint32_t(blocks.size());
+    header.table_offset = align_up(sizeof(ModelHeader));
+    header.checksum = 0;
+    std::vector<BlockEntry> table;
+    std::uint64_t offset =
+        align_up(header.table_offset + blocks.size() * sizeof(BlockEntry));
+    for (Block &block : blocks) {
+        if (block.weights != nullptr) {
+            block.entry.cols = std::uint32_t(block.weights->getCols());
+            block.entry.rows = std::uint32_t(block.weights->getRows());
+        }
+        block.entry.offset = offset;
+        table.push_back(block.entry);
+        offset = align_up(offset + std::uint64_t(block.entry.cols) *
+                                       block.entry.rows * sizeof(float));
+    }
+    header.file_size = offset;
+
+    // One write per section, summed on the way; the header is written again
+    // once the checksum is known
+    Fletcher64 checksum;
+    auto emit = [&](const void *data, std::size_t bytes) {
+        file.write(static_cast<const char *>(data), std::streamsize(bytes));
+        checksum.update(data, bytes);
+    };
+    auto emit_padding = [&](std::uint64_t target) {
+        static const char zeros[alignment] = {};
+        emit(zeros, std::size_t(target - std::uint64_t(file.tellp())));
+    };
+    emit(&header, sizeof(header));
+    emit_padding(header.table_offset);
+    emit(table.data(), table.size() * sizeof(BlockEntry));
+    for (const Block &block : blocks) {
+        emit_padding(block.entry.offset);
+        emit(block.weights != nullptr ? block.weights->getData().data()
+                                      : block.record,
+             std::size_t(block.entry.cols) * block.entry.rows * sizeof(float));
+    }
+    emit_padding(header.file_size);
+    header.checksum = checksum.value();
+    file.seekp(0);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.close();
+    std::error_code error;
+    if (file) {
+        std::filesystem::rename(temporary, file_string, error);
+    }
+    if (!file || error) {
+        std::filesystem::remove(temporary, error);
+        throw std::runtime_error("Cannot write model '" + file_string + "'");
+    }
+}
+
+bool has_magic(const MappedFile &file) {
+    return file.size() >= sizeof(magic) &&
+           std::equal(std::begin(magic), std::end(magic), file.data());
+}
+
+void check_model(const MappedFile &file, const std::string &file_string) {
+    auto invalid = [&file_string](const char *reason) {
+        return std::runtime_error("Invalid model '" + file_string +
+                                  "': " + reason);
+    };
+    if (file.size() < sizeof(ModelHeader)) {
+        throw invalid("file too small");
+    }
+    const auto *header = reinterpret_cast<const ModelHeader *>(file.data());
+    check_header(*header, magic, version, version, invalid);
+    if (header->file_size > file.size() ||
+        header->file_size < sizeof(ModelHeader) ||
+        header->file_size % alignment != 0) {
+        throw invalid("truncated");
+    }
+    if (header->table_offset % alignment != 0 ||
+        !fits(header->table_offset, header->block_count, sizeof(BlockEntry),
+              header->file_size)) {
+        throw invalid("bad block table");
+    }
+    const auto *table = reinterpret_cast<const BlockEntry *>(
+        file.data() + header->table_offset);
+    for (std::uint32_t b = 0; b < header->block_count; ++b) {
+        const BlockEntry &entry = table[b];
+        if (entry.offset % alignment != 0 ||
+            !fits(entry.offset, std::uint64_t(entry.cols) * entry.rows,
+                  sizeof(float), header->file_size)) {
+            throw invalid("bad block");
+        }
+    }
+    ModelHeader unsummed = *header;
+    unsummed.checksum = 0;
+    Fletcher64 checksum;
+    checksum.update(&unsummed, sizeof(unsummed));
+    checksum.update(file.data() + sizeof(ModelHeader),
+                    std::size_t(header->file_size) - sizeof(ModelHeader));
+    if (checksum.value() != header->checksum) {
+        throw invalid("checksum mismatch");
+    }
+}
+
+const ModelHeader &model_header(const MappedFile &file) {
+    return *reinterpret_cast<const ModelHeader *>(file.data());
+}
+
+std::span<const BlockEntry> block_table(const MappedFile &file) {
+    const ModelHeader &header = model_header(file);
+    return {reinterpret_cast<const BlockEntry *>(file.data() +
+                                                 header.table_offset),
+            header.block_count};
+}
+
+Matrix2D map_block(MappedFile &file, const BlockEntry &entry) {
+    auto *weights =
+        reinterpret_cast<float *>(file.writable_data() + entry.offset);
+    return Matrix2D(entry.cols, entry.rows,
+                    MatrixStorage::borrow(weights, std::size_t(entry.cols) *
+                                                       entry.rows));
+}
+
+} // namespace model_format
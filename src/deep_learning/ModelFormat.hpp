@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstddef> // size_t
+#include <cstdint> // uint32_t && uint64_t && int32_t
+#include <span>    // span
+#include <string>  // string
+
+#include "../math/Matrix2D.hpp"
+#include "../utils/FileFormat.hpp"
+#include "../utils/MappedFile.hpp"
+
+// Binary model file (.net-bin), designed to be memory-mapped and used in
+// place.
+//
+// Layout (conventions in FileFormat.hpp):
+//   ModelHeader                            64 bytes
+//   BlockEntry[block_count]                at table_offset, 64-byte aligned
+//   blocks: cols x rows 4-byte words, each at the offset of its entry,
+//           64-byte aligned; float matrices, row-major like Matrix2D, except
+//           the OptimizerSettings record
+// The file is padded to a multiple of 64 bytes. checksum is the Fletcher64
+// of the whole file, computed with the checksum field set to 0.
+// A NeuralNetwork stores HiddenWeights, OutputWeights, HiddenBias and
+// OutputBias blocks; a LayerStack stores one DenseWeights and one DenseBias
+// block per layer, with its position (and activation) in the entry. Biases
+// are n x 1 matrices; models written before biases existed have none, which
+// loads as zero biases.
+// A NeuralNetwork trained with an optimizer that has state (see
+// Optimizer.hpp) also stores an OptimizerSettings block and an
+// OptimizerState block per state tensor, so training resumes where it
+// stopped. The settings block holds one OptimizerRecord. A state block names
+// its parameter in layer, as the kind of the parameter's block
+// (HiddenWeights...), and its tensor in slot (velocity or first moment 0,
+// second moment 1).
+// epoch and sample locate a checkpoint in its training run (epochs
+// completed, samples trained in the next one), both 0 in a final model.
+//
+// Version 1 is the former headerless layout (int input, hidden, output,
+// float learning rate, then for each matrix size_t cols, rows and the
+// floats), still accepted by NeuralNetwork::load_bin.
+namespace model_format {
+
+constexpr char magic[4] = {'N', 'N', 'M', 'D'};
+constexpr std::uint32_t version = 2;
+
+enum class BlockKind : std::uint32_t {
+    HiddenWeights = 0,
+    OutputWeights = 1,
+    DenseWeights = 2,
+    HiddenBias = 3,
+    OutputBias = 4,
+    DenseBias = 5,
+    OptimizerState = 6,
+    OptimizerSettings = 7
+};
+
+struct ModelHeader {
+    char magic[4];
+    std::uint32_t version;
+    std::uint32_t endian_marker;
+    std::uint32_t block_count;
+    std::int32_t input;
+    std::int32_t hidden;
+    std::int32_t output;
+    float learning_rate;
+    std::uint64_t table_offset;
+    std::uint64_t file_size;
+    std::uint64_t checksum;
+    std::uint32_t epoch;
+    std::uint32_t sample;
+};
+static_assert(sizeof(ModelHeader) == 64);
+
+struct BlockEntry {
+    BlockKind kind;
+    std::uint32_t cols;
+    std::uint32_t rows;
+    // DenseWeights/DenseBias: position in the stack. OptimizerState: kind of
+    // the block of the parameter
+    std::uint32_t layer;
+    std::uint64_t offset;
+    std::uint32_t activation; // DenseWeights: see Activation in LayerStack.hpp
+    std::uint32_t slot;       // OptimizerState: tensor of the parameter
+};
+static_assert(sizeof(BlockEntry) == 32);
+
+// Contents of the OptimizerSettings block, 8 x 1 words
+struct OptimizerRecord {
+    std::uint32_t kind; // OptimizerKind, see Optimizer.hpp
+    float momentum;
+    float beta1;
+    float beta2;
+    float epsilon;
+    std::uint32_t reserved;
+    std::uint64_t steps;
+};
+static_assert(sizeof(OptimizerRecord) == 32);
+
+// A block to write: its entry (offset filled in by write_model) and either
+// weights, or a record of entry.cols x entry.rows words
+struct Block {
+    BlockEntry entry;
+    const Matrix2D *weights;
+    const void *record = nullptr;
+};
+
+// Writes a model made of header and blocks; the header fields describing the
+// file itself (magic to table_offset, file_size, checksum) are filled in.
+// The model goes to file_string + ".tmp", renamed over file_string once
+// complete. Throws std::runtime_error when the file cannot be written
+void write_model(const std::string &file_string, ModelHeader header,
+                 std::span<Block> blocks);
+
+// Whether a mapped file starts with the magic, unlike the version 1 layout
+bool has_magic(const MappedFile &file);
+
+// Validates a mapped model file, throwing std::runtime_error. Reads the
+// whole file to verify the checksum
+void check_model(const MappedFile &file, const std::string &file_string);
+
+// Header and block table of a checked model
+const ModelHeader &model_header(const MappedFile &file);
+std::span<const BlockEntry> block_table(const MappedFile &file);
+
+// Weights of a block of a checked model, borrowed from the mapping
+Matrix2D map_block(MappedFile &file, const BlockEntry &entry);
+
+} // namespace model_format
@@ -1,11 +1,21 @@
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstring>
 #include <fstream>
 #include <iostream>
-#include <format>
+#include <stdexcept>
 #include <string>
+#include <vector>
 
 #include "../math/Activation.hpp"
 #include "../math/Calculus.hpp"
+#include "../math/Kernels.hpp"
 #include "../utils/ProgressBar.hpp"
+#include "../utils/ThreadPool.hpp"
+#include "Checkpointer.hpp"
+#include "ModelFormat.hpp"
 #include "NeuralNetwork.hpp"
 
 NeuralNetwork::NeuralNetwork(int input, int hidden, int output, float lr) {
@@ -19,19 +29,134 @@ NeuralNetwork::NeuralNetwork(int input, int hidden, int output, float lr) {
     output_layer.randomize(output);
     this->hidden_weights = std::move(hidden_layer);
     this->output_weights = std::move(output_layer);
+    this->hidden_bias = Matrix2D(hidden, 1);
+    this->output_bias = Matrix2D(output, 1);
+    this->workspace = TrainingWorkspace(input, hidden, output);
 }
 
-float NeuralNetwork::train(const Matrix2D &input_data,
-                          const Matrix2D &output_data) {
+NeuralNetwork::NeuralNetwork(float lr, Matrix2D hidden_weights,
+                             Matrix2D output_weights, Matrix2D hidden_bias,
+                             Matrix2D output_bias) {
+    assert(output_weights.getRows() == hidden_weights.getCols());
+    this->input = int(hidden_weights.getRows());
+    this->hidden = int(hidden_weights.getCols());
+    this->output = int(output_weights.getCols());
+    this->learning_rate = lr;
+    this->hidden_weights = std::move(hidden_weights);
+    this->output_weights = std::move(output_weights);
+    this->hidden_bias = hidden_bias.getCols() == 0 ? Matrix2D(hidden, 1)
+                                                   : std::move(hidden_bias);
+    this->output_bias = output_bias.getCols() == 0 ? Matrix2D(output, 1)
+                                                   : std::move(output_bias);
+    assert(this->hidden_bias.getCols() == std::size_t(hidden) &&
+           this->output_bias.getCols() == std::size_t(output));
+    this->workspace = TrainingWorkspace(input, hidden, output);
+}
+
+namespace {
+
+// Calls f with the input of the batch loaded in ws: the uint8 samples when
+// they were kept compact, else the float matrix, as a SparseInput over the
+// active blocks when the batch has enough blank inputs
+template <typename F>
+decltype(auto) with_batch_input(TrainingWorkspace &ws, F &&f) {
+    auto call = [&](const auto &in) -> decltype(auto) {
+        if (ws.sparse_input) {
+            using Dense = std::decay_t<decltype(in)>;
+            return f(SparseInput<Dense>{in, ws.active_blocks});
+        }
+        return f(in);
+    };
+    if (ws.input_scale != 0.0f) {
+        return call(ws.byte_input());
+    }
+    return call(std::as_const(ws.input));
+}
+
+// out = x * y^T, the summed weight gradient of a batch of deltas x and
+// inputs y
+template <typename Input>
+void outer_product(const Matrix2D &x, const Input &y, Matrix2D &out) {
+    out.assign_dot(x, y, gemm::Op::N, gemm::Op::T);
+}
+
+// Same for a sparse y: only the columns of its active blocks are nonzero
+template <typename Dense>
+void outer_product(const Matrix2D &x, const SparseInput<Dense> &y,
+                   Matrix2D &out) {
+    out.resize(x.getCols(), y.getCols());
+    out.fill(0.0f);
+    out.add_outer(1.0f, x, y);
+}
+
+// out (n x 1) = alpha * sums of the rows of m (n x count) + beta * out: the
+// bias gradient of a batch of deltas, one sample per column
+void row_sums(const Matrix2D &m, float alpha, float beta, Matrix2D &out) {
+    if (beta == 0.0f) {
+        out.resize(m.getCols(), 1);
+    }
+    assert(out.getCols() == m.getCols());
+    const std::size_t count = m.getRows();
+    const float *row = m.getData().data();
+    for (std::size_t r = 0; r < m.getCols(); ++r, row += count) {
+        float sum = alpha * kernels::sum(0.0f, row, count);
+        out[r] = beta == 0.0f ? sum : sum + beta * out[r];
+    }
+}
+
+// Weight and bias gradients of the batch backpropagated in ws, summed over
+// its samples
+template <typename Input> void gradients(const Input &in, TrainingWorkspace &ws) {
+    ws.output_gradient.assign_dot(ws.output_deltas, ws.hidden_outputs,
+                                  gemm::Op::N, gemm::Op::T);
+    outer_product(ws.hidden_deltas, in, ws.hidden_gradient);
+    row_sums(ws.output_deltas, 1.0f, 0.0f, ws.output_bias_gradient);
+    row_sums(ws.hidden_deltas, 1.0f, 0.0f, ws.hidden_bias_gradient);
+}
+
+// Blocks of the parameters, in the order the optimizer numbers them
+constexpr model_format::BlockKind parameter_blocks[] = {
+    model_format::BlockKind::HiddenWeights, model_format::BlockKind::OutputWeights,
+    model_format::BlockKind::HiddenBias, model_format::BlockKind::OutputBias};
+
+} // namespace
+
+// Forward pass over a batch (one sample per column), leaving the activations
+// of both layers in ws. Each layer is a single GEMM whose epilogue adds the
+// bias and applies the sigmoid to the output tiles while they are in
+// registers
+template <typename Input>
+void NeuralNetwork::feed_forward(const Input &input_data,
+                                 TrainingWorkspace &ws) const {
+    ws.hidden_outputs.assign_dot(
+        hidden_weights, input_data,
+        gemm::bias_activation(hidden_bias.getData().data(), kernels::sigmoid));
+    ws.final_outputs.assign_dot(
+        output_weights, ws.hidden_outputs,
+        gemm::bias_activation(output_bias.getData().data(), kernels::sigmoid));
+}
+
+// Forward and backward pass over a batch (one sample per column) with the
+// current weights. Leaves the outputs and deltas of both layers in ws and
+// returns the summed squared error. Does not modify the network.
+template <typename Input>
+float NeuralNetwork::backpropagate(const Input &input_data,
+                                   const Matrix2D &output_data,
+                                   TrainingWorkspace &ws) const {
+    Matrix2D &hidden_outputs = ws.hidden_outputs;
+    Matrix2D &final_outputs = ws.final_outputs;
+    Matrix2D &output_errors = ws.output_errors;
+
     // Feed forward
-    Matrix2D hidden_outputs = hidden_weights * input_data;
-    hidden_outputs.apply(sigmoid);
-    Matrix2D final_outputs = output_weights * hidden_outputs;
-    final_outputs.apply(sigmoid);
+    feed_forward(input_data, ws);
 
-    // Find errors
-    Matrix2D output_errors = output_data - final_outputs;
-    Matrix2D hidden_errors = output_weights.transpose() * output_errors;
+    // Find errors: output errors, deltas and cost in one pass over the outputs
+    output_errors.resize(final_outputs.getCols(), final_outputs.getRows());
+    ws.output_deltas.resize(final_outputs.getCols(), final_outputs.getRows());
+    float cost = kernels::sigmoid_output_deltas(
+        output_data.getData().data(), final_outputs.getData().data(),
+        output_errors.getData().data(), ws.output_deltas.getData().data(),
+        final_outputs.getData().size());
 
     // Backpropogate
     // output_weights = add(
@@ -47,15 +172,6 @@ float NeuralNetwork::train(const Matrix2D &input_data,
     // 				)
     //		 )
     // )
-    Matrix2D sigmoid_primed_mat = sigmoidPrime(final_outputs);
-    Matrix2D multiplied_mat = output_errors.multiply(sigmoid_primed_mat);
-    Matrix2D transposed_mat = hidden_outputs.transpose();
-    Matrix2D dot_mat = multiplied_mat * transposed_mat;
-    Matrix2D scaled_mat = learning_rate * dot_mat;
-    Matrix2D added_mat = output_weights + scaled_mat;
-
-    output_weights = added_mat;
-
     // hidden_weights = add(
     // 	 net->hidden_weights,
     // 	 scale (
@@ -69,42 +185,314 @@ float NeuralNetwork::train(const Matrix2D &input_data,
     //      )
     // 	 )
     // )
-    // Reusing variables after freeing memory
-    sigmoid_primed_mat = sigmoidPrime(hidden_outputs);
-    multiplied_mat = hidden_errors.multiply(sigmoid_primed_mat);
-    transposed_mat = input_data.transpose();
-    dot_mat = multiplied_mat * transposed_mat;
-    scaled_mat = learning_rate * dot_mat;
-    added_mat = hidden_weights + scaled_mat;
+    // The hidden errors (output_weights^T * output_errors) are multiplied by
+    // sigmoidPrime(hidden_outputs) in the epilogue of their GEMM, so only
+    // the deltas are written. The dot products with the transposed
+    // activations are left to the caller
+    ws.hidden_deltas.assign_dot(
+        output_weights, output_errors,
+        gemm::scale_by_derivative(hidden_outputs.getData().data(),
+                                  hidden_outputs.getRows(),
+                                  kernels::sigmoid_prime),
+        gemm::Op::T);
+
+    return cost;
+}
 
-    hidden_weights = added_mat;
+// One training step. Each column of input_data/output_data is a sample, the
+// gradients are averaged over the columns and applied in a single update
+template <typename Input>
+float NeuralNetwork::train_step(const Input &input_data,
+                                const Matrix2D &output_data) {
+    assert(input_data.getRows() == output_data.getRows());
+    const float step = learning_rate / float(input_data.getRows());
 
-    float cost = output_errors.reduce<float>(0.0, [] (float a, float b) { return a + b * b; });
+    // Every intermediate lives in the workspace, so a step does not allocate
+    float cost = backpropagate(input_data, output_data, workspace);
+
+    if (optimizer.getSettings().kind != OptimizerKind::Sgd) {
+        // The optimizer reads the gradients along with its state
+        gradients(input_data, workspace);
+        apply_gradients(workspace, input_data.getRows());
+        return cost;
+    }
+
+    // The scaled outer products are accumulated straight into the weights
+    output_weights.add_outer(step, workspace.output_deltas,
+                             workspace.hidden_outputs);
+    hidden_weights.add_outer(step, workspace.hidden_deltas, input_data);
+    row_sums(workspace.output_deltas, step, 1.0f, output_bias);
+    row_sums(workspace.hidden_deltas, step, 1.0f, hidden_bias);
 
     return cost;
 }
 
-void NeuralNetwork::train_batch_imgs(const std::vector<Img> &imgs,
-                                     unsigned int epochs) {
+void NeuralNetwork::apply_gradients(const TrainingWorkspace &ws,
+                                    std::size_t count) {
+    optimizer.begin_step();
+    optimizer.update(0, hidden_weights, ws.hidden_gradient, learning_rate, count);
+    optimizer.update(1, output_weights, ws.output_gradient, learning_rate, count);
+    optimizer.update(2, hidden_bias, ws.hidden_bias_gradient, learning_rate, count);
+    optimizer.update(3, output_bias, ws.output_bias_gradient, learning_rate, count);
+}
+
+float NeuralNetwork::train(const Matrix2D &input_data,
+                          const Matrix2D &output_data) {
+    return train_step(input_data, output_data);
+}
+
+float NeuralNetwork::train(const ByteMatrix &input_data,
+                          const Matrix2D &output_data) {
+    return train_step(input_data, output_data);
+}
+
+float NeuralNetwork::train_img(const Img &img) {
+    // Back to a single sample after mini-batch training
+    workspace.resize(1);
+    // 0 = flatten to column vector
+    img.img_data.flatten(0, workspace.input);
+    workspace.input_scale = 0.0f;
+    workspace.find_active_inputs();
+    workspace.target.fill(0.0f);
+    workspace.target[img.label] = 1.0f; // Setting the result
+    return with_batch_input(workspace, [this](const auto &in) {
+        return train_step(in, workspace.target);
+    });
+}
+
+template <typename Images>
+void NeuralNetwork::load_batch(const Images &imgs, std::size_t first,
+                               std::size_t count, TrainingWorkspace &ws) {
+    // Image i of the batch becomes column i of the input/target matrices
+    ws.resize(count);
+    ws.input_scale = 0.0f;
+    if constexpr (requires {
+                      imgs.gather_bytes(first, count, ws.input_bytes,
+                                        ws.target, ws.target.getCols());
+                  }) {
+        // Compact datasets stay uint8, the first layer dequantizes
+        if (imgs.is_compact()) {
+            imgs.gather_bytes(first, count, ws.input_bytes, ws.target,
+                              ws.target.getCols());
+            ws.input_scale = imgs.getScale();
+            ws.find_active_inputs();
+            return;
+        }
+    }
+    if constexpr (requires {
+                      imgs.gather(first, count, ws.input, ws.target,
+                                  ws.target.getCols());
+                  }) {
+        // Contiguous datasets copy the whole batch in one pass
+        imgs.gather(first, count, ws.input, ws.target, ws.target.getCols());
+    } else {
+        float *inputs = ws.input.getData().data();
+        for (std::size_t i = 0; i < count; ++i) {
+            ImgView(imgs[first + i]).copy_to(inputs + i, count);
+        }
+        one_hot_columns([&](std::size_t i) { return imgs[first + i].label; },
+                        count, ws.target.getCols(), ws.target);
+    }
+    ws.find_active_inputs();
+}
+
+void NeuralNetwork::advance(unsigned int epoch, std::size_t sample,
+                            std::size_t epoch_size, std::size_t count) {
+    position = sample < epoch_size ? TrainingPosition{epoch - 1, sample}
+                                   : TrainingPosition{epoch, 0};
+    if (checkpointer) {
+        checkpointer->step(*this, count);
+    }
+}
+
+template <typename Images>
+void NeuralNetwork::train_minibatch(const Images &imgs,
+                                    unsigned int batch_size,
+                                    unsigned int epochs) {
+    assert(batch_size > 0);
+    assert(position.sample <= imgs.size());
+    workspace.resize(batch_size);
+    for (unsigned int e = position.epoch + 1; e <= epochs; e++) {
+        const std::size_t first = position.sample;
+        std::size_t i = first;
+        double avg_cost = 0;
+        // Title and messages are formatted into buffers, so a steady-state
+        // epoch does not allocate
+        char title[32], message[32];
+        ProgressBar progress(format_text(title, "Epoch {}/{}", e, epochs), int(imgs.size()));
+        progress.update(int(i));
+        while (i < imgs.size()) {
+            std::size_t count = std::min<std::size_t>(batch_size, imgs.size() - i);
+            load_batch(imgs, i, count, workspace);
+            float cost = with_batch_input(workspace, [this](const auto &in) {
+                return train_step(in, workspace.target);
+            });
+            avg_cost += cost;
+            i += count;
+            advance(e, i, imgs.size(), count);
+            if (progress.is_due(int(i))) {
+                progress.update(int(i), format_text(message, "Cost: {}", cost / count));
+            }
+        }
+        avg_cost /= imgs.size() - first;
+        std::clog << " Avg Cost: " << avg_cost << std::endl;
+    }
+    position = {};
+}
+
+void NeuralNetwork::train_stream(StreamingLoader &loader, unsigned int epochs) {
     for (unsigned int e = 1; e <= epochs; e++) {
-        int i = 0;
+        std::size_t i = 0;
         double avg_cost = 0;
-        ProgressBar progress(std::format("Epoch {}/{}", e, epochs), int(imgs.size()));
+        char title[32], message[32];
+        ProgressBar progress(format_text(title, "Epoch {}/{}", e, epochs), int(loader.size()));
+        progress.update(0);
+        // The loader fills the next batches in the background meanwhile
+        for (const Dataset &batch : loader) {
+            load_batch(batch, 0, batch.size(), workspace);
+            float cost = with_batch_input(workspace, [this](const auto &in) {
+                return train_step(in, workspace.target);
+            });
+            avg_cost += cost;
+            i += batch.size();
+            advance(e, i, loader.size(), batch.size());
+            if (progress.is_due(int(i))) {
+                progress.update(int(i), format_text(message, "Cost: {}", cost / batch.size()));
+            }
+        }
+        avg_cost /= loader.size();
+        std::clog << " Avg Cost: " << avg_cost << std::endl;
+    }
+    position = {};
+}
+
+template <typename Images>
+void NeuralNetwork::train_parallel(const Images &imgs,
+                                   unsigned int batch_size,
+                                   unsigned int epochs,
+                                   unsigned int threads) {
+    assert(batch_size > 0);
+    ThreadPool pool(threads);
+    // Shards of shard_samples samples or more, however many threads run
+    // them, so the sums and the result do not depend on the thread count
+    constexpr std::size_t shard_samples = 8;
+    const std::size_t n_shards =
+        std::max<std::size_t>(1, batch_size / shard_samples);
+
+    // Each shard owns its buffers, gradients included, so workers never
+    // share writable memory until the reduction
+    std::vector<TrainingWorkspace> shards(
+        n_shards, TrainingWorkspace(input, hidden, output,
+                                    (batch_size + n_shards - 1) / n_shards));
+    std::vector<float> shard_costs(n_shards);
+    std::vector<double> shard_seconds(n_shards);
+
+    assert(position.sample <= imgs.size());
+    for (unsigned int e = position.epoch + 1; e <= epochs; e++) {
+        const std::size_t first = position.sample;
+        std::size_t i = first;
+        double avg_cost = 0;
+        double busy_seconds = 0;
+        auto epoch_start = std::chrono::steady_clock::now();
+        char title[32], message[32];
+        ProgressBar progress(format_text(title, "Epoch {}/{}", e, epochs), int(imgs.size()));
+        progress.update(int(i));
+        while (i < imgs.size()) {
+            std::size_t count = std::min<std::size_t>(batch_size, imgs.size() - i);
+            std::size_t used = std::clamp<std::size_t>(
+                count / shard_samples, 1, n_shards);
+
+            // Shard s takes a fixed slice of the batch, so the result does
+            // not depend on which thread runs it
+            pool.parallel_for(used, [&](std::size_t s) {
+                auto start = std::chrono::steady_clock::now();
+                std::size_t first = i + count * s / used;
+                std::size_t last = i + count * (s + 1) / used;
+                TrainingWorkspace &ws = shards[s];
+                load_batch(imgs, first, last - first, ws);
+                with_batch_input(ws, [&](const auto &in) {
+                    shard_costs[s] = backpropagate(in, ws.target, ws);
+                    gradients(in, ws);
+                });
+                shard_seconds[s] = std::chrono::duration<double>(
+                                       std::chrono::steady_clock::now() - start)
+                                       .count();
+            });
+
+            // Deterministic pairwise tree reduction into shard 0
+            auto reduce_start = std::chrono::steady_clock::now();
+            for (std::size_t stride = 1; stride < used; stride *= 2) {
+                pool.parallel_for(used, [&](std::size_t s) {
+                    if (s % (2 * stride) == 0 && s + stride < used) {
+                        shards[s].output_gradient += shards[s + stride].output_gradient;
+                        shards[s].hidden_gradient += shards[s + stride].hidden_gradient;
+                        shards[s].output_bias_gradient += shards[s + stride].output_bias_gradient;
+                        shards[s].hidden_bias_gradient += shards[s + stride].hidden_bias_gradient;
+                    }
+                });
+            }
+
+            // Single update with the gradient averaged over the batch
+            apply_gradients(shards[0], count);
+            busy_seconds += std::chrono::duration<double>(
+                                std::chrono::steady_clock::now() - reduce_start)
+                                .count();
+
+            float cost = 0;
+            for (std::size_t s = 0; s < used; ++s) {
+                cost += shard_costs[s];
+                busy_seconds += shard_seconds[s];
+            }
+            avg_cost += cost;
+            i += count;
+            advance(e, i, imgs.size(), count);
+            if (progress.is_due(int(i))) {
+                progress.update(int(i), format_text(message, "Cost: {}", cost / count));
+            }
+        }
+        avg_cost /= imgs.size() - first;
+
+        // Parallelism: compute time summed over threads against wall time,
+        // the average number of busy threads (not a measured speedup)
+        double wall_seconds = std::chrono::duration<double>(
+                                  std::chrono::steady_clock::now() - epoch_start)
+                                  .count();
+        std::clog << " Avg Cost: " << avg_cost << " Threads: " << pool.size()
+                  << " Samples/s: " << (imgs.size() - first) / wall_seconds
+                  << " Parallelism: " << busy_seconds / wall_seconds
+                  << std::endl;
+    }
+    position = {};
+}
+
+template <typename Images>
+void NeuralNetwork::train_batch_imgs(const Images &imgs, unsigned int epochs) {
+    assert(position.sample <= imgs.size());
+    for (unsigned int e = position.epoch + 1; e <= epochs; e++) {
+        const std::size_t first = position.sample;
+        int i = int(first);
+        double avg_cost = 0;
+        char title[32], message[32];
+        ProgressBar progress(format_text(title, "Epoch {}/{}", e, epochs), int(imgs.size()));
         progress.update(i);
-        for (const Img &cur_img : imgs) {
-            auto img_data =
-                cur_img.img_data.flatten(0); // 0 = flatten to column vector
-            Matrix2D output(10, 1);
-            output.fill(0.0f);
-            output[cur_img.label] = 1.0f; // Setting the result
-            float cost = train(img_data, output);
+        for (std::size_t s = first; s < imgs.size(); ++s) {
+            // Samples are copied straight into the workspace columns
+            load_batch(imgs, s, 1, workspace);
+            float cost = with_batch_input(workspace, [this](const auto &in) {
+                return train_step(in, workspace.target);
+            });
             avg_cost += cost;
             i++;
-            progress.update(i, std::format("Cost: {}", cost));
+            advance(e, s + 1, imgs.size(), 1);
+            // Only format the message when the bar is actually redrawn
+            if (progress.is_due(i)) {
+                progress.update(i, format_text(message, "Cost: {}", cost));
+            }
         }
-        avg_cost /= imgs.size();
+        avg_cost /= imgs.size() - first;
         std::clog << " Avg Cost: " << avg_cost << std::endl;
     }
+    position = {};
 }
 
 Matrix2D NeuralNetwork::classify_img(const Img &img) {
@@ -112,25 +500,71 @@ Matrix2D NeuralNetwork::classify_img(const Img &img) {
     return classify(img_data);
 }
 
-double NeuralNetwork::classify_imgs(const std::vector<Img> &imgs) {
+template <typename Images>
+double NeuralNetwork::classify_imgs(const Images &imgs) {
+    std::vector<Prediction> predictions(imgs.size());
+    classify_batch(imgs, predictions);
     int n_correct = 0;
-    for(const Img &cur_img : imgs) {
-        Matrix2D prediction = classify_img(cur_img);
-        if (prediction.argmax() == cur_img.label) {
+    for (std::size_t i = 0; i < imgs.size(); ++i) {
+        if (predictions[i].label == std::size_t(imgs[i].label)) {
             n_correct++;
         }
     }
     return 1.0 * n_correct / imgs.size();
 }
 
-Matrix2D NeuralNetwork::classify(Matrix2D input_data) {
-    // Matrix2D outputs = (hidden_weights * input_data).apply(sigmoid); //
-    // hidden outputs *= output_weights; outputs.apply(sigmoid); return
+template <typename Images>
+void NeuralNetwork::classify_batch(const Images &imgs,
+                                   std::span<Prediction> predictions,
+                                   unsigned int batch_size,
+                                   unsigned int threads) const {
+    assert(predictions.size() >= imgs.size() && batch_size > 0);
+    ThreadPool pool(threads);
+    const std::size_t n_batches = (imgs.size() + batch_size - 1) / batch_size;
+    const std::size_t n_shards = std::min<std::size_t>(pool.size(), n_batches);
+
+    // Each shard scores a contiguous run of batches with its own buffers
+    pool.parallel_for(n_shards, [&](std::size_t s) {
+        TrainingWorkspace ws(input, hidden, output, batch_size);
+        for (std::size_t b = n_batches * s / n_shards;
+             b < n_batches * (s + 1) / n_shards; ++b) {
+            std::size_t first = b * batch_size;
+            std::size_t count = std::min<std::size_t>(batch_size, imgs.size() - first);
+            load_batch(imgs, first, count, ws);
+            with_batch_input(ws, [&](const auto &in) { feed_forward(in, ws); });
+
+            // Argmax and its softmax probability, column by column
+            const float *outputs = ws.final_outputs.getData().data();
+            for (std::size_t c = 0; c < count; ++c) {
+                std::size_t best = 0;
+                for (std::size_t o = 1; o < std::size_t(output); ++o) {
+                    if (outputs[o * count + c] > outputs[best * count + c]) {
+                        best = o;
+                    }
+                }
+                float max_score = outputs[best * count + c];
+                float total = 0.0f;
+                for (std::size_t o = 0; o < std::size_t(output); ++o) {
+                    total += std::exp(outputs[o * count + c] - max_score);
+                }
+                predictions[first + c] = {best, 1.0f / total};
+            }
+        }
+    });
+}
+
+Matrix2D NeuralNetwork::classify(const Matrix2D &input_data) const {
+    // Matrix2D outputs = sigmoid(hidden_weights * input_data + hidden_bias);
+    // outputs = sigmoid(output_weights * outputs + output_bias); return
     // softmax(outputs);
-    Matrix2D hidden_outputs = hidden_weights * input_data;
-    hidden_outputs.apply(sigmoid);
-    Matrix2D final_outputs = output_weights * hidden_outputs;
-    final_outputs.apply(sigmoid);
+    Matrix2D hidden_outputs;
+    hidden_outputs.assign_dot(
+        hidden_weights, input_data,
+        gemm::bias_activation(hidden_bias.getData().data(), kernels::sigmoid));
+    Matrix2D final_outputs;
+    final_outputs.assign_dot(
+        output_weights, hidden_outputs,
+        gemm::bias_activation(output_bias.getData().data(), kernels::sigmoid));
     return softmax(final_outputs);
 }
 
@@ -140,41 +574,268 @@ void NeuralNetwork::save(const std::string &file_string) {
          << hidden << "\n"
          << output << "\n"
          << learning_rate << "\n"
-         << hidden_weights << output_weights;
+         << hidden_weights << output_weights << hidden_bias << output_bias;
     file.close();
     std::cout << "Successfully written to '" << file_string << "'" << std::endl;
 }
 
+namespace {
+
+// Weights of a block of a checked model, borrowed from the mapping. A
+// missing optional block is all zeros. Throws std::runtime_error when the
+// block is missing or has another shape
+Matrix2D map_block(MappedFile &file, model_format::BlockKind kind,
+                   std::size_t cols, std::size_t rows,
+                   const std::string &file_string, bool optional = false) {
+    auto table = model_format::block_table(file);
+    auto entry = std::find_if(table.begin(), table.end(),
+                              [kind](const model_format::BlockEntry &e) {
+                                  return e.kind == kind;
+                              });
+    if (entry == table.end() && optional) {
+        return Matrix2D(cols, rows);
+    }
+    if (entry == table.end() || entry->cols != cols || entry->rows != rows) {
+        throw std::runtime_error("Invalid model '" + file_string +
+                                 "': missing or mismatched weights");
+    }
+    return model_format::map_block(file, *entry);
+}
+
+// Restores the optimizer saved with a checked model, its state used in
+// place from the mapping, checked against the parameters. A model without
+// one keeps the settings of optimizer, without state. Throws
+// std::runtime_error when the blocks are malformed
+void load_optimizer(MappedFile &file, const Matrix2D *const (&parameters)[4],
+                    Optimizer &optimizer, const std::string &file_string) {
+    using namespace model_format;
+    auto invalid = [&file_string]() {
+        return std::runtime_error("Invalid model '" + file_string +
+                                  "': bad optimizer state");
+    };
+    auto table = block_table(file);
+    auto settings_entry =
+        std::find_if(table.begin(), table.end(), [](const BlockEntry &e) {
+            return e.kind == BlockKind::OptimizerSettings;
+        });
+    if (settings_entry == table.end()) {
+        optimizer = Optimizer(optimizer.getSettings());
+        return;
+    }
+    if (std::uint64_t(settings_entry->cols) * settings_entry->rows *
+            sizeof(float) !=
+        sizeof(OptimizerRecord)) {
+        throw invalid();
+    }
+    OptimizerRecord record;
+    std::memcpy(&record, file.data() + settings_entry->offset, sizeof(record));
+    if (record.kind > std::uint32_t(OptimizerKind::Adam)) {
+        throw invalid();
+    }
+    OptimizerSettings settings;
+    settings.kind = OptimizerKind(record.kind);
+    settings.momentum = record.momentum;
+    settings.beta1 = record.beta1;
+    settings.beta2 = record.beta2;
+    settings.epsilon = record.epsilon;
+    Optimizer loaded(settings);
+    loaded.set_steps(record.steps);
+    for (const BlockEntry &entry : table) {
+        if (entry.kind != BlockKind::OptimizerState) {
+            continue;
+        }
+        auto param = std::find(std::begin(parameter_blocks),
+                               std::end(parameter_blocks), BlockKind(entry.layer));
+        if (param == std::end(parameter_blocks) || entry.slot >= loaded.slots()) {
+            throw invalid();
+        }
+        std::size_t p = std::size_t(param - std::begin(parameter_blocks));
+        if (entry.cols != parameters[p]->getCols() ||
+            entry.rows != parameters[p]->getRows()) {
+            throw invalid();
+        }
+        loaded.set_state(p, entry.slot, map_block(file, entry));
+    }
+    optimizer = std::move(loaded);
+}
+
+// Writes a binary model; checkpoints carry their training position. An
+// optimizer other than SGD is saved with its state
+void write_model(const std::string &file_string, int input, int hidden,
+                 int output, float learning_rate,
+                 const Matrix2D &hidden_weights,
+                 const Matrix2D &output_weights, const Matrix2D &hidden_bias,
+                 const Matrix2D &output_bias, const Optimizer &optimizer,
+                 TrainingPosition position) {
+    using namespace model_format;
+    ModelHeader header = {};
+    header.input = input;
+    header.hidden = hidden;
+    header.output = output;
+    header.learning_rate = learning_rate;
+    header.epoch = position.epoch;
+    header.sample = std::uint32_t(position.sample);
+    std::vector<Block> blocks;
+    auto add_block = [&blocks](BlockKind kind, const Matrix2D &weights) {
+        BlockEntry entry{};
+        entry.kind = kind;
+        blocks.push_back({entry, &weights});
+    };
+    add_block(BlockKind::HiddenWeights, hidden_weights);
+    add_block(BlockKind::OutputWeights, output_weights);
+    add_block(BlockKind::HiddenBias, hidden_bias);
+    add_block(BlockKind::OutputBias, output_bias);
+    const OptimizerSettings &settings = optimizer.getSettings();
+    OptimizerRecord record{};
+    if (settings.kind != OptimizerKind::Sgd) {
+        record.kind = std::uint32_t(settings.kind);
+        record.momentum = settings.momentum;
+        record.beta1 = settings.beta1;
+        record.beta2 = settings.beta2;
+        record.epsilon = settings.epsilon;
+        record.steps = optimizer.getSteps();
+        BlockEntry entry{};
+        entry.kind = BlockKind::OptimizerSettings;
+        entry.cols = sizeof(record) / sizeof(float);
+        entry.rows = 1;
+        blocks.push_back({entry, nullptr, &record});
+        for (std::size_t p = 0; p < optimizer.getParameters(); ++p) {
+            for (std::size_t s = 0; s < optimizer.slots(); ++s) {
+                if (optimizer.getState(p, s).getCols() == 0) {
+                    continue; // Parameter not updated yet
+                }
+                BlockEntry entry{};
+                entry.kind = BlockKind::OptimizerState;
+                entry.layer = std::uint32_t(parameter_blocks[p]);
+                entry.slot = std::uint32_t(s);
+                blocks.push_back({entry, &optimizer.getState(p, s)});
+            }
+        }
+    }
+    model_format::write_model(file_string, header, blocks);
+}
+
+} // namespace
+
 void NeuralNetwork::save_bin(const std::string &file_string) {
-    std::ofstream file(file_string, std::ios::binary | std::ios::trunc | std::ios::out);
-    write(file, input);
-    write(file, hidden);
-    write(file, output);
-    write(file, learning_rate);
-    hidden_weights.write_bin(file);
-    output_weights.write_bin(file);
-    file.close();
+    own_weights();
+    write_model(file_string, input, hidden, output, learning_rate,
+                hidden_weights, output_weights, hidden_bias, output_bias,
+                optimizer, {});
     std::cout << "Successfully written to '" << file_string << "'" << std::endl;
 }
 
+void NeuralNetwork::own_weights() {
+    if (!model_file) {
+        return;
+    }
+    // Copies are always owned
+    hidden_weights = Matrix2D(hidden_weights);
+    output_weights = Matrix2D(output_weights);
+    hidden_bias = Matrix2D(hidden_bias);
+    output_bias = Matrix2D(output_bias);
+    optimizer = Optimizer(optimizer);
+    model_file.reset();
+}
+
+void ModelSnapshot::save_bin(const std::string &file_string) const {
+    write_model(file_string, input, hidden, output, learning_rate,
+                hidden_weights, output_weights, hidden_bias, output_bias,
+                optimizer, position);
+}
+
+void NeuralNetwork::snapshot(ModelSnapshot &out) const {
+    out.input = input;
+    out.hidden = hidden;
+    out.output = output;
+    out.learning_rate = learning_rate;
+    out.hidden_weights = hidden_weights;
+    out.output_weights = output_weights;
+    out.hidden_bias = hidden_bias;
+    out.output_bias = output_bias;
+    out.optimizer = optimizer;
+    out.position = position;
+}
+
 void NeuralNetwork::load(const std::string &file_string) {
     std::ifstream file(file_string);
     file >> input >> hidden >> output >> learning_rate >> hidden_weights >>
         output_weights;
+    // Files written before biases existed end here
+    if (!(file >> hidden_bias >> output_bias)) {
+        hidden_bias = Matrix2D(hidden, 1);
+        output_bias = Matrix2D(output, 1);
+    }
     file.close();
+    workspace = TrainingWorkspace(input, hidden, output);
+    optimizer = Optimizer(optimizer.getSettings());
+    // Reading moved the weights of a previous model file to owned memory
+    model_file.reset();
+    position = {};
     std::cout << "Successfully loaded from '" << file_string << "'"
               << std::endl;
 }
 
 void NeuralNetwork::load_bin(const std::string &file_string) {
-    std::ifstream file(file_string, std::ios::binary | std::ios::in);
-    read(file, input);
-    read(file, hidden);
-    read(file, output);
-    read(file, learning_rate);
-    hidden_weights.load_bin(file);
-    output_weights.load_bin(file);
-    file.close();
+    auto file = std::make_shared<MappedFile>(file_string,
+                                             MappedFile::Access::CopyOnWrite);
+    if (!file->is_open()) {
+        throw std::runtime_error("Cannot open model '" + file_string + "'");
+    }
+    if (!model_format::has_magic(*file)) {
+        // Former headerless layout, imported into new owned weights: the
+        // current ones may be borrowed from the model file released below
+        std::ifstream legacy(file_string, std::ios::binary | std::ios::in);
+        int legacy_input, legacy_hidden, legacy_output;
+        float legacy_learning_rate;
+        read(legacy, legacy_input);
+        read(legacy, legacy_hidden);
+        read(legacy, legacy_output);
+        read(legacy, legacy_learning_rate);
+        Matrix2D legacy_hidden_weights, legacy_output_weights;
+        legacy_hidden_weights.load_bin(legacy);
+        legacy_output_weights.load_bin(legacy);
+        if (!legacy) {
+            throw std::runtime_error("Invalid model '" + file_string +
+                                     "': truncated");
+        }
+        input = legacy_input;
+        hidden = legacy_hidden;
+        output = legacy_output;
+        learning_rate = legacy_learning_rate;
+        hidden_weights = std::move(legacy_hidden_weights);
+        output_weights = std::move(legacy_output_weights);
+        hidden_bias = Matrix2D(hidden, 1);
+        output_bias = Matrix2D(output, 1);
+        optimizer = Optimizer(optimizer.getSettings());
+        model_file.reset();
+        position = {};
+    } else {
+        model_format::check_model(*file, file_string);
+        const model_format::ModelHeader &header = model_format::model_header(*file);
+        input = header.input;
+        hidden = header.hidden;
+        output = header.output;
+        learning_rate = header.learning_rate;
+        position = {header.epoch, header.sample};
+        hidden_weights =
+            map_block(*file, model_format::BlockKind::HiddenWeights, hidden,
+                      input, file_string);
+        output_weights =
+            map_block(*file, model_format::BlockKind::OutputWeights, output,
+                      hidden, file_string);
+        // Models saved before biases existed have none
+        hidden_bias = map_block(*file, model_format::BlockKind::HiddenBias,
+                                hidden, 1, file_string, true);
+        output_bias = map_block(*file, model_format::BlockKind::OutputBias,
+                                output, 1, file_string, true);
+        load_optimizer(*file,
+                       {&hidden_weights, &output_weights, &hidden_bias,
+                        &output_bias},
+                       optimizer, file_string);
+        model_file = std::move(file);
+    }
+    workspace = TrainingWorkspace(input, hidden, output);
     std::cout << "Successfully loaded from '" << file_string << "'"
               << std::endl;
 }
@@ -187,3 +848,22 @@ void NeuralNetwork::print() {
               << "Hidden Weights: " << hidden_weights << std::endl
               << "Output Weights: " << output_weights << std::endl;
 }
+
+// Supported image containers
+#define INSTANTIATE_FOR_IMAGES(Images)                                         \
+    template void NeuralNetwork::train_batch_imgs(const Images &,              \
+                                                  unsigned int);               \
+    template void NeuralNetwork::train_minibatch(const Images &, unsigned int, \
+                                                 unsigned int);                \
+    template void NeuralNetwork::train_parallel(const Images &, unsigned int,  \
+                                                unsigned int, unsigned int);   \
+    template double NeuralNetwork::classify_imgs(const Images &);              \
+    template void NeuralNetwork::classify_batch(                               \
+        const Images &, std::span<Prediction>, unsigned int, unsigned int) const;
+
+INSTANTIATE_FOR_IMAGES(std::vector<Img>)
+INSTANTIATE_FOR_IMAGES(MappedDataset)
+INSTANTIATE_FOR_IMAGES(Dataset)
+INSTANTIATE_FOR_IMAGES(Dataset::Batch)
+
+#undef INSTANTIATE_FOR_IMAGES
@@ -1,9 +1,53 @@
 #pragma once
 
+#include <cstddef>
+#include <memory>
+#include <span>
 #include <string>
 
 #include "../math/Matrix2D.hpp"
+#include "../utils/Dataset.hpp"
 #include "../utils/Img.hpp"
+#include "../utils/MappedDataset.hpp"
+#include "../utils/MappedFile.hpp"
+#include "../utils/StreamingLoader.hpp"
+#include "Optimizer.hpp"
+#include "Workspace.hpp"
+
+// Result of classifying one image: the most likely label and its softmax
+// probability
+struct Prediction {
+    std::size_t label;
+    float confidence;
+};
+
+// Progress of a training run: epochs completed and samples trained in the
+// next epoch
+struct TrainingPosition {
+    unsigned int epoch = 0;
+    std::size_t sample = 0;
+};
+
+// Copy of the state save_bin writes, taken by NeuralNetwork::snapshot so it
+// can be written while the network keeps training
+struct ModelSnapshot {
+    int input = 0;
+    int hidden = 0;
+    int output = 0;
+    float learning_rate = 0.0f;
+    Matrix2D hidden_weights;
+    Matrix2D output_weights;
+    Matrix2D hidden_bias;
+    Matrix2D output_bias;
+    Optimizer optimizer;
+    TrainingPosition position;
+
+    // Binary model in the format of ModelFormat.hpp. Throws
+    // std::runtime_error when the file cannot be written
+    void save_bin(const std::string &file_string) const;
+};
+
+class Checkpointer;
 
 class NeuralNetwork {
     int input;
@@ -12,18 +56,122 @@ class NeuralNetwork {
     float learning_rate;
     Matrix2D hidden_weights;
     Matrix2D output_weights;
+    // One per neuron (hidden x 1, output x 1), added before the activation
+    Matrix2D hidden_bias;
+    Matrix2D output_bias;
+    // Update rule of training and its state, one or two tensors per weight
+    // and bias matrix above, saved with them
+    Optimizer optimizer;
+    // Copy-on-write mapping of the model file the weights were loaded from,
+    // whose memory they use in place (see load_bin)
+    std::shared_ptr<MappedFile> model_file;
+    TrainingWorkspace workspace;
+    // Where an interrupted training run resumes, restored by load_bin
+    TrainingPosition position;
+    Checkpointer *checkpointer = nullptr;
+
+    // Input is a Matrix2D or a ByteMatrix (uint8 samples)
+    template <typename Input>
+    void feed_forward(const Input &input_data, TrainingWorkspace &ws) const;
+    template <typename Input>
+    float backpropagate(const Input &input_data, const Matrix2D &output_data,
+                        TrainingWorkspace &ws) const;
+    template <typename Input>
+    float train_step(const Input &input_data, const Matrix2D &output_data);
+    // One optimizer step with the gradients summed over count samples in ws
+    void apply_gradients(const TrainingWorkspace &ws, std::size_t count);
+    template <typename Images>
+    static void load_batch(const Images &imgs, std::size_t first,
+                           std::size_t count, TrainingWorkspace &ws);
+    // Records that sample samples of epoch (1-based) out of epoch_size are
+    // trained, the last count in this step, and lets the checkpointer act
+    void advance(unsigned int epoch, std::size_t sample,
+                 std::size_t epoch_size, std::size_t count);
 
   public:
     NeuralNetwork() = default;
     NeuralNetwork(int input, int hidden, int output, float lr);
+    // Empty biases are zero
+    NeuralNetwork(float lr, Matrix2D hidden_weights, Matrix2D output_weights,
+                  Matrix2D hidden_bias = {}, Matrix2D output_bias = {});
     float train(const Matrix2D &input_data, const Matrix2D &output_data);
-    void train_batch_imgs(const std::vector<Img> &imgs, unsigned int epochs = 1);
+    // Same on uint8 samples, dequantized inside the first layer GEMMs
+    float train(const ByteMatrix &input_data, const Matrix2D &output_data);
+    float train_img(const Img &img);
+
+    // Training and batched inference take the images as Images: a
+    // std::vector<Img>, MappedDataset, Dataset or Dataset::Batch
+    // (instantiated in NeuralNetwork.cpp).
+    // epochs counts from the start of the run: a network loaded from a
+    // checkpoint only trains what is left, from the saved epoch and sample,
+    // so the images must come in the same order as before the interruption
+    template <typename Images>
+    void train_batch_imgs(const Images &imgs, unsigned int epochs = 1);
+    template <typename Images>
+    void train_minibatch(const Images &imgs, unsigned int batch_size,
+                         unsigned int epochs = 1);
+    // Data-parallel train_minibatch on threads threads (0 = one per hardware
+    // core). Each batch is split into shards of 8 samples or more whose
+    // gradients are summed in a fixed order, so the result is the same for
+    // any thread count; a batch needs 8 * threads samples to keep every
+    // thread busy
+    template <typename Images>
+    void train_parallel(const Images &imgs, unsigned int batch_size,
+                        unsigned int epochs = 1, unsigned int threads = 0);
+    // Mini-batch training on batches streamed from disk, one epoch per pass
+    // over the loader. Checkpoints are taken, but resuming restarts at the
+    // first epoch as the loader reshuffles every pass
+    void train_stream(StreamingLoader &loader, unsigned int epochs = 1);
     Matrix2D classify_img(const Img &img);
-    double classify_imgs(const std::vector<Img> &imgs);
-    Matrix2D classify(Matrix2D input_data);
+    template <typename Images> double classify_imgs(const Images &imgs);
+    template <typename Images>
+    void classify_batch(const Images &imgs, std::span<Prediction> predictions,
+                        unsigned int batch_size = 256,
+                        unsigned int threads = 0) const;
+    Matrix2D classify(const Matrix2D &input_data) const;
     void save(const std::string &file_string);
     void load(const std::string &file_string);
+    // Binary model in the format of ModelFormat.hpp, replacing the file
+    // once written; weights borrowed from a model file are copied to owned
+    // memory first (see own_weights). Throws std::runtime_error when the
+    // file cannot be written
     void save_bin(const std::string &file_string);
+    // Copies the weights and optimizer state borrowed from the model file
+    // loaded by load_bin into owned memory and closes the file, which can
+    // then be replaced or deleted
+    void own_weights();
+    // Copies the weights and the training position into out, reusing its
+    // buffers
+    void snapshot(ModelSnapshot &out) const;
+    // Update rule of the next training steps, SGD by default. The state of
+    // the previous optimizer is dropped
+    void set_optimizer(OptimizerSettings settings) {
+        optimizer = Optimizer(settings);
+    }
+    // Training calls checkpointer->step after every batch (see
+    // Checkpointer.hpp); nullptr disables checkpoints
+    void set_checkpointer(Checkpointer *checkpointer) {
+        this->checkpointer = checkpointer;
+    }
+    // Maps a binary model and uses its weights in place, without copying
+    // them: the file is read once to verify its checksum, and pages are
+    // copied only if the network is trained. A checkpoint also restores the training position.
+    // A model saved with an optimizer restores it, state included; otherwise
+    // the current optimizer is kept, without state. Files in the former
+    // headerless layout are imported. Throws std::runtime_error when the file
+    // is missing or malformed
     void load_bin(const std::string &file_string);
     void print();
+
+    // getters
+    int getInput() const { return input; }
+    int getHidden() const { return hidden; }
+    int getOutput() const { return output; }
+    float getLearningRate() const { return learning_rate; }
+    const Matrix2D &getHiddenWeights() const { return hidden_weights; }
+    const Matrix2D &getOutputWeights() const { return output_weights; }
+    const Matrix2D &getHiddenBias() const { return hidden_bias; }
+    const Matrix2D &getOutputBias() const { return output_bias; }
+    const Optimizer &getOptimizer() const { return optimizer; }
+    const TrainingPosition &getPosition() const { return position; }
 };
@@ -0,0 +1,75 @@
+#include "Optimizer.hpp"
+
+#include <cassert> // assert
+#include <cmath>   // pow && sqrt
+#include <utility> // move
+
+#include "../math/Kernels.hpp"
+
+void Optimizer::update(std::size_t param, Matrix2D &weights,
+                       const Matrix2D &gradient, float learning_rate,
+                       std::size_t count) {
+    assert(gradient.getCols() == weights.getCols() &&
+           gradient.getRows() == weights.getRows() && count > 0);
+    assert(settings.kind == OptimizerKind::Sgd || steps > 0);
+    float *w = weights.getData().data();
+    const float *g = gradient.getData().data();
+    const std::size_t n = weights.getData().size();
+    const float scale = 1.0f / float(count);
+
+    // Zero state on the first update of the parameter
+    if (slots() > 0 && param >= state.size()) {
+        state.resize(param + 1);
+    }
+    for (std::size_t s = 0; s < slots(); ++s) {
+        Matrix2D &tensor = state[param][s];
+        if (tensor.getCols() != weights.getCols() ||
+            tensor.getRows() != weights.getRows()) {
+            tensor = Matrix2D(weights.getCols(), weights.getRows());
+        }
+    }
+
+    switch (settings.kind) {
+    case OptimizerKind::Sgd:
+        kernels::sgd_update(w, g, n, scale, learning_rate);
+        break;
+    case OptimizerKind::Momentum:
+    case OptimizerKind::Nesterov:
+        kernels::momentum_update(w, state[param][0].getData().data(), g, n,
+                                 scale, learning_rate, settings.momentum,
+                                 settings.kind == OptimizerKind::Nesterov);
+        break;
+    case OptimizerKind::Adam: {
+        // Bias corrections, in double as beta^t is close to 1 early on
+        double t = double(steps);
+        float lr_t = float(learning_rate / (1.0 - std::pow(settings.beta1, t)));
+        float root_t = float(1.0 / std::sqrt(1.0 - std::pow(settings.beta2, t)));
+        kernels::adam_update(w, state[param][0].getData().data(),
+                             state[param][1].getData().data(), g, n, scale,
+                             lr_t, root_t, settings.beta1, settings.beta2,
+                             settings.epsilon);
+        break;
+    }
+    }
+}
+
+std::size_t Optimizer::slots() const {
+    switch (settings.kind) {
+    case OptimizerKind::Momentum:
+    case OptimizerKind::Nesterov:
+        return 1;
+    case OptimizerKind::Adam:
+        return 2;
+    default:
+        return 0;
+    }
+}
+
+void Optimizer::set_state(std::size_t param, std::size_t slot,
+                          Matrix2D tensor) {
+    assert(slot < max_slots);
+    if (param >= state.size()) {
+        state.resize(param + 1);
+    }
+    state[param][slot] = std::move(tensor);
+}
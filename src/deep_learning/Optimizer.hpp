@@ -0,0 +1,71 @@
+#pragma once
+
+#include <array>   // array
+#include <cstddef> // size_t
+#include <cstdint> // uint32_t && uint64_t
+#include <vector>  // vector
+
+#include "../math/Matrix2D.hpp"
+
+// Update rule of the parameters, stored in the model file
+enum class OptimizerKind : std::uint32_t {
+    Sgd = 0,      // Plain gradient descent, no state
+    Momentum = 1, // Velocity accumulating the gradients
+    Nesterov = 2, // Momentum, stepping from where the velocity leads
+    Adam = 3      // Per-weight steps from the first and second moments
+};
+
+struct OptimizerSettings {
+    OptimizerKind kind = OptimizerKind::Sgd;
+    float momentum = 0.9f; // Momentum and Nesterov: decay of the velocity
+    float beta1 = 0.9f;    // Adam: decay of the first and second moments
+    float beta2 = 0.999f;
+    float epsilon = 1e-8f;
+};
+
+// Optimizer of the parameters of a network (weights and biases, numbered by
+// the network) and its state: for each parameter, the velocity (Momentum,
+// Nesterov) or the two moments (Adam), shaped like it. State is zero until
+// the first update of its parameter. Each update is a single pass of a fused
+// kernel (see Kernels.hpp) reading the gradient and the state and writing
+// the state and the weights.
+//
+//     optimizer.begin_step();
+//     optimizer.update(0, hidden_weights, hidden_gradient, lr, batch);
+//     optimizer.update(1, output_weights, output_gradient, lr, batch);
+class Optimizer {
+    OptimizerSettings settings;
+    std::uint64_t steps = 0; // Adam's bias correction depends on it
+    std::vector<std::array<Matrix2D, 2>> state;
+
+  public:
+    static constexpr std::size_t max_slots = 2;
+
+    Optimizer() = default;
+    explicit Optimizer(OptimizerSettings settings) : settings(settings) {}
+
+    // Starts a step, before the updates of all the parameters
+    void begin_step() { ++steps; }
+    // Updates parameter param of the network, weights, with gradient, the
+    // descent direction summed over count samples, and the state of param
+    void update(std::size_t param, Matrix2D &weights, const Matrix2D &gradient,
+                float learning_rate, std::size_t count);
+
+    // State tensors per parameter: 0 (Sgd), 1 (Momentum, Nesterov) or 2 (Adam)
+    std::size_t slots() const;
+
+    // Restore a saved optimizer
+    void set_state(std::size_t param, std::size_t slot, Matrix2D tensor);
+    void set_steps(std::uint64_t steps) { this->steps = steps; }
+
+    // getters
+    const OptimizerSettings &getSettings() const { return settings; }
+    std::uint64_t getSteps() const { return steps; }
+    // Parameters with state, numbered from 0
+    std::size_t getParameters() const { return state.size(); }
+    // Slot slot of the state of parameter param, empty before its first
+    // update
+    const Matrix2D &getState(std::size_t param, std::size_t slot) const {
+        return state[param][slot];
+    }
+};
@@ -0,0 +1,372 @@
+#include <algorithm>    // clamp && max && min
+#include <cassert>      // assert
+#include <cmath>        // lround
+#include <cstring>      // memcpy
+#include <filesystem>   // rename && remove
+#include <fstream>      // ifstream && ofstream
+#include <stdexcept>    // runtime_error
+#include <system_error> // error_code
+
+#include "../math/Int8Gemm.hpp"
+#include "../math/Kernels.hpp"
+#include "../utils/Checksum.hpp"
+#include "../utils/ThreadPool.hpp"
+#include "QuantizedNetwork.hpp"
+
+using namespace quantized_format;
+using namespace file_format;
+
+namespace {
+
+// Activations are non-negative, so adding 0.5 and truncating rounds them
+// without a call to lround
+std::uint8_t quantize_activation(float value, float inv_scale) {
+    return std::uint8_t(std::clamp(value * inv_scale + 0.5f, 0.0f, 127.0f));
+}
+
+// Quantizes the pixels of img into out, one branch-free loop per pixel type
+void quantize_input(const ImgView &img, float inv_scale, std::uint8_t *out) {
+    const std::size_t n = img.size();
+    if (img.pixels != nullptr) {
+        for (std::size_t j = 0; j < n; ++j) {
+            out[j] = quantize_activation(img.pixels[j], inv_scale);
+        }
+    } else {
+        const float byte_scale = inv_scale / img.scale;
+        for (std::size_t j = 0; j < n; ++j) {
+            out[j] = quantize_activation(float(img.bytes[j]), byte_scale);
+        }
+    }
+}
+
+// Quantizes each row of weights (rows x cols) with its own scale into q
+// (rows x stride, zero-padded). scales[r] = row scale * input_scale
+template <typename Storage>
+void quantize_rows(const Matrix2D &weights, std::size_t stride,
+                   float input_scale, Storage &q, std::vector<float> &scales) {
+    // Matrix2D(cols, rows) stores cols rows of rows elements
+    const std::size_t rows = weights.getCols();
+    const std::size_t cols = weights.getRows();
+    const float *w = weights.getData().data();
+    for (std::size_t r = 0; r < rows; ++r) {
+        float max_abs = 0.0f;
+        for (std::size_t c = 0; c < cols; ++c) {
+            max_abs = std::max(max_abs, std::abs(w[r * cols + c]));
+        }
+        const float scale = max_abs > 0.0f ? max_abs / 127.0f : 1.0f;
+        for (std::size_t c = 0; c < cols; ++c) {
+            q[r * stride + c] = std::int8_t(std::lround(w[r * cols + c] / scale));
+        }
+        scales[r] = scale * input_scale;
+    }
+}
+
+} // namespace
+
+void QuantizedNetwork::set_topology(int input, int hidden, int output) {
+    this->input = input;
+    this->hidden = hidden;
+    this->output = output;
+    input_stride = int8_gemm::padded(std::size_t(input));
+    hidden_stride = int8_gemm::padded(std::size_t(hidden));
+    hidden_scales.assign(std::size_t(hidden), 0.0f);
+    output_scales.assign(std::size_t(output), 0.0f);
+    hidden_bias.assign(std::size_t(hidden), 0.0f);
+    output_bias.assign(std::size_t(output), 0.0f);
+    hidden_weights.assign(std::size_t(hidden) * input_stride, 0);
+    output_weights.assign(std::size_t(output) * hidden_stride, 0);
+}
+
+template <typename Images>
+QuantizedNetwork::QuantizedNetwork(const NeuralNetwork &net,
+                                   const Images &calibration) {
+    set_topology(net.getInput(), net.getHidden(), net.getOutput());
+
+    // Largest input and hidden activation over the calibration set
+    constexpr std::size_t batch_size = 256;
+    float max_input = 0.0f;
+    float max_hidden = 0.0f;
+    auto max_of = [](float a, float b) { return std::max(a, b); };
+    Matrix2D inputs;
+    Matrix2D activations;
+    for (std::size_t first = 0; first < calibration.size();
+         first += batch_size) {
+        const std::size_t count =
+            std::min(batch_size, calibration.size() - first);
+        inputs.resize(std::size_t(input), count);
+        for (std::size_t i = 0; i < count; ++i) {
+            ImgView img = calibration[first + i];
+            img.copy_to(inputs.getData().data() + i, count);
+        }
+        activations.assign_dot(
+            net.getHiddenWeights(), inputs,
+            gemm::bias_activation(net.getHiddenBias().getData().data(),
+                                  kernels::sigmoid));
+        max_input = inputs.reduce(max_input, max_of);
+        max_hidden = activations.reduce(max_hidden, max_of);
+    }
+    input_scale = max_input > 0.0f ? max_input / 127.0f : 1.0f;
+    hidden_scale = max_hidden > 0.0f ? max_hidden / 127.0f : 1.0f;
+
+    quantize_rows(net.getHiddenWeights(), input_stride, input_scale,
+                  hidden_weights, hidden_scales);
+    quantize_rows(net.getOutputWeights(), hidden_stride, hidden_scale,
+                  output_weights, output_scales);
+    const MatrixStorage &net_hidden_bias = net.getHiddenBias().getData();
+    const MatrixStorage &net_output_bias = net.getOutputBias().getData();
+    hidden_bias.assign(net_hidden_bias.begin(), net_hidden_bias.end());
+    output_bias.assign(net_output_bias.begin(), net_output_bias.end());
+}
+
+void QuantizedNetwork::reserve(Scratch &scratch, std::size_t count) const {
+    // Only grows: the padding of x and hidden_q past input and hidden meets
+    // zero weights, so what earlier calls left there does not matter
+    auto grow = [](auto &buffer, std::size_t size) {
+        if (buffer.size() < size) {
+            buffer.resize(size);
+        }
+    };
+    grow(scratch.x, count * input_stride);
+    grow(scratch.acc, count * std::size_t(std::max(hidden, output)));
+    grow(scratch.activations, std::size_t(hidden));
+    grow(scratch.hidden_q, count * hidden_stride);
+}
+
+void QuantizedNetwork::classify_quantized(Scratch &scratch, std::size_t count,
+                                          std::size_t *labels) const {
+    std::int32_t *acc = scratch.acc.data();
+    float *activations = scratch.activations.data();
+    std::uint8_t *hidden_q = scratch.hidden_q.data();
+
+    int8_gemm::gemm(std::size_t(hidden), count, input_stride,
+                    hidden_weights.data(), input_stride, scratch.x.data(),
+                    input_stride, acc, std::size_t(hidden));
+    const float inv_hidden_scale = 1.0f / hidden_scale;
+    for (std::size_t i = 0; i < count; ++i) {
+        const std::int32_t *a = acc + i * std::size_t(hidden);
+        for (std::size_t r = 0; r < std::size_t(hidden); ++r) {
+            activations[r] = float(a[r]) * hidden_scales[r] + hidden_bias[r];
+        }
+        kernels::sigmoid(activations, activations, std::size_t(hidden));
+        std::uint8_t *h = hidden_q + i * hidden_stride;
+        for (std::size_t r = 0; r < std::size_t(hidden); ++r) {
+            h[r] = quantize_activation(activations[r], inv_hidden_scale);
+        }
+    }
+
+    int8_gemm::gemm(std::size_t(output), count, hidden_stride,
+                    output_weights.data(), hidden_stride, hidden_q,
+                    hidden_stride, acc, std::size_t(output));
+    for (std::size_t i = 0; i < count; ++i) {
+        const std::int32_t *a = acc + i * std::size_t(output);
+        std::size_t best = 0;
+        float best_score = float(a[0]) * output_scales[0] + output_bias[0];
+        for (std::size_t r = 1; r < std::size_t(output); ++r) {
+            float score = float(a[r]) * output_scales[r] + output_bias[r];
+            if (score > best_score) {
+                best = r;
+                best_score = score;
+            }
+        }
+        labels[i] = best;
+    }
+}
+
+std::size_t QuantizedNetwork::classify_img(const ImgView &img) const {
+    assert(img.size() == std::size_t(input));
+    thread_local Scratch scratch;
+    reserve(scratch, 1);
+    quantize_input(img, 1.0f / input_scale, scratch.x.data());
+    std::size_t label;
+    classify_quantized(scratch, 1, &label);
+    return label;
+}
+
+template <typename Images>
+void QuantizedNetwork::classify_batch(const Images &imgs,
+                                      std::span<std::size_t> labels,
+                                      unsigned int batch_size,
+                                      unsigned int threads) const {
+    assert(labels.size() >= imgs.size() && batch_size > 0);
+    ThreadPool pool(threads);
+    const std::size_t n_batches = (imgs.size() + batch_size - 1) / batch_size;
+    const std::size_t n_shards = std::min<std::size_t>(pool.size(), n_batches);
+    const float inv_input_scale = 1.0f / input_scale;
+
+    // Each shard quantizes and scores a contiguous run of batches with its
+    // own buffers
+    pool.parallel_for(n_shards, [&](std::size_t s) {
+        Scratch scratch;
+        reserve(scratch, batch_size);
+        for (std::size_t b = n_batches * s / n_shards;
+             b < n_batches * (s + 1) / n_shards; ++b) {
+            std::size_t first = b * batch_size;
+            std::size_t count =
+                std::min<std::size_t>(batch_size, imgs.size() - first);
+            for (std::size_t i = 0; i < count; ++i) {
+                ImgView img = imgs[first + i];
+                assert(img.size() == std::size_t(input));
+                quantize_input(img, inv_input_scale,
+                               scratch.x.data() + i * input_stride);
+            }
+            classify_quantized(scratch, count, labels.data() + first);
+        }
+    });
+}
+
+template <typename Images>
+double QuantizedNetwork::classify_imgs(const Images &imgs) const {
+    std::vector<std::size_t> labels(imgs.size());
+    classify_batch(imgs, labels);
+    int n_correct = 0;
+    for (std::size_t i = 0; i < imgs.size(); ++i) {
+        if (labels[i] == std::size_t(imgs[i].label)) {
+            n_correct++;
+        }
+    }
+    return 1.0 * n_correct / imgs.size();
+}
+
+void QuantizedNetwork::save(const std::string &file_string) const {
+    QuantizedHeader header = {};
+    stamp_header(header, magic, version);
+    header.input = input;
+    header.hidden = hidden;
+    header.output = output;
+    header.input_scale = input_scale;
+    header.hidden_scale = hidden_scale;
+    header.hidden_scales_offset = std::uint32_t(align_up(sizeof(header)));
+    // Each scales array is followed by the biases of its layer
+    header.output_scales_offset = std::uint32_t(align_up(
+        header.hidden_scales_offset + 2 * hidden_scales.size() * sizeof(float)));
+    header.hidden_weights_offset = std::uint32_t(align_up(
+        header.output_scales_offset + 2 * output_scales.size() * sizeof(float)));
+    header.output_weights_offset = std::uint32_t(
+        align_up(header.hidden_weights_offset + hidden_weights.size()));
+    header.file_size =
+        align_up(header.output_weights_offset + output_weights.size());
+
+    // The whole file is assembled, summed and written at once
+    std::vector<char> buffer(header.file_size, 0);
+    std::memcpy(buffer.data() + header.hidden_scales_offset,
+                hidden_scales.data(), hidden_scales.size() * sizeof(float));
+    std::memcpy(buffer.data() + header.output_scales_offset,
+                output_scales.data(), output_scales.size() * sizeof(float));
+    std::memcpy(buffer.data() + header.hidden_scales_offset +
+                    hidden_scales.size() * sizeof(float),
+                hidden_bias.data(), hidden_bias.size() * sizeof(float));
+    std::memcpy(buffer.data() + header.output_scales_offset +
+                    output_scales.size() * sizeof(float),
+                output_bias.data(), output_bias.size() * sizeof(float));
+    std::memcpy(buffer.data() + header.hidden_weights_offset,
+                hidden_weights.data(), hidden_weights.size());
+    std::memcpy(buffer.data() + header.output_weights_offset,
+                output_weights.data(), output_weights.size());
+    std::memcpy(buffer.data(), &header, sizeof(header));
+    Fletcher64 checksum;
+    checksum.update(buffer.data(), buffer.size());
+    header.checksum = checksum.value();
+    std::memcpy(buffer.data(), &header, sizeof(header));
+
+    // Written aside then renamed over the target, so a failed write leaves
+    // the previous model intact
+    const std::string temporary = file_string + ".tmp";
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+    file.write(buffer.data(), std::streamsize(buffer.size()));
+    file.close();
+    std::error_code error;
+    if (file) {
+        std::filesystem::rename(temporary, file_string, error);
+    }
+    if (!file || error) {
+        std::filesystem::remove(temporary, error);
+        throw std::runtime_error("Cannot write model '" + file_string + "'");
+    }
+}
+
+void QuantizedNetwork::load(const std::string &file_string) {
+    std::ifstream file(file_string, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) {
+        throw std::runtime_error("Cannot open model '" + file_string + "'");
+    }
+    auto invalid = [&file_string](const char *reason) {
+        return std::runtime_error("Invalid model '" + file_string +
+                                  "': " + reason);
+    };
+    std::vector<char> buffer(std::size_t(file.tellg()));
+    file.seekg(0);
+    file.read(buffer.data(), std::streamsize(buffer.size()));
+    if (!file || buffer.size() < sizeof(QuantizedHeader)) {
+        throw invalid("file too small");
+    }
+    QuantizedHeader header;
+    std::memcpy(&header, buffer.data(), sizeof(header));
+    check_header(header, magic, 1, version, invalid);
+    if (header.file_size != buffer.size() || buffer.size() % 4 != 0) {
+        throw invalid("truncated");
+    }
+    QuantizedHeader unsummed = header;
+    unsummed.checksum = 0;
+    std::memcpy(buffer.data(), &unsummed, sizeof(unsummed));
+    Fletcher64 checksum;
+    checksum.update(buffer.data(), buffer.size());
+    if (checksum.value() != header.checksum) {
+        throw invalid("checksum mismatch");
+    }
+    if (header.input <= 0 || header.hidden <= 0 || header.output <= 0) {
+        throw invalid("bad topology");
+    }
+
+    set_topology(header.input, header.hidden, header.output);
+    auto in_buffer = [&](std::uint64_t offset, std::size_t bytes) {
+        return offset % alignment == 0 && fits(offset, bytes, 1, buffer.size());
+    };
+    // Version 1 has no biases after the scales
+    const std::size_t arrays = header.version == 1 ? 1 : 2;
+    if (!in_buffer(header.hidden_scales_offset,
+              arrays * hidden_scales.size() * sizeof(float)) ||
+        !in_buffer(header.output_scales_offset,
+              arrays * output_scales.size() * sizeof(float)) ||
+        !in_buffer(header.hidden_weights_offset, hidden_weights.size()) ||
+        !in_buffer(header.output_weights_offset, output_weights.size())) {
+        throw invalid("bad offsets");
+    }
+    input_scale = header.input_scale;
+    hidden_scale = header.hidden_scale;
+    std::memcpy(hidden_scales.data(), buffer.data() + header.hidden_scales_offset,
+                hidden_scales.size() * sizeof(float));
+    std::memcpy(output_scales.data(), buffer.data() + header.output_scales_offset,
+                output_scales.size() * sizeof(float));
+    if (header.version > 1) {
+        std::memcpy(hidden_bias.data(),
+                    buffer.data() + header.hidden_scales_offset +
+                        hidden_scales.size() * sizeof(float),
+                    hidden_bias.size() * sizeof(float));
+        std::memcpy(output_bias.data(),
+                    buffer.data() + header.output_scales_offset +
+                        output_scales.size() * sizeof(float),
+                    output_bias.size() * sizeof(float));
+    }
+    std::memcpy(hidden_weights.data(),
+                buffer.data() + header.hidden_weights_offset,
+                hidden_weights.size());
+    std::memcpy(output_weights.data(),
+                buffer.data() + header.output_weights_offset,
+                output_weights.size());
+}
+
+// Supported image containers
+#define INSTANTIATE_FOR_IMAGES(Images)                                         \
+    template QuantizedNetwork::QuantizedNetwork(const NeuralNetwork &,         \
+                                                const Images &);               \
+    template void QuantizedNetwork::classify_batch(                            \
+        const Images &, std::span<std::size_t>, unsigned int, unsigned int)    \
+        const;                                                                 \
+    template double QuantizedNetwork::classify_imgs(const Images &) const;
+
+INSTANTIATE_FOR_IMAGES(std::vector<Img>)
+INSTANTIATE_FOR_IMAGES(MappedDataset)
+INSTANTIATE_FOR_IMAGES(Dataset)
+INSTANTIATE_FOR_IMAGES(Dataset::Batch)
+
+#undef INSTANTIATE_FOR_IMAGES
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstddef> // size_t
+#include <cstdint> // int8_t && uint32_t && uint64_t && int32_t
+#include <span>    // span
+#include <string>  // string
+#include <vector>  // vector
+
+#include "../utils/FileFormat.hpp"
+#include "../utils/MemoryPool.hpp"
+#include "NeuralNetwork.hpp"
+
+// Quantized model file (.net-q8), read in one piece.
+//
+// Layout (conventions in FileFormat.hpp):
+//   QuantizedHeader                        64 bytes
+//   hidden_scales: float[hidden], then hidden_bias: float[hidden]
+//                                          at hidden_scales_offset
+//   output_scales: float[output], then output_bias: float[output]
+//                                          at output_scales_offset
+//   hidden weights: int8[hidden][input_stride]    at hidden_weights_offset
+//   output weights: int8[output][hidden_stride]   at output_weights_offset
+// Every array starts on a 64-byte boundary and the file is padded to a
+// multiple of 64 bytes. checksum is the Fletcher64 of the whole file,
+// computed with the checksum field set to 0. Version 1 files have no biases
+// and load with zero biases.
+namespace quantized_format {
+
+constexpr char magic[4] = {'N', 'N', 'Q', '8'};
+constexpr std::uint32_t version = 2;
+
+struct QuantizedHeader {
+    char magic[4];
+    std::uint32_t version;
+    std::uint32_t endian_marker;
+    std::int32_t input;
+    std::int32_t hidden;
+    std::int32_t output;
+    float input_scale;
+    float hidden_scale;
+    std::uint64_t file_size;
+    std::uint64_t checksum;
+    std::uint32_t hidden_scales_offset;
+    std::uint32_t output_scales_offset;
+    std::uint32_t hidden_weights_offset;
+    std::uint32_t output_weights_offset;
+};
+static_assert(sizeof(QuantizedHeader) == 64);
+
+} // namespace quantized_format
+
+// Int8 inference copy of a NeuralNetwork.
+//
+// Weights are quantized symmetrically per row (one scale per neuron,
+// w = q * scale, q in [-127, 127]) and activations per tensor to [0, 127]:
+// inputs and hidden activations are non-negative (pixels and sigmoids), and
+// their ranges are calibrated on a dataset. Both layers run as
+// int8 x int8 -> int32 GEMMs (see Int8Gemm.hpp) on a quarter of the float
+// weight bytes; the float biases are added to the dequantized accumulators.
+// Only the label is computed: the output sigmoid and the
+// softmax preserve the order of the outputs, so the argmax is taken on the
+// dequantized accumulators.
+class QuantizedNetwork {
+    using Int8Storage = std::vector<std::int8_t, PoolAllocator<std::int8_t>>;
+
+    int input = 0;
+    int hidden = 0;
+    int output = 0;
+    std::size_t input_stride = 0;  // input padded for the GEMM kernel
+    std::size_t hidden_stride = 0; // hidden padded for the GEMM kernel
+    float input_scale = 1.0f;      // pixel = q * input_scale
+    float hidden_scale = 1.0f;     // activation = q * hidden_scale
+    // Per row: weight scale times the scale of the layer input, turning the
+    // int32 accumulators back into floats
+    std::vector<float> hidden_scales;
+    std::vector<float> output_scales;
+    std::vector<float> hidden_bias;
+    std::vector<float> output_bias;
+    Int8Storage hidden_weights; // hidden x input_stride
+    Int8Storage output_weights; // output x hidden_stride
+
+    // Buffers of classify_quantized, kept by each shard of classify_batch
+    // and each thread calling classify_img, so that classifying does not
+    // allocate once they are sized
+    struct Scratch {
+        std::vector<std::uint8_t> x;        // count x input_stride
+        std::vector<std::int32_t> acc;      // count x max(hidden, output)
+        std::vector<float> activations;     // hidden
+        std::vector<std::uint8_t> hidden_q; // count x hidden_stride
+    };
+
+    void set_topology(int input, int hidden, int output);
+    // Grows scratch to batches of count samples
+    void reserve(Scratch &scratch, std::size_t count) const;
+    // Labels of count samples already quantized in scratch.x
+    void classify_quantized(Scratch &scratch, std::size_t count,
+                            std::size_t *labels) const;
+
+  public:
+    QuantizedNetwork() = default;
+
+    // Quantizes net, calibrating the activation ranges on calibration (a
+    // std::vector<Img>, MappedDataset, Dataset or Dataset::Batch,
+    // instantiated in QuantizedNetwork.cpp)
+    template <typename Images>
+    QuantizedNetwork(const NeuralNetwork &net, const Images &calibration);
+
+    std::size_t classify_img(const ImgView &img) const;
+    // Labels of all images, batch_size images per int8 GEMM, spread over
+    // threads threads (0 = one per hardware core)
+    template <typename Images>
+    void classify_batch(const Images &imgs, std::span<std::size_t> labels,
+                        unsigned int batch_size = 256,
+                        unsigned int threads = 0) const;
+    // Fraction of correctly classified images
+    template <typename Images> double classify_imgs(const Images &imgs) const;
+
+    // Written to file_string + ".tmp", renamed over file_string once
+    // complete. Throws std::runtime_error when the file cannot be written
+    void save(const std::string &file_string) const;
+    // Throws std::runtime_error when the file is missing or malformed
+    void load(const std::string &file_string);
+
+    // getters
+    int getInput() const { return input; }
+    int getHidden() const { return hidden; }
+    int getOutput() const { return output; }
+    float getInputScale() const { return input_scale; }
+    float getHiddenScale() const { return hidden_scale; }
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef> // size_t
+#include <cstdint> // uint32_t
+#include <vector>  // vector
+
+#include "../math/Matrix2D.hpp"
+
+// Intermediate buffers of a training step, sized once from the network
+// topology and reused by every step so that training does not allocate.
+// Each column holds one sample of the batch.
+struct TrainingWorkspace {
+    Matrix2D input;          // input x batch, flattened images
+    Matrix2D target;         // output x batch, one-hot labels
+    Matrix2D hidden_outputs; // hidden x batch
+    Matrix2D final_outputs;  // output x batch
+    Matrix2D output_errors;  // output x batch
+    Matrix2D output_deltas;  // output x batch, errors * sigmoid'
+    // hidden x batch, errors * sigmoid', the errors never stored (the GEMM
+    // producing them scales them in its epilogue)
+    Matrix2D hidden_deltas;
+    // Summed weight and bias gradients of the batch, read by optimizers with
+    // state and by data-parallel training, where every worker accumulates its
+    // own before the reduction. SGD steps add the gradients to the weights
+    // without storing them
+    Matrix2D output_gradient;      // output x hidden
+    Matrix2D hidden_gradient;      // hidden x input
+    Matrix2D output_bias_gradient; // output x 1
+    Matrix2D hidden_bias_gradient; // hidden x 1
+    // Batch of uint8 samples (input x batch) used instead of input when
+    // input_scale != 0, pixel = byte / input_scale. The first layer reads it
+    // directly, see ByteMatrix
+    ByteStorage input_bytes;
+    float input_scale = 0.0f;
+    // Blocks of gemm::sparse_block inputs holding a nonzero value in some
+    // sample of the batch, and whether they are few enough for the first
+    // layer to skip the others (see SparseInput). Set by find_active_inputs
+    std::vector<std::uint32_t> active_blocks;
+    bool sparse_input = false;
+
+    TrainingWorkspace() = default;
+
+    TrainingWorkspace(std::size_t input, std::size_t hidden,
+                      std::size_t output, std::size_t batch = 1)
+        : input(input, batch), target(output, batch),
+          hidden_outputs(hidden, batch), final_outputs(output, batch),
+          output_errors(output, batch), output_deltas(output, batch),
+          hidden_deltas(hidden, batch) {
+        active_blocks.reserve((input + gemm::sparse_block - 1) /
+                              gemm::sparse_block);
+    }
+
+    // The uint8 batch as a matrix
+    ByteMatrix byte_input() const {
+        return {input_bytes.data(), input.getCols(), input.getRows(),
+                input_scale};
+    }
+
+    // Finds the active blocks of the batch in input, or input_bytes when
+    // input_scale != 0. Images leave most pixels blank, but skipping fewer
+    // than 1/8 of the inputs does not pay for gathering the others
+    void find_active_inputs() {
+        const std::size_t n = input.getCols();
+        if (input_scale != 0.0f) {
+            find_active_blocks(input_bytes.data(), n, input.getRows(),
+                               active_blocks);
+        } else {
+            find_active_blocks(input.getData().data(), n, input.getRows(),
+                               active_blocks);
+        }
+        const std::size_t blocks =
+            (n + gemm::sparse_block - 1) / gemm::sparse_block;
+        sparse_input = active_blocks.size() * 8 <= blocks * 7;
+    }
+
+    // Resizes every buffer to hold batch samples. Storage only grows, so
+    // switching back to a smaller batch does not allocate
+    void resize(std::size_t batch) {
+        for (Matrix2D *m : {&input, &target, &hidden_outputs, &final_outputs,
+                            &output_errors, &output_deltas, &hidden_deltas}) {
+            m->resize(m->getCols(), batch);
+        }
+    }
+};
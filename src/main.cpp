@@ -1,8 +1,14 @@
+#include "deep_learning/Checkpointer.hpp"
+#include "deep_learning/LayerStack.hpp"
 #include "deep_learning/NeuralNetwork.hpp"
+#include "deep_learning/QuantizedNetwork.hpp"
+#include "utils/CompressedDataset.hpp"
 
 #include <chrono> // duration && duration_cast && milliseconds && nanoseconds && high_resolution_clock
+#include <filesystem> // remove
 #include <iostream> // cout && endl
 #include <locale>   // locale && to_string
+#include <memory>   // unique_ptr && make_unique
 #include <ranges>   // views::iota
 
 void benchmark(std::function<void()> func,
@@ -42,9 +48,11 @@ void TestMatrixAlgos() {
 void StartTraining() {
     // TRAINING
     try {
-        std::vector<Img> imgs;
+        Dataset imgs;
         benchmark(
-            [&imgs]() { imgs = csv_to_imgs("data/mnist_train.csv", 60000); },
+            [&imgs]() {
+                imgs = Dataset(csv_to_imgs("data/mnist_train.csv", 60000));
+            },
             "1. csv_to_imgs");
         NeuralNetwork net(784, 300, 10, 0.164f);
         benchmark([&net, &imgs]() { net.train_batch_imgs(imgs, 8); },
@@ -58,12 +66,13 @@ void StartTraining() {
 void ContinueTraining(unsigned int nEpochs=1) {
     // Continue TRAINING
     try {
-        std::vector<Img> imgs;
+        // Pixels stay uint8 in memory, the first layer dequantizes them
+        Dataset imgs;
         benchmark(
             [&imgs]() {
-                imgs = load_binary_compact_imgs("data/mnist_train_compact.bin");
+                imgs = load_compressed_dataset("data/mnist_train.zdataset");
             },
-            "1. load_binary_compact_imgs");
+            "1. load_compressed_dataset");
         NeuralNetwork net;
         benchmark([&net]() { net.load_bin("data/net.net-bin"); },
                   "2. load_bin");
@@ -76,6 +85,73 @@ void ContinueTraining(unsigned int nEpochs=1) {
     }
 }
 
+void AdamTraining(unsigned int nEpochs = 1) {
+    // TRAINING with Adam on mini-batches, scored after every epoch. The
+    // moments are saved with the model, so ContinueTraining resumes with them
+    try {
+        Dataset imgs = load_compressed_dataset("data/mnist_train.zdataset");
+        MappedDataset test("data/mnist_test.dataset");
+        NeuralNetwork net(784, 300, 10, 0.001f);
+        net.set_optimizer({OptimizerKind::Adam});
+        for (unsigned int e = 1; e <= nEpochs; e++) {
+            imgs.shuffle(e);
+            benchmark([&net, &imgs]() { net.train_minibatch(imgs, 32); },
+                      "Epoch " + std::to_string(e) + ". train_minibatch");
+            std::cout << "Score: " << net.classify_imgs(test) << std::endl;
+        }
+        benchmark([&net]() { net.save_bin("data/net.net-bin"); }, "save_bin");
+    } catch (const std::exception &e) {
+        std::cout << "Exception: " << e.what() << std::endl;
+    }
+}
+
+void CheckpointedTraining(unsigned int nEpochs = 1) {
+    // TRAINING with a checkpoint every 10000 samples or minute, resumed from
+    // the last one when the previous run was interrupted
+    try {
+        Dataset imgs = load_compressed_dataset("data/mnist_train.zdataset");
+        imgs.shuffle(0); // Same order on every run, so resuming is exact
+        NeuralNetwork net;
+        Checkpointer checkpointer("data/net.ckpt", 10000, 60.0);
+        benchmark(
+            [&net, &checkpointer]() {
+                if (!checkpointer.resume(net)) {
+                    net.load_bin("data/net.net-bin");
+                }
+            },
+            "1. resume");
+        std::cout << "Resuming at epoch " << net.getPosition().epoch + 1
+                  << ", sample " << net.getPosition().sample << std::endl;
+        net.set_checkpointer(&checkpointer);
+        benchmark([&net, &imgs, &nEpochs]() { net.train_minibatch(imgs, 32, nEpochs); },
+                  "2. train_minibatch");
+        net.set_checkpointer(nullptr);
+        benchmark([&net]() { net.save_bin("data/net.net-bin"); },
+                  "3. save_bin");
+        // The run is complete, its checkpoint is no longer needed
+        checkpointer.flush();
+        std::filesystem::remove(checkpointer.getPath());
+    } catch (const std::exception &e) {
+        std::cout << "Exception: " << e.what() << std::endl;
+    }
+}
+
+void StreamingTraining(unsigned int nEpochs = 1) {
+    // TRAINING on dataset shards streamed from disk
+    try {
+        StreamingLoader loader({"data/mnist_train.dataset"}, 32, 8192);
+        NeuralNetwork net;
+        benchmark([&net]() { net.load_bin("data/net.net-bin"); },
+                  "1. load_bin");
+        benchmark([&net, &loader, &nEpochs]() { net.train_stream(loader, nEpochs); },
+                  "2. train_stream");
+        benchmark([&net]() { net.save_bin("data/net.net-bin"); },
+                  "3. save_bin");
+    } catch (const std::exception &e) {
+        std::cout << "Exception: " << e.what() << std::endl;
+    }
+}
+
 void Converting() {
     // Convert csv to binary
     try {
@@ -94,6 +170,15 @@ void Converting() {
             },
             "3. save_binary_compact_imgs");
 
+        benchmark([&imgs]() { save_dataset("data/mnist_test.dataset", imgs); },
+                  "3b. save_dataset");
+
+        benchmark(
+            [&imgs]() {
+                save_compressed_dataset("data/mnist_test.zdataset", imgs);
+            },
+            "3c. save_compressed_dataset");
+
         benchmark(
             [&imgs]() {
                 imgs = std::move(csv_to_imgs("data/mnist_train.csv", 60000));
@@ -109,6 +194,15 @@ void Converting() {
             },
             "6. save_binary_compact_imgs");
 
+        benchmark([&imgs]() { save_dataset("data/mnist_train.dataset", imgs); },
+                  "6b. save_dataset");
+
+        benchmark(
+            [&imgs]() {
+                save_compressed_dataset("data/mnist_train.zdataset", imgs);
+            },
+            "6c. save_compressed_dataset");
+
         benchmark(
             [&imgs]() {
                 imgs = std::move(load_binary_imgs("data/mnist_test.bin"));
@@ -192,13 +286,14 @@ void Classifying() {
 void ClassificationBenchmarck() {
     // Classifying benchmark
     try {
-        std::vector<Img> imgs;
+        // Memory-mapped: images are read from the page cache on first use
+        std::unique_ptr<MappedDataset> imgs;
         benchmark(
             [&imgs]() {
-                imgs = std::move(
-                    load_binary_compact_imgs("data/mnist_test_compact.bin"));
+                imgs = std::make_unique<MappedDataset>(
+                    "data/mnist_test.dataset");
             },
-            "1. load_binary_compact_imgs");
+            "1. MappedDataset");
 
         NeuralNetwork net2;
         benchmark([&net2]() { net2.load_bin("data/net.net-bin"); },
@@ -206,7 +301,7 @@ void ClassificationBenchmarck() {
 
         double score;
         benchmark(
-            [&net2, &imgs, &score]() { score = net2.classify_imgs(imgs); },
+            [&net2, &imgs, &score]() { score = net2.classify_imgs(*imgs); },
             "3. predict_batch_imgs");
         std::cout << "Score: " << score << std::endl;
 
@@ -215,6 +310,78 @@ void ClassificationBenchmarck() {
     }
 }
 
+void Quantizing() {
+    // Int8 model calibrated on training images, compared on the test set
+    try {
+        NeuralNetwork net;
+        benchmark([&net]() { net.load_bin("data/net.net-bin"); },
+                  "1. load_bin");
+
+        Dataset train(MappedDataset("data/mnist_train.dataset"));
+        train.shuffle(0);
+        QuantizedNetwork quantized;
+        benchmark(
+            [&net, &train, &quantized]() {
+                quantized = QuantizedNetwork(net, train.batch(0, 2000));
+            },
+            "2. quantize");
+        benchmark([&quantized]() { quantized.save("data/net.net-q8"); },
+                  "3. save");
+
+        MappedDataset test("data/mnist_test.dataset");
+        double fp32_score, int8_score;
+        benchmark([&net, &test, &fp32_score]() {
+                      fp32_score = net.classify_imgs(test);
+                  },
+                  "4. fp32 classify_imgs");
+        benchmark([&quantized, &test, &int8_score]() {
+                      int8_score = quantized.classify_imgs(test);
+                  },
+                  "5. int8 classify_imgs");
+        std::cout << "fp32 score: " << fp32_score << std::endl
+                  << "int8 score: " << int8_score << std::endl
+                  << "Delta: " << int8_score - fp32_score << std::endl;
+    } catch (const std::exception &e) {
+        std::cout << "Exception: " << e.what() << std::endl;
+    }
+}
+
+void LayerStackClassifying() {
+    // The 784-300-10 model run by the layer-stack engine, then a deeper
+    // stack saved and loaded through the same format
+    try {
+        LayerStack stack;
+        benchmark([&stack]() { stack.load_bin("data/net.net-bin"); },
+                  "1. load_bin");
+        std::cout << "Layers: " << stack.getLayers().size()
+                  << " Plan floats: " << stack.make_plan(LayerStack::default_batch).size()
+                  << std::endl;
+
+        MappedDataset test("data/mnist_test.dataset");
+        double score;
+        benchmark([&stack, &test, &score]() { score = stack.classify_imgs(test); },
+                  "2. classify_imgs");
+        std::cout << "Score: " << score << std::endl;
+
+        LayerStack deep;
+        for (auto [outputs, inputs] : {std::pair{256, 784}, std::pair{128, 256},
+                                       std::pair{64, 128}, std::pair{10, 64}}) {
+            Matrix2D weights(outputs, inputs);
+            weights.randomize(outputs);
+            deep.add_layer(std::move(weights),
+                           outputs == 10 ? Activation::Sigmoid : Activation::Relu);
+        }
+        benchmark([&deep]() { deep.save_bin("data/deep.net-bin"); },
+                  "3. save_bin");
+        benchmark([&deep]() { deep.load_bin("data/deep.net-bin"); },
+                  "4. load_bin");
+        benchmark([&deep, &test, &score]() { score = deep.classify_imgs(test); },
+                  "5. classify_imgs (untrained 784-256-128-64-10)");
+    } catch (const std::exception &e) {
+        std::cout << "Exception: " << e.what() << std::endl;
+    }
+}
+
 int main(int argc, char *argv[]) {
     std::clog.imbue(std::locale("en-US"));
     std::cout.imbue(std::locale("en-US"));
@@ -225,10 +392,20 @@ int main(int argc, char *argv[]) {
 
     // ContinueTraining(4);
 
+    // AdamTraining(4);
+
+    // CheckpointedTraining(4);
+
+    // StreamingTraining(4);
+
     // Converting();
 
     // Classifying();
 
+    // Quantizing();
+
+    // LayerStackClassifying();
+
     ClassificationBenchmarck();
 
     return 0;
@@ -1,19 +1,22 @@
 #pragma once
 
 #include "Activation.hpp"
+#include "Kernels.hpp"
 #include "Matrix2D.hpp"
 
-// Sigmoid prime
-// Matrix2D sigmoidPrime(const Matrix2D &m) { return m.multiply(1 - m); }
-Matrix2D sigmoidPrime(const Matrix2D &m) {
-    return m.map([](float v) { return v * (1 - v); });
+// Sigmoid prime (lazy, so it fuses with the expression that consumes it)
+// auto sigmoidPrime(const Matrix2D &m) { return m.multiply(1 - m); }
+template <matrix_expr E> auto sigmoidPrime(E &&m) {
+    return std::forward<E>(m).map(kernels::sigmoid_prime);
 }
 
 // Softmax
-Matrix2D softmax(const Matrix2D &m) {
-    double total = m.reduce<double>(0.0, [](double a, float b) { return a + exp(b); });
-    return m.map([&total](float a) -> float { return float(exp(a) / total); });
+inline Matrix2D softmax(const Matrix2D &m) {
+    Matrix2D result = m;
+    result.apply(kernels::exp);
+    result /= result.reduce(0.0f, kernels::sum);
+    return result;
 }
 
 // ReLU prime
-Matrix2D reluPrime(const Matrix2D &m) { return m.map(drelu); }
+inline Matrix2D reluPrime(const Matrix2D &m) { return m.map(drelu); }
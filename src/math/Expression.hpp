@@ -0,0 +1,188 @@
+#pragma once
+
+#include <cassert>     // assert
+#include <concepts>    // derived_from
+#include <cstddef>     // size_t
+#include <type_traits> // conditional_t && decay_t && remove_cvref_t
+#include <utility>     // forward && move
+
+// Lazy element-wise expressions over matrices.
+//
+// Element-wise operators (+ - * / with scalars, + - between matrices,
+// multiply and map) do not compute anything: they return a small expression
+// node that remembers its operands. The whole chain is evaluated in a single
+// loop when it is assigned to (or used to construct) a Matrix2D, so no
+// intermediate matrix is ever allocated. Because every element of the result
+// only depends on the same element of the operands, assigning into a matrix
+// that is also an operand is done in place.
+//
+// Operands that are lvalue matrices are captured by reference, temporaries
+// are moved into the node, so an expression never outlives its data.
+
+template <typename E> class MatrixExpr;
+
+template <typename T>
+concept matrix_expr =
+    std::derived_from<std::remove_cvref_t<T>,
+                      MatrixExpr<std::remove_cvref_t<T>>>;
+
+// How an operand is stored inside an expression node: lvalue leaves by
+// reference, everything else (temporaries, nested nodes) by value
+template <typename T>
+using expr_stored_t =
+    std::conditional_t<std::remove_cvref_t<T>::is_leaf &&
+                           std::is_lvalue_reference_v<T>,
+                       const std::remove_cvref_t<T> &, std::remove_cvref_t<T>>;
+
+struct AddOp {
+    static float apply(float a, float b) { return a + b; }
+};
+
+struct SubOp {
+    static float apply(float a, float b) { return a - b; }
+};
+
+struct MulOp {
+    static float apply(float a, float b) { return a * b; }
+};
+
+template <typename L, typename R, typename Op> class BinaryExpr;
+template <typename E, typename F> class MapExpr;
+
+template <typename Op, typename L, typename R>
+auto make_binary_expr(L &&lhs, R &&rhs) {
+    return BinaryExpr<expr_stored_t<L>, expr_stored_t<R>, Op>(
+        std::forward<L>(lhs), std::forward<R>(rhs));
+}
+
+template <typename E, typename F> auto make_map_expr(E &&expr, F &&f) {
+    return MapExpr<expr_stored_t<E>, std::decay_t<F>>(
+        std::forward<E>(expr), std::forward<F>(f));
+}
+
+// CRTP base of matrices and expression nodes
+template <typename E> class MatrixExpr {
+  public:
+    static constexpr bool is_leaf = false;
+
+    const E &derived() const { return static_cast<const E &>(*this); }
+    E &derived() { return static_cast<E &>(*this); }
+
+    std::size_t size() const {
+        return derived().getCols() * derived().getRows();
+    }
+
+    // Element-wise (Hadamard) product
+    template <matrix_expr R> auto multiply(R &&other) const & {
+        return make_binary_expr<MulOp>(derived(), std::forward<R>(other));
+    }
+
+    template <matrix_expr R> auto multiply(R &&other) && {
+        return make_binary_expr<MulOp>(std::move(derived()),
+                                       std::forward<R>(other));
+    }
+
+    // Apply a function to each element. Any float(float) callable works, it
+    // is stored by value and inlined into the evaluation loop
+    template <typename F> auto map(F &&f) const & {
+        return make_map_expr(derived(), std::forward<F>(f));
+    }
+
+    template <typename F> auto map(F &&f) && {
+        return make_map_expr(std::move(derived()), std::forward<F>(f));
+    }
+};
+
+// Element-wise binary operation between two expressions of the same shape
+template <typename L, typename R, typename Op>
+class BinaryExpr : public MatrixExpr<BinaryExpr<L, R, Op>> {
+    L lhs;
+    R rhs;
+
+  public:
+    template <typename A, typename B>
+    BinaryExpr(A &&a, B &&b)
+        : lhs(std::forward<A>(a)), rhs(std::forward<B>(b)) {
+        assert(lhs.getCols() == rhs.getCols() &&
+               lhs.getRows() == rhs.getRows());
+    }
+
+    std::size_t getCols() const { return lhs.getCols(); }
+    std::size_t getRows() const { return lhs.getRows(); }
+
+    float eval(std::size_t i) const {
+        return Op::apply(lhs.eval(i), rhs.eval(i));
+    }
+};
+
+// Function applied to each element of an expression
+template <typename E, typename F>
+class MapExpr : public MatrixExpr<MapExpr<E, F>> {
+    E expr;
+    F f;
+
+  public:
+    template <typename A, typename G>
+    MapExpr(A &&a, G &&g) : expr(std::forward<A>(a)), f(std::forward<G>(g)) {}
+
+    std::size_t getCols() const { return expr.getCols(); }
+    std::size_t getRows() const { return expr.getRows(); }
+
+    float eval(std::size_t i) const { return f(expr.eval(i)); }
+};
+
+// Matrix addition
+template <matrix_expr L, matrix_expr R> auto operator+(L &&lhs, R &&rhs) {
+    return make_binary_expr<AddOp>(std::forward<L>(lhs), std::forward<R>(rhs));
+}
+
+// Matrix subtraction
+template <matrix_expr L, matrix_expr R> auto operator-(L &&lhs, R &&rhs) {
+    return make_binary_expr<SubOp>(std::forward<L>(lhs), std::forward<R>(rhs));
+}
+
+// Add scalar
+template <matrix_expr E> auto operator+(E &&expr, float scalar) {
+    return make_map_expr(std::forward<E>(expr),
+                         [scalar](float v) { return v + scalar; });
+}
+
+// Scalar addition
+template <matrix_expr E> auto operator+(float scalar, E &&expr) {
+    return std::forward<E>(expr) + scalar;
+}
+
+// Subtract scalar
+template <matrix_expr E> auto operator-(E &&expr, float scalar) {
+    return make_map_expr(std::forward<E>(expr),
+                         [scalar](float v) { return v - scalar; });
+}
+
+// Scalar subtraction
+template <matrix_expr E> auto operator-(float scalar, E &&expr) {
+    return make_map_expr(std::forward<E>(expr),
+                         [scalar](float v) { return scalar - v; });
+}
+
+// Multiply scalar
+template <matrix_expr E> auto operator*(E &&expr, float scalar) {
+    return make_map_expr(std::forward<E>(expr),
+                         [scalar](float v) { return v * scalar; });
+}
+
+// Scalar multiplication
+template <matrix_expr E> auto operator*(float scalar, E &&expr) {
+    return std::forward<E>(expr) * scalar;
+}
+
+// Divide scalar
+template <matrix_expr E> auto operator/(E &&expr, float scalar) {
+    return make_map_expr(std::forward<E>(expr),
+                         [scalar](float v) { return v / scalar; });
+}
+
+// Scalar division
+template <matrix_expr E> auto operator/(float scalar, E &&expr) {
+    return make_map_expr(std::forward<E>(expr),
+                         [scalar](float v) { return scalar / v; });
+}
@@ -0,0 +1,756 @@
+#pragma once
+
+#include <algorithm> // min
+#include <cstddef>   // size_t
+#include <cstdint>   // uint8_t
+#include <memory>    // unique_ptr
+#include <new>       // align_val_t
+#include <type_traits> // is_same_v
+
+#include "Simd.hpp"
+
+// Single precision GEMM engine used behind Matrix2D::operator*.
+//
+// Computes C = alpha * op(A) * op(B) + beta * C for row-major matrices, where
+// op(X) is X or its transpose. The implementation follows the classic
+// Goto/BLIS layering: the operands are split into KC x NC panels of B (kept in
+// L2/L3) and MC x KC blocks of A (kept in L2), both packed into contiguous
+// micro-panels so that the MR x NR register-blocked micro-kernel streams
+// through memory with unit stride.
+namespace gemm {
+
+enum class Op { N, T };
+
+// Epilogues: an element-wise step fused into the GEMM, applied to each tile
+// of C right after its last rank-kc update while it is still in registers,
+// so that C makes one trip through memory instead of one per step. An
+// epilogue maps the value v of C(i, j) to its final value, and has an AVX
+// form for C(i, j..j + 7) when NN_AVX2 is defined.
+
+// Plain GEMM
+struct NoEpilogue {};
+
+// C(i, j) = activation(C(i, j) + bias[i]): a dense layer with one neuron per
+// row of C. activation is a kernel of Kernels.hpp
+template <typename Activation> struct BiasActivation {
+    const float *bias;
+    Activation activation;
+
+    float operator()(float v, std::size_t i, std::size_t) const {
+        return activation(v + bias[i]);
+    }
+#ifdef NN_AVX2
+    __m256 operator()(__m256 v, std::size_t i, std::size_t) const {
+        return activation(_mm256_add_ps(v, _mm256_set1_ps(bias[i])));
+    }
+#endif
+};
+
+template <typename Activation>
+BiasActivation<Activation> bias_activation(const float *bias,
+                                           Activation activation) {
+    return {bias, activation};
+}
+
+// C(i, j) *= derivative(Y(i, j)), with Y (ldy row stride) the outputs of the
+// activation: the errors of a layer turned into its deltas. derivative is a
+// kernel of Kernels.hpp taking the activation output, e.g. sigmoid_prime
+template <typename Derivative> struct ScaleByDerivative {
+    const float *y;
+    std::size_t ldy;
+    Derivative derivative;
+
+    float operator()(float v, std::size_t i, std::size_t j) const {
+        return v * derivative(y[i * ldy + j]);
+    }
+#ifdef NN_AVX2
+    __m256 operator()(__m256 v, std::size_t i, std::size_t j) const {
+        return _mm256_mul_ps(v, derivative(_mm256_loadu_ps(y + i * ldy + j)));
+    }
+#endif
+};
+
+template <typename Derivative>
+ScaleByDerivative<Derivative> scale_by_derivative(const float *y,
+                                                  std::size_t ldy,
+                                                  Derivative derivative) {
+    return {y, ldy, derivative};
+}
+
+// Register block: 6 rows x 16 columns = 12 AVX accumulators
+constexpr std::size_t MR = 6;
+constexpr std::size_t NR = 16;
+// Cache blocks: A block MC x KC fits L2, B micro-panel KC x NR fits L1
+constexpr std::size_t MC = 144;
+constexpr std::size_t KC = 256;
+constexpr std::size_t NC = 4080;
+// Sparse operands (see sgemm_sparse_k) list their nonzero inner indices in
+// aligned blocks of this many, the width of an AVX register
+constexpr std::size_t sparse_block = 8;
+
+namespace detail {
+
+struct AlignedDelete {
+    void operator()(float *p) const {
+        ::operator delete[](p, std::align_val_t(64));
+    }
+};
+
+// Per-thread packing buffers, grown on demand and reused by every call
+struct PackBuffers {
+    std::unique_ptr<float[], AlignedDelete> a;
+    std::unique_ptr<float[], AlignedDelete> b;
+    std::size_t a_size = 0;
+    std::size_t b_size = 0;
+
+    static float *reserve(std::unique_ptr<float[], AlignedDelete> &buf,
+                          std::size_t &size, std::size_t needed) {
+        if (needed > size) {
+            buf.reset(static_cast<float *>(::operator new[](
+                needed * sizeof(float), std::align_val_t(64))));
+            size = needed;
+        }
+        return buf.get();
+    }
+
+    static PackBuffers &local() {
+        thread_local PackBuffers buffers;
+        return buffers;
+    }
+};
+
+// Element (i, k) of op(A)
+inline float at(Op op, const float *a, std::size_t ld, std::size_t i,
+                std::size_t k) {
+    return op == Op::N ? a[i * ld + k] : a[k * ld + i];
+}
+
+// Inner index p of a product restricted to the blocks of sparse_block
+// inner indices in k_blocks (nullptr: all of them)
+inline std::size_t inner(const std::uint32_t *k_blocks, std::size_t p) {
+    return k_blocks == nullptr
+               ? p
+               : k_blocks[p / sparse_block] * sparse_block + p % sparse_block;
+}
+
+// Packs the mc x kc block of op(A) starting at (ic, pc) into MR-row
+// micro-panels, zero padding the last one
+inline void pack_a(Op op, const float *a, std::size_t lda, std::size_t ic,
+                   std::size_t pc, std::size_t mc, std::size_t kc,
+                   float *dst, const std::uint32_t *k_blocks = nullptr) {
+    for (std::size_t ir = 0; ir < mc; ir += MR) {
+        std::size_t mr = std::min(MR, mc - ir);
+        for (std::size_t p = 0; p < kc; ++p) {
+            std::size_t col = inner(k_blocks, pc + p);
+            std::size_t r = 0;
+            for (; r < mr; ++r)
+                dst[r] = at(op, a, lda, ic + ir + r, col);
+            for (; r < MR; ++r)
+                dst[r] = 0.0f;
+            dst += MR;
+        }
+    }
+}
+
+// Packs the kc x nc block of op(B) starting at (pc, jc) into NR-column
+// micro-panels, zero padding the last one. B may be stored as another
+// element type (uint8 pixels), converted to float while packing
+template <typename TB>
+inline void pack_b(Op op, const TB *b, std::size_t ldb, std::size_t pc,
+                   std::size_t jc, std::size_t kc, std::size_t nc,
+                   float *dst, const std::uint32_t *k_blocks = nullptr) {
+    for (std::size_t jr = 0; jr < nc; jr += NR) {
+        std::size_t nr = std::min(NR, nc - jr);
+        for (std::size_t p = 0; p < kc; ++p) {
+            std::size_t row = inner(k_blocks, pc + p);
+            std::size_t c = 0;
+            if (op == Op::N) {
+                const TB *src = b + row * ldb + jc + jr;
+#ifdef NN_AVX2
+                if constexpr (std::is_same_v<TB, std::uint8_t>) {
+                    if (nr == NR) {
+                        // 16 bytes widened to two vectors of 8 floats
+                        __m128i v = _mm_loadu_si128(
+                            reinterpret_cast<const __m128i *>(src));
+                        _mm256_store_ps(dst, _mm256_cvtepi32_ps(
+                                                 _mm256_cvtepu8_epi32(v)));
+                        _mm256_store_ps(
+                            dst + 8, _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+                                         _mm_srli_si128(v, 8))));
+                        c = NR;
+                    }
+                }
+#endif
+                for (; c < nr; ++c)
+                    dst[c] = float(src[c]);
+            } else {
+                for (; c < nr; ++c)
+                    dst[c] = float(b[(jc + jr + c) * ldb + row]);
+            }
+            for (; c < NR; ++c)
+                dst[c] = 0.0f;
+            dst += NR;
+        }
+    }
+}
+
+// Full MR x NR tile: c = alpha * a * b + beta * c, then the epilogue, the
+// tile starting at C(i, j)
+template <typename Epilogue = NoEpilogue>
+inline void micro_kernel(std::size_t kc, const float *a, const float *b,
+                         float *c, std::size_t ldc, float alpha, float beta,
+                         const Epilogue &epilogue = {}, std::size_t i = 0,
+                         std::size_t j = 0) {
+    constexpr bool fused = !std::is_same_v<Epilogue, NoEpilogue>;
+#ifdef NN_AVX2
+    __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+    __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+    __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+    __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+    __m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+    __m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+    for (std::size_t p = 0; p < kc; ++p) {
+        __m256 b0 = _mm256_load_ps(b);
+        __m256 b1 = _mm256_load_ps(b + 8);
+        __m256 av = _mm256_broadcast_ss(a + 0);
+        c00 = _mm256_fmadd_ps(av, b0, c00);
+        c01 = _mm256_fmadd_ps(av, b1, c01);
+        av = _mm256_broadcast_ss(a + 1);
+        c10 = _mm256_fmadd_ps(av, b0, c10);
+        c11 = _mm256_fmadd_ps(av, b1, c11);
+        av = _mm256_broadcast_ss(a + 2);
+        c20 = _mm256_fmadd_ps(av, b0, c20);
+        c21 = _mm256_fmadd_ps(av, b1, c21);
+        av = _mm256_broadcast_ss(a + 3);
+        c30 = _mm256_fmadd_ps(av, b0, c30);
+        c31 = _mm256_fmadd_ps(av, b1, c31);
+        av = _mm256_broadcast_ss(a + 4);
+        c40 = _mm256_fmadd_ps(av, b0, c40);
+        c41 = _mm256_fmadd_ps(av, b1, c41);
+        av = _mm256_broadcast_ss(a + 5);
+        c50 = _mm256_fmadd_ps(av, b0, c50);
+        c51 = _mm256_fmadd_ps(av, b1, c51);
+        a += MR;
+        b += NR;
+    }
+    __m256 va = _mm256_set1_ps(alpha);
+    __m256 acc[MR][2] = {{c00, c01}, {c10, c11}, {c20, c21},
+                         {c30, c31}, {c40, c41}, {c50, c51}};
+    __m256 vb = _mm256_set1_ps(beta);
+    for (std::size_t r = 0; r < MR; ++r) {
+        float *row = c + r * ldc;
+        __m256 v0, v1;
+        if (beta == 0.0f) {
+            v0 = _mm256_mul_ps(va, acc[r][0]);
+            v1 = _mm256_mul_ps(va, acc[r][1]);
+        } else {
+            v0 = _mm256_fmadd_ps(va, acc[r][0],
+                                 _mm256_mul_ps(vb, _mm256_loadu_ps(row)));
+            v1 = _mm256_fmadd_ps(va, acc[r][1],
+                                 _mm256_mul_ps(vb, _mm256_loadu_ps(row + 8)));
+        }
+        if constexpr (fused) {
+            v0 = epilogue(v0, i + r, j);
+            v1 = epilogue(v1, i + r, j + 8);
+        }
+        _mm256_storeu_ps(row, v0);
+        _mm256_storeu_ps(row + 8, v1);
+    }
+#else
+    float acc[MR][NR] = {};
+    for (std::size_t p = 0; p < kc; ++p) {
+        for (std::size_t r = 0; r < MR; ++r) {
+            for (std::size_t j = 0; j < NR; ++j) {
+                acc[r][j] += a[r] * b[j];
+            }
+        }
+        a += MR;
+        b += NR;
+    }
+    for (std::size_t r = 0; r < MR; ++r) {
+        for (std::size_t q = 0; q < NR; ++q) {
+            float &dst = c[r * ldc + q];
+            dst = beta == 0.0f ? alpha * acc[r][q]
+                               : alpha * acc[r][q] + beta * dst;
+            if constexpr (fused) {
+                dst = epilogue(dst, i + r, j + q);
+            }
+        }
+    }
+#endif
+}
+
+// Partial mr x nr tile at the matrix edges, computed into a scratch tile
+template <typename Epilogue = NoEpilogue>
+inline void micro_kernel_edge(std::size_t kc, const float *a, const float *b,
+                              float *c, std::size_t ldc, std::size_t mr,
+                              std::size_t nr, float alpha, float beta,
+                              const Epilogue &epilogue = {}, std::size_t i = 0,
+                              std::size_t j = 0) {
+    alignas(64) float tile[MR * NR];
+    micro_kernel(kc, a, b, tile, NR, 1.0f, 0.0f);
+    for (std::size_t r = 0; r < mr; ++r) {
+        for (std::size_t q = 0; q < nr; ++q) {
+            float &dst = c[r * ldc + q];
+            dst = beta == 0.0f ? alpha * tile[r * NR + q]
+                               : alpha * tile[r * NR + q] + beta * dst;
+            if constexpr (!std::is_same_v<Epilogue, NoEpilogue>) {
+                dst = epilogue(dst, i + r, j + q);
+            }
+        }
+    }
+}
+
+// Epilogue over a whole m x n C, for the paths without micro-kernel
+template <typename Epilogue>
+inline void apply_epilogue(const Epilogue &epilogue, float *c, std::size_t m,
+                           std::size_t n, std::size_t ldc) {
+    if constexpr (!std::is_same_v<Epilogue, NoEpilogue>) {
+        for (std::size_t i = 0; i < m; ++i)
+            for (std::size_t j = 0; j < n; ++j)
+                c[i * ldc + j] = epilogue(c[i * ldc + j], i, j);
+    }
+}
+
+inline float dot(const float *x, const float *y, std::size_t n) {
+    std::size_t i = 0;
+    float sum = 0.0f;
+#ifdef NN_AVX2
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+    __m256 s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+    for (; i + 32 <= n; i += 32) {
+        s0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), s0);
+        s1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(y + i + 8), s1);
+        s2 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 16), _mm256_loadu_ps(y + i + 16), s2);
+        s3 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 24), _mm256_loadu_ps(y + i + 24), s3);
+    }
+    for (; i + 8 <= n; i += 8)
+        s0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i), s0);
+    __m256 s = _mm256_add_ps(_mm256_add_ps(s0, s1), _mm256_add_ps(s2, s3));
+    __m128 h = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+    h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+    h = _mm_add_ss(h, _mm_movehdup_ps(h));
+    sum = _mm_cvtss_f32(h);
+#endif
+    for (; i < n; ++i)
+        sum += x[i] * y[i];
+    return sum;
+}
+
+// y += a * x
+inline void axpy(float a, const float *x, float *y, std::size_t n) {
+    std::size_t i = 0;
+#ifdef NN_AVX2
+    __m256 va = _mm256_set1_ps(a);
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(y + i, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + i),
+                                                _mm256_loadu_ps(y + i)));
+#endif
+    for (; i < n; ++i)
+        y[i] += a * x[i];
+}
+
+// y = beta * y
+inline void scale(float beta, float *y, std::size_t n, std::size_t inc) {
+    for (std::size_t i = 0; i < n; ++i) {
+        float &v = y[i * inc];
+        v = beta == 0.0f ? 0.0f : beta * v;
+    }
+}
+
+// Matrix-vector fast path (N == 1): packing would cost as much as the product
+inline void gemv(Op ta, std::size_t m, std::size_t k, float alpha,
+                 const float *a, std::size_t lda, const float *x,
+                 std::size_t incx, float beta, float *y, std::size_t incy) {
+    if (ta == Op::N && incx == 1) {
+        for (std::size_t i = 0; i < m; ++i) {
+            float &dst = y[i * incy];
+            float v = alpha * dot(a + i * lda, x, k);
+            dst = beta == 0.0f ? v : v + beta * dst;
+        }
+    } else if (ta == Op::T && incy == 1) {
+        scale(beta, y, m, 1);
+        for (std::size_t p = 0; p < k; ++p)
+            axpy(alpha * x[p * incx], a + p * lda, y, m);
+    } else {
+        for (std::size_t i = 0; i < m; ++i) {
+            float sum = 0.0f;
+            for (std::size_t p = 0; p < k; ++p)
+                sum += at(ta, a, lda, i, p) * x[p * incx];
+            float &dst = y[i * incy];
+            dst = beta == 0.0f ? alpha * sum : alpha * sum + beta * dst;
+        }
+    }
+}
+
+// a[0..n) += sum over p < k of coef[p] * yt[p * n + j]: one row of a rank-k
+// update, read and written once with the k FMAs of each element in
+// registers
+inline void update_row(std::size_t k, const float *coef, const float *yt,
+                       std::size_t n, float *a) {
+    std::size_t j = 0;
+#ifdef NN_AVX2
+    for (; j + 32 <= n; j += 32) {
+        __m256 a0 = _mm256_loadu_ps(a + j);
+        __m256 a1 = _mm256_loadu_ps(a + j + 8);
+        __m256 a2 = _mm256_loadu_ps(a + j + 16);
+        __m256 a3 = _mm256_loadu_ps(a + j + 24);
+        for (std::size_t p = 0; p < k; ++p) {
+            const float *y = yt + p * n + j;
+            __m256 c = _mm256_broadcast_ss(coef + p);
+            a0 = _mm256_fmadd_ps(c, _mm256_loadu_ps(y), a0);
+            a1 = _mm256_fmadd_ps(c, _mm256_loadu_ps(y + 8), a1);
+            a2 = _mm256_fmadd_ps(c, _mm256_loadu_ps(y + 16), a2);
+            a3 = _mm256_fmadd_ps(c, _mm256_loadu_ps(y + 24), a3);
+        }
+        _mm256_storeu_ps(a + j, a0);
+        _mm256_storeu_ps(a + j + 8, a1);
+        _mm256_storeu_ps(a + j + 16, a2);
+        _mm256_storeu_ps(a + j + 24, a3);
+    }
+    for (; j + 8 <= n; j += 8) {
+        __m256 a0 = _mm256_loadu_ps(a + j);
+        for (std::size_t p = 0; p < k; ++p)
+            a0 = _mm256_fmadd_ps(_mm256_broadcast_ss(coef + p),
+                                 _mm256_loadu_ps(yt + p * n + j), a0);
+        _mm256_storeu_ps(a + j, a0);
+    }
+#endif
+    // One axpy per p over the remaining columns, which the compiler
+    // vectorizes
+    for (std::size_t p = 0; p < k; ++p)
+        for (std::size_t jj = j; jj < n; ++jj)
+            a[jj] += coef[p] * yt[p * n + jj];
+}
+
+// Number of blocks in the blocks of sparse_block indices below n listed in
+// blocks (count of them, ascending) that are whole, all but maybe the last
+inline std::size_t whole_blocks(const std::uint32_t *blocks,
+                                std::size_t count, std::size_t n) {
+    return count > 0 && (blocks[count - 1] + 1) * sparse_block > n ? count - 1
+                                                                   : count;
+}
+
+// Sum of x[j] * y[j'] over the indices j below n in the blocks of
+// sparse_block listed in blocks (count of them), y holding the entries of
+// the blocks one after another
+inline float dot_blocks(const float *x, const std::uint32_t *blocks,
+                        std::size_t count, std::size_t n, const float *y) {
+    std::size_t q = 0;
+    float sum = 0.0f;
+#ifdef NN_AVX2
+    const std::size_t whole = whole_blocks(blocks, count, n);
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+    __m256 s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+    for (; q + 4 <= whole; q += 4, y += 32) {
+        s0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + blocks[q] * 8), _mm256_loadu_ps(y), s0);
+        s1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + blocks[q + 1] * 8), _mm256_loadu_ps(y + 8), s1);
+        s2 = _mm256_fmadd_ps(_mm256_loadu_ps(x + blocks[q + 2] * 8), _mm256_loadu_ps(y + 16), s2);
+        s3 = _mm256_fmadd_ps(_mm256_loadu_ps(x + blocks[q + 3] * 8), _mm256_loadu_ps(y + 24), s3);
+    }
+    for (; q < whole; ++q, y += 8)
+        s0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + blocks[q] * 8), _mm256_loadu_ps(y), s0);
+    __m256 s = _mm256_add_ps(_mm256_add_ps(s0, s1), _mm256_add_ps(s2, s3));
+    __m128 h = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+    h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+    h = _mm_add_ss(h, _mm_movehdup_ps(h));
+    sum = _mm_cvtss_f32(h);
+#endif
+    for (; q < count; ++q, y += sparse_block) {
+        std::size_t j = blocks[q] * sparse_block;
+        std::size_t len = std::min(sparse_block, n - j);
+        for (std::size_t t = 0; t < len; ++t)
+            sum += x[j + t] * y[t];
+    }
+    return sum;
+}
+
+// a[j] += sum over p < k of x[p] * yt[p * ldyt + j'] for the indices j below
+// n in the blocks of sparse_block listed in blocks (count of them), yt
+// holding the entries of the blocks one after another: one row of a sparse
+// rank-k update, each block read and written once with its k FMAs in
+// registers
+inline void update_blocks(std::size_t k, const float *x, const float *yt,
+                          std::size_t ldyt, const std::uint32_t *blocks,
+                          std::size_t count, std::size_t n, float *a) {
+    std::size_t q = 0;
+#ifdef NN_AVX2
+    const std::size_t whole = whole_blocks(blocks, count, n);
+    for (; q + 4 <= whole; q += 4) {
+        float *a0 = a + blocks[q] * 8, *a1 = a + blocks[q + 1] * 8;
+        float *a2 = a + blocks[q + 2] * 8, *a3 = a + blocks[q + 3] * 8;
+        __m256 v0 = _mm256_loadu_ps(a0), v1 = _mm256_loadu_ps(a1);
+        __m256 v2 = _mm256_loadu_ps(a2), v3 = _mm256_loadu_ps(a3);
+        for (std::size_t p = 0; p < k; ++p) {
+            const float *y = yt + p * ldyt + q * 8;
+            __m256 c = _mm256_broadcast_ss(x + p);
+            v0 = _mm256_fmadd_ps(c, _mm256_loadu_ps(y), v0);
+            v1 = _mm256_fmadd_ps(c, _mm256_loadu_ps(y + 8), v1);
+            v2 = _mm256_fmadd_ps(c, _mm256_loadu_ps(y + 16), v2);
+            v3 = _mm256_fmadd_ps(c, _mm256_loadu_ps(y + 24), v3);
+        }
+        _mm256_storeu_ps(a0, v0);
+        _mm256_storeu_ps(a1, v1);
+        _mm256_storeu_ps(a2, v2);
+        _mm256_storeu_ps(a3, v3);
+    }
+    for (; q < whole; ++q) {
+        float *a0 = a + blocks[q] * 8;
+        __m256 v0 = _mm256_loadu_ps(a0);
+        for (std::size_t p = 0; p < k; ++p)
+            v0 = _mm256_fmadd_ps(_mm256_broadcast_ss(x + p),
+                                 _mm256_loadu_ps(yt + p * ldyt + q * 8), v0);
+        _mm256_storeu_ps(a0, v0);
+    }
+#endif
+    for (; q < count; ++q) {
+        std::size_t j = blocks[q] * sparse_block;
+        std::size_t len = std::min(sparse_block, n - j);
+        for (std::size_t p = 0; p < k; ++p)
+            for (std::size_t t = 0; t < len; ++t)
+                a[j + t] += x[p] * yt[p * ldyt + q * sparse_block + t];
+    }
+}
+
+// Blocked loops of sgemm: packed panels of B and blocks of A through the
+// micro-kernel, the inner dimension restricted to k_blocks if not nullptr
+template <typename TB, typename Epilogue>
+inline void gemm_blocked(Op ta, Op tb, std::size_t m, std::size_t n,
+                         std::size_t k, const std::uint32_t *k_blocks,
+                         float alpha, const float *a, std::size_t lda,
+                         const TB *b, std::size_t ldb, float beta, float *c,
+                         std::size_t ldc, const Epilogue &epilogue) {
+    auto round_up = [](std::size_t v, std::size_t r) { return (v + r - 1) / r * r; };
+    auto &buffers = PackBuffers::local();
+    float *pa = PackBuffers::reserve(
+        buffers.a, buffers.a_size, round_up(std::min(MC, m), MR) * std::min(KC, k));
+    float *pb = PackBuffers::reserve(
+        buffers.b, buffers.b_size, round_up(std::min(NC, n), NR) * std::min(KC, k));
+
+    for (std::size_t jc = 0; jc < n; jc += NC) {
+        std::size_t nc = std::min(NC, n - jc);
+        for (std::size_t pc = 0; pc < k; pc += KC) {
+            std::size_t kc = std::min(KC, k - pc);
+            // Only the first rank-kc update scales C, the rest accumulate,
+            // and only the last one applies the epilogue
+            float beta_k = pc == 0 ? beta : 1.0f;
+            pack_b(tb, b, ldb, pc, jc, kc, nc, pb, k_blocks);
+            auto update = [&](const auto &ep) {
+                for (std::size_t ic = 0; ic < m; ic += MC) {
+                    std::size_t mc = std::min(MC, m - ic);
+                    pack_a(ta, a, lda, ic, pc, mc, kc, pa, k_blocks);
+                    for (std::size_t jr = 0; jr < nc; jr += NR) {
+                        std::size_t nr = std::min(NR, nc - jr);
+                        for (std::size_t ir = 0; ir < mc; ir += MR) {
+                            std::size_t mr = std::min(MR, mc - ir);
+                            float *ct = c + (ic + ir) * ldc + jc + jr;
+                            if (mr == MR && nr == NR) {
+                                micro_kernel(kc, pa + ir * kc, pb + jr * kc,
+                                             ct, ldc, alpha, beta_k, ep,
+                                             ic + ir, jc + jr);
+                            } else {
+                                micro_kernel_edge(
+                                    kc, pa + ir * kc, pb + jr * kc, ct, ldc,
+                                    mr, nr, alpha, beta_k, ep, ic + ir,
+                                    jc + jr);
+                            }
+                        }
+                    }
+                }
+            };
+            if (pc + kc == k) {
+                update(epilogue);
+            } else {
+                update(NoEpilogue{});
+            }
+        }
+    }
+}
+
+} // namespace detail
+
+// C (m x n) = alpha * op(A) (m x k) * op(B) (k x n) + beta * C
+// lda, ldb and ldc are the row strides of the stored (untransposed) matrices.
+// B is float, or uint8 (quantized pixels) converted to float while it is
+// packed, so that it is never expanded in memory; a dequantization scale
+// goes into alpha. The epilogue, if any, is applied to the final C
+template <typename TB, typename Epilogue = NoEpilogue>
+inline void sgemm(Op ta, Op tb, std::size_t m, std::size_t n, std::size_t k,
+                  float alpha, const float *a, std::size_t lda, const TB *b,
+                  std::size_t ldb, float beta, float *c, std::size_t ldc,
+                  const Epilogue &epilogue = {}) {
+    if (m == 0 || n == 0)
+        return;
+    if (k == 0 || alpha == 0.0f) {
+        for (std::size_t i = 0; i < m; ++i)
+            detail::scale(beta, c + i * ldc, n, 1);
+        detail::apply_epilogue(epilogue, c, m, n, ldc);
+        return;
+    }
+    auto &buffers = detail::PackBuffers::local();
+    if (n == 1) {
+        if constexpr (std::is_same_v<TB, float>) {
+            detail::gemv(ta, m, k, alpha, a, lda, b, tb == Op::N ? ldb : 1,
+                         beta, c, ldc);
+        } else {
+            // Converts the vector once, into the B packing buffer
+            float *x = detail::PackBuffers::reserve(buffers.b, buffers.b_size, k);
+            std::size_t incx = tb == Op::N ? ldb : 1;
+            for (std::size_t p = 0; p < k; ++p)
+                x[p] = float(b[p * incx]);
+            detail::gemv(ta, m, k, alpha, a, lda, x, 1, beta, c, ldc);
+        }
+        detail::apply_epilogue(epilogue, c, m, n, ldc);
+        return;
+    }
+
+    detail::gemm_blocked(ta, tb, m, n, k, nullptr, alpha, a, lda, b, ldb, beta,
+                         c, ldc, epilogue);
+}
+
+// C (m x n) = alpha * A(:, J) * B(J, :) + beta * C, J the inner indices
+// below k in the blocks of sparse_block listed in k_blocks (count of them,
+// ascending): for a B that is zero outside of the rows J, e.g. a batch of
+// images (one per column) with blank pixels, the same product as sgemm
+// (Op::N, Op::N) at the cost of an inner dimension of |J|. The columns of A
+// and rows of B in J are gathered while they are packed. B is float or
+// uint8, as in sgemm
+template <typename TB, typename Epilogue = NoEpilogue>
+inline void sgemm_sparse_k(std::size_t m, std::size_t n, std::size_t k,
+                           const std::uint32_t *k_blocks, std::size_t count,
+                           float alpha, const float *a, std::size_t lda,
+                           const TB *b, std::size_t ldb, float beta, float *c,
+                           std::size_t ldc, const Epilogue &epilogue = {}) {
+    if (m == 0 || n == 0)
+        return;
+    // |J|, the last block may be cut at k
+    std::size_t kj = count * sparse_block;
+    if (detail::whole_blocks(k_blocks, count, k) < count)
+        kj -= (k_blocks[count - 1] + 1) * sparse_block - k;
+    if (kj == 0 || alpha == 0.0f) {
+        for (std::size_t i = 0; i < m; ++i)
+            detail::scale(beta, c + i * ldc, n, 1);
+        detail::apply_epilogue(epilogue, c, m, n, ldc);
+        return;
+    }
+    if (n == 1) {
+        // The blocks of the vector, gathered once into the B packing buffer,
+        // against the same blocks of each row of A
+        auto &buffers = detail::PackBuffers::local();
+        float *x = detail::PackBuffers::reserve(buffers.b, buffers.b_size,
+                                                count * sparse_block);
+        for (std::size_t p = 0; p < kj; ++p)
+            x[p] = float(b[detail::inner(k_blocks, p) * ldb]);
+        for (std::size_t i = 0; i < m; ++i) {
+            float &dst = c[i * ldc];
+            float v = alpha * detail::dot_blocks(a + i * lda, k_blocks, count,
+                                                 k, x);
+            dst = beta == 0.0f ? v : v + beta * dst;
+        }
+        detail::apply_epilogue(epilogue, c, m, n, ldc);
+        return;
+    }
+    detail::gemm_blocked(Op::N, Op::N, m, n, kj, k_blocks, alpha, a, lda, b,
+                         ldb, beta, c, ldc, epilogue);
+}
+
+// Largest rank updated by streaming over A; past it the k FMAs per element
+// make the update compute-bound and the register blocking of sgemm wins
+#ifdef NN_AVX2
+constexpr std::size_t max_streaming_rank = 8;
+#else
+constexpr std::size_t max_streaming_rank = 2;
+#endif
+
+// Rank-k update A (m x n) += alpha * X (m x k) * Y (n x k)^T, in place: the
+// SGD weight update, with one sample per column of X (errors) and Y
+// (activations), ldx and ldy their row strides. Up to max_streaming_rank it
+// is one read-modify-write pass over A: Y is transposed once into a k x n
+// panel that stays in cache and each row of A gets its k FMAs per element in
+// registers. Y may be uint8 like the B of sgemm, the scale going into alpha
+template <typename TY>
+inline void rank_update(std::size_t m, std::size_t n, std::size_t k,
+                        float alpha, const float *x, std::size_t ldx,
+                        const TY *y, std::size_t ldy, float *a,
+                        std::size_t lda) {
+    if (k > max_streaming_rank) {
+        sgemm(Op::N, Op::T, m, n, k, alpha, x, ldx, y, ldy, 1.0f, a, lda);
+        return;
+    }
+    if (m == 0 || n == 0 || k == 0 || alpha == 0.0f)
+        return;
+    const float *yt = nullptr;
+    if constexpr (std::is_same_v<TY, float>) {
+        // A rank-1 update of a contiguous y uses it as is
+        if (k == 1 && ldy == 1) {
+            yt = y;
+        }
+    }
+    if (yt == nullptr) {
+        auto &buffers = detail::PackBuffers::local();
+        float *panel =
+            detail::PackBuffers::reserve(buffers.b, buffers.b_size, k * n);
+        for (std::size_t j = 0; j < n; ++j)
+            for (std::size_t p = 0; p < k; ++p)
+                panel[p * n + j] = float(y[j * ldy + p]);
+        yt = panel;
+    }
+    float coef[max_streaming_rank];
+    for (std::size_t i = 0; i < m; ++i) {
+        for (std::size_t p = 0; p < k; ++p)
+            coef[p] = alpha * x[i * ldx + p];
+        detail::update_row(k, coef, yt, n, a + i * lda);
+    }
+}
+
+// Largest rank of a sparse update; past it the update is compute-bound and
+// sgemm over all the columns is faster than skipping the zero ones
+#ifdef NN_AVX2
+constexpr std::size_t max_sparse_rank = 32;
+#else
+constexpr std::size_t max_sparse_rank = max_streaming_rank;
+#endif
+
+// Rank-k update restricted to the columns J of A (m x n) below n in the
+// blocks of sparse_block listed in blocks (count of them, ascending):
+// A(:, J) += alpha * X (m x k) * Y(J, :)^T. For a Y that is zero outside of
+// the rows J, e.g. the inputs of a layer with blank pixels, this is
+// rank_update without the columns it would leave unchanged. Y(J, :) is
+// transposed once into a panel, scaled by alpha, and each row of A is read
+// and written once, with the k FMAs of four blocks at a time in registers.
+// Ranks past max_sparse_rank go to rank_update
+template <typename TY>
+inline void rank_update_sparse(std::size_t m, std::size_t n,
+                               const std::uint32_t *blocks, std::size_t count,
+                               std::size_t k, float alpha, const float *x,
+                               std::size_t ldx, const TY *y, std::size_t ldy,
+                               float *a, std::size_t lda) {
+    if (k > max_sparse_rank) {
+        rank_update(m, n, k, alpha, x, ldx, y, ldy, a, lda);
+        return;
+    }
+    if (m == 0 || count == 0 || k == 0 || alpha == 0.0f)
+        return;
+    auto &buffers = detail::PackBuffers::local();
+    const std::size_t ldyt = count * sparse_block;
+    float *yt =
+        detail::PackBuffers::reserve(buffers.b, buffers.b_size, k * ldyt);
+    for (std::size_t q = 0; q < ldyt; ++q) {
+        std::size_t j = detail::inner(blocks, q);
+        for (std::size_t p = 0; p < k; ++p)
+            yt[p * ldyt + q] = j < n ? alpha * float(y[j * ldy + p]) : 0.0f;
+    }
+    for (std::size_t i = 0; i < m; ++i)
+        detail::update_blocks(k, x + i * ldx, yt, ldyt, blocks, count, n,
+                              a + i * lda);
+}
+
+// Rank-1 update A (m x n) += alpha * x * y^T (BLAS sger), x and y with
+// strides incx and incy
+inline void ger(std::size_t m, std::size_t n, float alpha, const float *x,
+                std::size_t incx, const float *y, std::size_t incy, float *a,
+                std::size_t lda) {
+    rank_update(m, n, 1, alpha, x, incx, y, incy, a, lda);
+}
+
+} // namespace gemm
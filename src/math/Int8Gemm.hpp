@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstddef> // size_t
+#include <cstdint> // int8_t && uint8_t && int32_t
+
+#include "Simd.hpp"
+
+// Integer GEMM for quantized inference: C = A * B^T with A int8 (weights, one
+// row per output), B uint8 (activations, one row per sample) and C int32.
+//
+// Activations must be in [0, 127]: the AVX2 kernel multiplies with
+// _mm256_maddubs_epi16 (u8 x s8 -> pairs summed in s16), and with both
+// operands at most 127 in magnitude the pair sums cannot saturate. Rows are
+// zero-padded to a multiple of k_align elements so the inner loop has no
+// tail.
+namespace int8_gemm {
+
+constexpr std::size_t k_align = 32;
+
+// Row length padded for the kernels
+constexpr std::size_t padded(std::size_t k) {
+    return (k + k_align - 1) / k_align * k_align;
+}
+
+namespace detail {
+
+#ifdef NN_AVX2
+inline std::int32_t hsum(__m256i v) {
+    __m128i h = _mm_add_epi32(_mm256_castsi256_si128(v),
+                              _mm256_extracti128_si256(v, 1));
+    h = _mm_add_epi32(h, _mm_unpackhi_epi64(h, h));
+    h = _mm_add_epi32(h, _mm_shuffle_epi32(h, 1));
+    return _mm_cvtsi128_si32(h);
+}
+
+// 32 products of x and w summed into 8 int32 lanes of acc
+inline __m256i dot32(__m256i acc, __m256i x, const std::int8_t *w) {
+    const __m256i pairs = _mm256_maddubs_epi16(
+        x, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(w)));
+    return _mm256_add_epi32(acc,
+                            _mm256_madd_epi16(pairs, _mm256_set1_epi16(1)));
+}
+#endif
+
+// c[r] = a[r] . x for rows [r0, r1) of a
+inline void gemv_rows(const std::int8_t *a, std::size_t lda,
+                      std::size_t r0, std::size_t r1, const std::uint8_t *x,
+                      std::size_t k, std::int32_t *c) {
+    std::size_t r = r0;
+#ifdef NN_AVX2
+    // 4 rows at a time share each load of x
+    for (; r + 4 <= r1; r += 4) {
+        const std::int8_t *w = a + r * lda;
+        __m256i acc0 = _mm256_setzero_si256();
+        __m256i acc1 = _mm256_setzero_si256();
+        __m256i acc2 = _mm256_setzero_si256();
+        __m256i acc3 = _mm256_setzero_si256();
+        for (std::size_t p = 0; p < k; p += k_align) {
+            const __m256i xv =
+                _mm256_loadu_si256(reinterpret_cast<const __m256i *>(x + p));
+            acc0 = dot32(acc0, xv, w + p);
+            acc1 = dot32(acc1, xv, w + lda + p);
+            acc2 = dot32(acc2, xv, w + 2 * lda + p);
+            acc3 = dot32(acc3, xv, w + 3 * lda + p);
+        }
+        c[r] = hsum(acc0);
+        c[r + 1] = hsum(acc1);
+        c[r + 2] = hsum(acc2);
+        c[r + 3] = hsum(acc3);
+    }
+    for (; r < r1; ++r) {
+        __m256i acc = _mm256_setzero_si256();
+        for (std::size_t p = 0; p < k; p += k_align) {
+            acc = dot32(acc,
+                        _mm256_loadu_si256(
+                            reinterpret_cast<const __m256i *>(x + p)),
+                        a + r * lda + p);
+        }
+        c[r] = hsum(acc);
+    }
+#else
+    for (; r < r1; ++r) {
+        const std::int8_t *w = a + r * lda;
+        std::int32_t acc = 0;
+        for (std::size_t p = 0; p < k; ++p) {
+            acc += std::int32_t(x[p]) * std::int32_t(w[p]);
+        }
+        c[r] = acc;
+    }
+#endif
+}
+
+} // namespace detail
+
+// c[i * ldc + r] = a[r] . b[i] for m rows of a (row stride lda) and n rows
+// of b (row stride ldb), over k = a multiple of k_align elements
+inline void gemm(std::size_t m, std::size_t n, std::size_t k,
+                 const std::int8_t *a, std::size_t lda, const std::uint8_t *b,
+                 std::size_t ldb, std::int32_t *c, std::size_t ldc) {
+    // Blocks of rows of a stay in L1 while every sample streams past them
+    constexpr std::size_t row_block = 16;
+    for (std::size_t r0 = 0; r0 < m; r0 += row_block) {
+        const std::size_t r1 = r0 + row_block < m ? r0 + row_block : m;
+        for (std::size_t i = 0; i < n; ++i) {
+            detail::gemv_rows(a, lda, r0, r1, b + i * ldb, k, c + i * ldc);
+        }
+    }
+}
+
+// c[r] = a[r] . x, the single sample case of gemm
+inline void gemv(std::size_t m, std::size_t k, const std::int8_t *a,
+                 std::size_t lda, const std::uint8_t *x, std::int32_t *c) {
+    detail::gemv_rows(a, lda, 0, m, x, k, c);
+}
+
+} // namespace int8_gemm
@@ -0,0 +1,318 @@
+#pragma once
+
+#include <cmath>   // exp && sqrt
+#include <cstddef> // size_t
+
+#include "Simd.hpp"
+
+// Built-in element-wise kernels.
+//
+// Each kernel is a function object that can be used element by element like
+// any other callable (Matrix2D::map/apply/reduce, expressions), and that also
+// has a block form over a whole buffer. Matrix2D::apply and reduce pick the
+// block form when it exists, which runs the vectorized loop below instead of
+// one call per element. Activations and their derivatives also take a whole
+// AVX register, the form GEMM epilogues apply to tiles (see Gemm.hpp).
+namespace kernels {
+
+namespace detail {
+
+#ifdef NN_AVX2
+// exp(x) for 8 floats: range reduction to x = n * ln2 + r, |r| <= ln2 / 2,
+// then a degree 5 polynomial for exp(r) (Cephes expf, ~1 ulp)
+inline __m256 exp256(__m256 x) {
+    x = _mm256_min_ps(x, _mm256_set1_ps(88.3762626647949f));
+    x = _mm256_max_ps(x, _mm256_set1_ps(-88.3762626647949f));
+
+    __m256 fx = _mm256_fmadd_ps(x, _mm256_set1_ps(1.44269504088896341f),
+                                _mm256_set1_ps(0.5f));
+    fx = _mm256_floor_ps(fx);
+    x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(0.693359375f), x);
+    x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(-2.12194440e-4f), x);
+
+    __m256 y = _mm256_set1_ps(1.9875691500E-4f);
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.3981999507E-3f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(8.3334519073E-3f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(4.1665795894E-2f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.6666665459E-1f));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(5.0000001201E-1f));
+    y = _mm256_fmadd_ps(y, _mm256_mul_ps(x, x), x);
+    y = _mm256_add_ps(y, _mm256_set1_ps(1.0f));
+
+    // 2^n built directly in the exponent bits
+    __m256i n = _mm256_cvttps_epi32(fx);
+    n = _mm256_slli_epi32(_mm256_add_epi32(n, _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(y, _mm256_castsi256_ps(n));
+}
+
+inline __m256 sigmoid256(__m256 x) {
+    __m256 one = _mm256_set1_ps(1.0f);
+    __m256 e = exp256(_mm256_sub_ps(_mm256_setzero_ps(), x));
+    return _mm256_div_ps(one, _mm256_add_ps(one, e));
+}
+
+inline float hsum256(__m256 v) {
+    __m128 h = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+    h = _mm_add_ss(h, _mm_movehdup_ps(h));
+    return _mm_cvtss_f32(h);
+}
+#endif
+
+} // namespace detail
+
+// e^x
+struct Exp {
+    float operator()(float x) const { return std::exp(x); }
+
+    void operator()(const float *in, float *out, std::size_t n) const {
+        std::size_t i = 0;
+#ifdef NN_AVX2
+        for (; i + 8 <= n; i += 8)
+            _mm256_storeu_ps(out + i, detail::exp256(_mm256_loadu_ps(in + i)));
+#endif
+        for (; i < n; ++i)
+            out[i] = std::exp(in[i]);
+    }
+};
+
+// x, for layers without activation
+struct Identity {
+    float operator()(float x) const { return x; }
+#ifdef NN_AVX2
+    __m256 operator()(__m256 x) const { return x; }
+#endif
+
+    void operator()(const float *in, float *out, std::size_t n) const {
+        if (in != out) {
+            for (std::size_t i = 0; i < n; ++i)
+                out[i] = in[i];
+        }
+    }
+};
+
+// 1 / (1 + e^-x)
+struct Sigmoid {
+    float operator()(float x) const { return 1.0f / (1.0f + std::exp(-x)); }
+#ifdef NN_AVX2
+    __m256 operator()(__m256 x) const { return detail::sigmoid256(x); }
+#endif
+
+    void operator()(const float *in, float *out, std::size_t n) const {
+        std::size_t i = 0;
+#ifdef NN_AVX2
+        for (; i + 8 <= n; i += 8)
+            _mm256_storeu_ps(out + i,
+                             detail::sigmoid256(_mm256_loadu_ps(in + i)));
+#endif
+        for (; i < n; ++i)
+            out[i] = (*this)(in[i]);
+    }
+};
+
+// Derivative of the sigmoid, taking the sigmoid output s: s * (1 - s)
+struct SigmoidPrime {
+    float operator()(float s) const { return s * (1.0f - s); }
+#ifdef NN_AVX2
+    __m256 operator()(__m256 s) const {
+        return _mm256_mul_ps(s, _mm256_sub_ps(_mm256_set1_ps(1.0f), s));
+    }
+#endif
+
+    void operator()(const float *in, float *out, std::size_t n) const {
+        std::size_t i = 0;
+#ifdef NN_AVX2
+        __m256 one = _mm256_set1_ps(1.0f);
+        for (; i + 8 <= n; i += 8) {
+            __m256 s = _mm256_loadu_ps(in + i);
+            _mm256_storeu_ps(out + i, _mm256_mul_ps(s, _mm256_sub_ps(one, s)));
+        }
+#endif
+        for (; i < n; ++i)
+            out[i] = (*this)(in[i]);
+    }
+};
+
+// max(x, 0)
+struct Relu {
+    float operator()(float x) const { return x > 0.0f ? x : 0.0f; }
+#ifdef NN_AVX2
+    __m256 operator()(__m256 x) const {
+        return _mm256_max_ps(x, _mm256_setzero_ps());
+    }
+#endif
+
+    void operator()(const float *in, float *out, std::size_t n) const {
+        std::size_t i = 0;
+#ifdef NN_AVX2
+        __m256 zero = _mm256_setzero_ps();
+        for (; i + 8 <= n; i += 8)
+            _mm256_storeu_ps(out + i, _mm256_max_ps(_mm256_loadu_ps(in + i), zero));
+#endif
+        for (; i < n; ++i)
+            out[i] = (*this)(in[i]);
+    }
+};
+
+// Sum of the elements, as a reduction: acc + v
+struct Sum {
+    float operator()(float acc, float v) const { return acc + v; }
+
+    float operator()(float acc, const float *in, std::size_t n) const {
+        std::size_t i = 0;
+#ifdef NN_AVX2
+        __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+        for (; i + 16 <= n; i += 16) {
+            s0 = _mm256_add_ps(s0, _mm256_loadu_ps(in + i));
+            s1 = _mm256_add_ps(s1, _mm256_loadu_ps(in + i + 8));
+        }
+        acc += detail::hsum256(_mm256_add_ps(s0, s1));
+#endif
+        for (; i < n; ++i)
+            acc += in[i];
+        return acc;
+    }
+};
+
+// Sum of squares of the elements, as a reduction: acc + v * v
+struct SumSquares {
+    float operator()(float acc, float v) const { return acc + v * v; }
+
+    float operator()(float acc, const float *in, std::size_t n) const {
+        std::size_t i = 0;
+#ifdef NN_AVX2
+        __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+        for (; i + 16 <= n; i += 16) {
+            __m256 a = _mm256_loadu_ps(in + i);
+            __m256 b = _mm256_loadu_ps(in + i + 8);
+            s0 = _mm256_fmadd_ps(a, a, s0);
+            s1 = _mm256_fmadd_ps(b, b, s1);
+        }
+        acc += detail::hsum256(_mm256_add_ps(s0, s1));
+#endif
+        for (; i < n; ++i)
+            acc += in[i] * in[i];
+        return acc;
+    }
+};
+
+// Output layer step of backpropagation with a sigmoid output, in one pass:
+// errors = targets - outputs, deltas = errors * sigmoid'(outputs). Returns
+// the summed squared error
+inline float sigmoid_output_deltas(const float *targets, const float *outputs,
+                                   float *errors, float *deltas,
+                                   std::size_t n) {
+    std::size_t i = 0;
+    float cost = 0.0f;
+#ifdef NN_AVX2
+    __m256 one = _mm256_set1_ps(1.0f);
+    __m256 sum = _mm256_setzero_ps();
+    for (; i + 8 <= n; i += 8) {
+        __m256 y = _mm256_loadu_ps(outputs + i);
+        __m256 e = _mm256_sub_ps(_mm256_loadu_ps(targets + i), y);
+        _mm256_storeu_ps(errors + i, e);
+        _mm256_storeu_ps(deltas + i,
+                         _mm256_mul_ps(e, _mm256_mul_ps(y, _mm256_sub_ps(one, y))));
+        sum = _mm256_fmadd_ps(e, e, sum);
+    }
+    cost = detail::hsum256(sum);
+#endif
+    for (; i < n; ++i) {
+        float e = targets[i] - outputs[i];
+        errors[i] = e;
+        deltas[i] = e * (outputs[i] * (1.0f - outputs[i]));
+        cost += e * e;
+    }
+    return cost;
+}
+
+// Optimizer updates. Each reads the summed gradients g of a batch, scaled by
+// scale (1 / batch size), and the optimizer state, and writes the state and
+// the weights w in the same pass. g is the descent direction (targets -
+// outputs backpropagated), so it is added to the weights
+
+// w += lr * scale * g
+inline void sgd_update(float *w, const float *g, std::size_t n, float scale,
+                       float lr) {
+    const float step = lr * scale;
+    std::size_t i = 0;
+#ifdef NN_AVX2
+    __m256 s = _mm256_set1_ps(step);
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(w + i, _mm256_fmadd_ps(s, _mm256_loadu_ps(g + i),
+                                                _mm256_loadu_ps(w + i)));
+    }
+#endif
+    for (; i < n; ++i)
+        w[i] += step * g[i];
+}
+
+// v = momentum * v + scale * g, then w += lr * v, or with nesterov
+// w += lr * (scale * g + momentum * v), the step taken from the point the
+// velocity leads to
+inline void momentum_update(float *w, float *v, const float *g, std::size_t n,
+                            float scale, float lr, float momentum,
+                            bool nesterov) {
+    std::size_t i = 0;
+#ifdef NN_AVX2
+    __m256 s = _mm256_set1_ps(scale), l = _mm256_set1_ps(lr);
+    __m256 mu = _mm256_set1_ps(momentum);
+    for (; i + 8 <= n; i += 8) {
+        __m256 d = _mm256_mul_ps(s, _mm256_loadu_ps(g + i));
+        __m256 vi = _mm256_fmadd_ps(mu, _mm256_loadu_ps(v + i), d);
+        _mm256_storeu_ps(v + i, vi);
+        __m256 step = nesterov ? _mm256_fmadd_ps(mu, vi, d) : vi;
+        _mm256_storeu_ps(w + i,
+                         _mm256_fmadd_ps(l, step, _mm256_loadu_ps(w + i)));
+    }
+#endif
+    for (; i < n; ++i) {
+        float d = scale * g[i];
+        v[i] = momentum * v[i] + d;
+        w[i] += lr * (nesterov ? d + momentum * v[i] : v[i]);
+    }
+}
+
+// Adam at step t: m = beta1 * m + (1 - beta1) * scale * g, v likewise with
+// beta2 and the squares, then w += lr_t * m / (sqrt(v) * root_t + epsilon).
+// lr_t = lr / (1 - beta1^t) and root_t = 1 / sqrt(1 - beta2^t) correct the
+// bias of the moments towards their zero start
+inline void adam_update(float *w, float *m, float *v, const float *g,
+                        std::size_t n, float scale, float lr_t, float root_t,
+                        float beta1, float beta2, float epsilon) {
+    std::size_t i = 0;
+#ifdef NN_AVX2
+    __m256 s = _mm256_set1_ps(scale), l = _mm256_set1_ps(lr_t);
+    __m256 r = _mm256_set1_ps(root_t), eps = _mm256_set1_ps(epsilon);
+    __m256 b1 = _mm256_set1_ps(beta1), c1 = _mm256_set1_ps(1.0f - beta1);
+    __m256 b2 = _mm256_set1_ps(beta2), c2 = _mm256_set1_ps(1.0f - beta2);
+    for (; i + 8 <= n; i += 8) {
+        __m256 d = _mm256_mul_ps(s, _mm256_loadu_ps(g + i));
+        __m256 mi = _mm256_fmadd_ps(b1, _mm256_loadu_ps(m + i),
+                                    _mm256_mul_ps(c1, d));
+        __m256 vi = _mm256_fmadd_ps(b2, _mm256_loadu_ps(v + i),
+                                    _mm256_mul_ps(c2, _mm256_mul_ps(d, d)));
+        _mm256_storeu_ps(m + i, mi);
+        _mm256_storeu_ps(v + i, vi);
+        __m256 denominator = _mm256_fmadd_ps(_mm256_sqrt_ps(vi), r, eps);
+        _mm256_storeu_ps(w + i, _mm256_fmadd_ps(l, _mm256_div_ps(mi, denominator),
+                                                _mm256_loadu_ps(w + i)));
+    }
+#endif
+    for (; i < n; ++i) {
+        float d = scale * g[i];
+        m[i] = beta1 * m[i] + (1.0f - beta1) * d;
+        v[i] = beta2 * v[i] + (1.0f - beta2) * (d * d);
+        w[i] += lr_t * (m[i] / (std::sqrt(v[i]) * root_t + epsilon));
+    }
+}
+
+inline constexpr Identity identity{};
+inline constexpr Exp exp{};
+inline constexpr Sigmoid sigmoid{};
+inline constexpr SigmoidPrime sigmoid_prime{};
+inline constexpr Relu relu{};
+inline constexpr Sum sum{};
+inline constexpr SumSquares sum_squares{};
+
+} // namespace kernels
@@ -0,0 +1,270 @@
+#pragma once
+
+#include <algorithm>   // copy_n && fill_n
+#include <cstddef>     // size_t
+#include <memory>      // unique_ptr
+#include <stdexcept>   // invalid_argument
+#include <string>      // to_string
+#include <type_traits> // is_invocable
+#include <utility>     // index_sequence
+
+#include "Expression.hpp"
+#include "Gemm.hpp"
+#include "Simd.hpp"
+
+// Matrix with compile-time dimensions: R x C, row-major, like a Matrix2D
+// constructed as Matrix2D(R, C).
+//
+// The shape is part of the type, so products between incompatible matrices
+// do not compile, and the fixed-size kernels below unroll their loops at
+// compile time. The elements live in a single 64-byte aligned heap block
+// (weights of real layers are far too large for the stack).
+//
+// It is an expression leaf like Matrix2D: it can be mixed in element-wise
+// expressions, converted to a Matrix2D (Matrix2D m = fixed;) and built from
+// a Matrix2D or expression of the same shape (checked at runtime).
+template <std::size_t R, std::size_t C>
+class Matrix : public MatrixExpr<Matrix<R, C>> {
+    static_assert(R > 0 && C > 0, "Matrix dimensions must be positive");
+
+    struct alignas(64) Storage {
+        float data[R * C];
+    };
+    std::unique_ptr<Storage> m;
+
+  public:
+    static constexpr bool is_leaf = true;
+    static constexpr std::size_t elements = R * C;
+
+    // Zero-filled matrix
+    Matrix() : m(std::make_unique<Storage>()) {}
+
+    // copy constructor
+    Matrix(const Matrix &other) : m(std::make_unique_for_overwrite<Storage>()) {
+        std::copy_n(other.data(), elements, data());
+    }
+
+    // move constructor, the source is left empty
+    Matrix(Matrix &&other) noexcept = default;
+
+    // Evaluates a Matrix2D or element-wise expression of the same shape
+    template <typename E>
+    explicit Matrix(const MatrixExpr<E> &expr)
+        : m(std::make_unique_for_overwrite<Storage>()) {
+        *this = expr;
+    }
+
+    // copy assignment
+    Matrix &operator=(const Matrix &other) {
+        if (this != &other) {
+            std::copy_n(other.data(), elements, data());
+        }
+        return *this;
+    }
+
+    // move assignment
+    Matrix &operator=(Matrix &&other) noexcept = default;
+
+    // Evaluates a Matrix2D or element-wise expression of the same shape, in
+    // place (safe when this matrix is an operand)
+    template <typename E> Matrix &operator=(const MatrixExpr<E> &expr) {
+        const E &e = expr.derived();
+        if (e.getCols() != R || e.getRows() != C) {
+            throw std::invalid_argument(
+                "Matrix<" + std::to_string(R) + ", " + std::to_string(C) +
+                "> assigned from a " + std::to_string(e.getCols()) + "x" +
+                std::to_string(e.getRows()) + " matrix");
+        }
+        float *dst = data();
+        for (std::size_t i = 0; i < elements; ++i) {
+            dst[i] = e.eval(i);
+        }
+        return *this;
+    }
+
+    // Shape, named like Matrix2D (first dimension, second dimension)
+    static constexpr std::size_t getCols() { return R; }
+    static constexpr std::size_t getRows() { return C; }
+
+    float *data() { return m->data; }
+    const float *data() const { return m->data; }
+
+    float &operator[](std::size_t i) { return m->data[i]; }
+    const float &operator[](std::size_t i) const { return m->data[i]; }
+
+    float &operator()(std::size_t r, std::size_t c) { return m->data[r * C + c]; }
+    const float &operator()(std::size_t r, std::size_t c) const {
+        return m->data[r * C + c];
+    }
+
+    // Element i of the matrix as an expression leaf
+    float eval(std::size_t i) const { return m->data[i]; }
+
+    void fill(float value) { std::fill_n(data(), elements, value); }
+
+    // Apply a function to each element, using the block form of kernels
+    // (see Kernels.hpp) when available
+    template <typename F> Matrix &apply(F &&f) {
+        if constexpr (std::is_invocable_v<F &, const float *, float *,
+                                          std::size_t>) {
+            f(data(), data(), elements);
+        } else {
+            for (std::size_t i = 0; i < elements; ++i) {
+                m->data[i] = f(m->data[i]);
+            }
+        }
+        return *this;
+    }
+
+    // Reduce the matrix to a single value
+    template <typename T, typename F> T reduce(T start, F &&f) const {
+        if constexpr (std::is_invocable_r_v<T, F &, T, const float *,
+                                            std::size_t>) {
+            return f(start, data(), elements);
+        } else {
+            T result = start;
+            for (std::size_t i = 0; i < elements; ++i) {
+                result = f(result, m->data[i]);
+            }
+            return result;
+        }
+    }
+
+    template <typename E> Matrix &operator+=(const MatrixExpr<E> &other) {
+        const E &e = other.derived();
+        for (std::size_t i = 0; i < elements; ++i) {
+            m->data[i] += e.eval(i);
+        }
+        return *this;
+    }
+
+    template <typename E> Matrix &operator-=(const MatrixExpr<E> &other) {
+        const E &e = other.derived();
+        for (std::size_t i = 0; i < elements; ++i) {
+            m->data[i] -= e.eval(i);
+        }
+        return *this;
+    }
+
+    std::size_t argmax() const {
+        std::size_t best = 0;
+        for (std::size_t i = 1; i < elements; ++i) {
+            if (m->data[i] > m->data[best]) {
+                best = i;
+            }
+        }
+        return best;
+    }
+};
+
+namespace fixed {
+
+// Fully unrolled kernels over N contiguous floats, N known at compile time
+namespace detail {
+
+// Number of full SIMD vectors in N floats, the rest is done in scalar code
+#ifdef NN_AVX2
+template <std::size_t N> constexpr std::size_t vectors = N / 8;
+#else
+template <std::size_t N> constexpr std::size_t vectors = 0;
+#endif
+
+// x . y
+template <std::size_t N> inline float dot(const float *x, const float *y) {
+    constexpr std::size_t V = vectors<N>;
+    float sum = 0.0f;
+#ifdef NN_AVX2
+    if constexpr (V > 0) {
+        __m256 acc[4] = {_mm256_setzero_ps(), _mm256_setzero_ps(),
+                         _mm256_setzero_ps(), _mm256_setzero_ps()};
+        [&]<std::size_t... I>(std::index_sequence<I...>) {
+            ((acc[I % 4] = _mm256_fmadd_ps(_mm256_loadu_ps(x + 8 * I),
+                                           _mm256_loadu_ps(y + 8 * I),
+                                           acc[I % 4])),
+             ...);
+        }(std::make_index_sequence<V>{});
+        __m256 s = _mm256_add_ps(_mm256_add_ps(acc[0], acc[1]),
+                                 _mm256_add_ps(acc[2], acc[3]));
+        __m128 h = _mm_add_ps(_mm256_castps256_ps128(s),
+                              _mm256_extractf128_ps(s, 1));
+        h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+        h = _mm_add_ss(h, _mm_movehdup_ps(h));
+        sum = _mm_cvtss_f32(h);
+    }
+#endif
+    [&]<std::size_t... I>(std::index_sequence<I...>) {
+        ((sum += x[V * 8 + I] * y[V * 8 + I]), ...);
+    }(std::make_index_sequence<N - V * 8>{});
+    return sum;
+}
+
+// y += a * x
+template <std::size_t N> inline void axpy(float a, const float *x, float *y) {
+    constexpr std::size_t V = vectors<N>;
+#ifdef NN_AVX2
+    if constexpr (V > 0) {
+        __m256 va = _mm256_set1_ps(a);
+        [&]<std::size_t... I>(std::index_sequence<I...>) {
+            (_mm256_storeu_ps(y + 8 * I,
+                              _mm256_fmadd_ps(va, _mm256_loadu_ps(x + 8 * I),
+                                              _mm256_loadu_ps(y + 8 * I))),
+             ...);
+        }(std::make_index_sequence<V>{});
+    }
+#endif
+    [&]<std::size_t... I>(std::index_sequence<I...>) {
+        ((y[V * 8 + I] += a * x[V * 8 + I]), ...);
+    }(std::make_index_sequence<N - V * 8>{});
+}
+
+} // namespace detail
+
+// y = a * x
+template <std::size_t R, std::size_t C>
+void dot(const Matrix<R, C> &a, const Matrix<C, 1> &x, Matrix<R, 1> &y) {
+    for (std::size_t r = 0; r < R; ++r) {
+        y[r] = detail::dot<C>(a.data() + r * C, x.data());
+    }
+}
+
+// y = a * x + bias, the bias added as each row is reduced
+template <std::size_t R, std::size_t C>
+void dot(const Matrix<R, C> &a, const Matrix<C, 1> &x,
+         const Matrix<R, 1> &bias, Matrix<R, 1> &y) {
+    for (std::size_t r = 0; r < R; ++r) {
+        y[r] = detail::dot<C>(a.data() + r * C, x.data()) + bias[r];
+    }
+}
+
+// y = a^T * x
+template <std::size_t R, std::size_t C>
+void dot_tn(const Matrix<R, C> &a, const Matrix<R, 1> &x, Matrix<C, 1> &y) {
+    y.fill(0.0f);
+    for (std::size_t r = 0; r < R; ++r) {
+        detail::axpy<C>(x[r], a.data() + r * C, y.data());
+    }
+}
+
+// a += alpha * x * y^T
+template <std::size_t R, std::size_t C>
+void add_outer(Matrix<R, C> &a, float alpha, const Matrix<R, 1> &x,
+               const Matrix<C, 1> &y) {
+    for (std::size_t r = 0; r < R; ++r) {
+        detail::axpy<C>(alpha * x[r], y.data(), a.data() + r * C);
+    }
+}
+
+} // namespace fixed
+
+// Dot product; inner dimensions are checked at compile time
+template <std::size_t R, std::size_t C, std::size_t K>
+Matrix<R, K> operator*(const Matrix<R, C> &a, const Matrix<C, K> &b) {
+    Matrix<R, K> result;
+    if constexpr (K == 1) {
+        fixed::dot(a, b, result);
+    } else {
+        gemm::sgemm(gemm::Op::N, gemm::Op::N, R, K, C, 1.0f, a.data(), C,
+                    b.data(), K, 0.0f, result.data(), K);
+    }
+    return result;
+}
@@ -1,42 +1,112 @@
 #pragma once
 
+#include <algorithm>  // any_of && copy_n && fill_n
 #include <cassert>    // assert
 #include <chrono>     // high_resolution_clock
 #include <cmath>      // sqrt
 #include <cstddef>    // size_t
-#include <functional> // function && bind
+#include <cstdint>    // uint8_t
+#include <functional> // bind
 #include <new>        // placement new && bad_alloc
 #include <random>     // uniform_real_distribution && default_random_engine
 #include <ranges>     // ranges::copy && ranges::transform
+#include <span>       // span
 #include <sstream>    // stringstream
 #include <string>     // string
+#include <type_traits> // is_invocable
 #include <utility>    // move && as_const
 #include <vector>     // vector
 
+#include "../utils/MemoryPool.hpp"
 #include "../utils/Serialization.hpp"
-
-class Matrix2D {
-    std::vector<float> m;
+#include "Expression.hpp"
+#include "Gemm.hpp"
+#include "MatrixStorage.hpp"
+
+// Read-only matrix stored as bytes, element = byte / scale, e.g. a batch of
+// uint8 pixels. Same layout as Matrix2D(cols, rows)
+struct ByteMatrix {
+    const std::uint8_t *data;
     std::size_t cols;
     std::size_t rows;
+    float scale;
+
+    std::size_t getCols() const { return cols; }
+    std::size_t getRows() const { return rows; }
+};
+
+// Pool-backed byte storage, for data kept quantized (see ByteMatrix)
+using ByteStorage = std::vector<std::uint8_t, PoolAllocator<std::uint8_t>>;
+
+// A Matrix2D or ByteMatrix that is zero outside of the listed blocks of
+// gemm::sparse_block cols (ascending), e.g. a batch of images, one per row,
+// where only the pixels inked in some image are nonzero. Products with it
+// skip the other cols, see Matrix2D::assign_dot and Matrix2D::add_outer, and
+// find_active_blocks lists the blocks
+template <typename Dense> struct SparseInput {
+    const Dense &values;
+    std::span<const std::uint32_t> blocks;
+
+    std::size_t getCols() const { return values.getCols(); }
+    std::size_t getRows() const { return values.getRows(); }
+};
+
+// Replaces blocks with the blocks of gemm::sparse_block cols of m (cols x
+// rows, stored as floats or bytes) that hold a nonzero value, ascending
+template <typename T>
+void find_active_blocks(const T *m, std::size_t cols, std::size_t rows,
+                        std::vector<std::uint32_t> &blocks) {
+    blocks.clear();
+    for (std::size_t c = 0; c < cols; c += gemm::sparse_block) {
+        const T *first = m + c * rows;
+        const T *last = m + std::min(cols, c + gemm::sparse_block) * rows;
+        if (std::any_of(first, last, [](T v) { return v != T(0); })) {
+            blocks.push_back(std::uint32_t(c / gemm::sparse_block));
+        }
+    }
+}
+
+class Matrix2D : public MatrixExpr<Matrix2D> {
+    MatrixStorage m;
+    std::size_t cols = 0;
+    std::size_t rows = 0;
 
   public:
+    static constexpr bool is_leaf = true;
+
+    // Tag for constructing a matrix whose elements are about to be overwritten
+    struct Uninitialized {};
+    static constexpr Uninitialized uninitialized{};
+
     // Constructors
     Matrix2D() = default;
 
+    // Zero-filled matrix
     Matrix2D(std::size_t cols, std::size_t rows) {
+        this->cols = cols;
+        this->rows = rows;
+        m.resize(rows * cols, 0.0f);
+    }
+
+    // Matrix with unspecified contents, for callers that write every element
+    Matrix2D(std::size_t cols, std::size_t rows, Uninitialized) {
         this->cols = cols;
         this->rows = rows;
         m.resize(rows * cols);
     }
 
+    // Matrix over existing storage of cols * rows elements, e.g. storage
+    // borrowed from a memory-mapped file
+    Matrix2D(std::size_t cols, std::size_t rows, MatrixStorage storage)
+        : m(std::move(storage)), cols(cols), rows(rows) {
+        assert(m.size() == cols * rows);
+    }
+
     // copy constructor
-    Matrix2D(const Matrix2D &other) {
+    Matrix2D(const Matrix2D &other) : m(other.m.size()) {
         this->cols = other.cols;
         this->rows = other.rows;
-        m.resize(other.m.size());
-        for (std::size_t i = 0; i < m.size(); i++)
-            m[i] = other.m[i];
+        std::copy_n(other.m.data(), m.size(), m.data());
     }
 
     // move constructor
@@ -46,6 +116,14 @@ class Matrix2D {
         m = std::move(other.m);
     }
 
+    // Evaluates an element-wise expression into a new matrix
+    template <typename E> Matrix2D(const MatrixExpr<E> &expr) {
+        this->cols = expr.derived().getCols();
+        this->rows = expr.derived().getRows();
+        m.resize(rows * cols);
+        assign(expr.derived());
+    }
+
     // Constructs from a stream
     Matrix2D(std::istream &is) { is >> *this; }
 
@@ -63,9 +141,7 @@ class Matrix2D {
         if (this != &other) {
             this->cols = other.cols;
             this->rows = other.rows;
-            m.resize(other.m.size());
-            for (std::size_t i = 0; i < m.size(); i++)
-                m[i] = other.m[i];
+            m = other.m;
         }
         return *this;
     }
@@ -80,6 +156,16 @@ class Matrix2D {
         return *this;
     }
 
+    // Evaluates an element-wise expression into this matrix, in place. This
+    // is safe even if this matrix is an operand: then the shapes already
+    // match, and each element only reads the same element of the operands
+    template <typename E> Matrix2D &operator=(const MatrixExpr<E> &expr) {
+        const E &e = expr.derived();
+        resize(e.getCols(), e.getRows());
+        assign(e);
+        return *this;
+    }
+
     // index operator
     float &operator()(std::size_t row, std::size_t col) {
         assert(col < cols && row < rows);
@@ -99,7 +185,10 @@ class Matrix2D {
     std::size_t getRows() const { return rows; }
 
     // getter
-    std::vector<float> &getData() { return m; }
+    MatrixStorage &getData() { return m; }
+
+    // getter
+    const MatrixStorage &getData() const { return m; }
 
     // getter
     float &operator[](std::size_t i) {
@@ -107,14 +196,17 @@ class Matrix2D {
         return m[i];
     }
 
-    // Add Scalar
-    Matrix2D operator+(float scalar) const {
-        Matrix2D result(cols, rows);
-        for (std::size_t i = 0; i < m.size(); i++)
-            result.m[i] = m[i] + scalar;
-        return result;
+    // Changes the shape, keeping the storage when it is large enough.
+    // Contents are unspecified afterwards
+    void resize(std::size_t cols, std::size_t rows) {
+        this->cols = cols;
+        this->rows = rows;
+        m.resize(cols * rows);
     }
 
+    // Element i of the matrix as an expression leaf
+    float eval(std::size_t i) const { return m[i]; }
+
     // Add scalar into this
     Matrix2D &operator+=(float scalar) {
         for (std::size_t i = 0; i < cols * rows; ++i) {
@@ -123,20 +215,6 @@ class Matrix2D {
         return *this;
     }
 
-    // Scalar addition
-    friend Matrix2D operator+(float scalar, const Matrix2D &m) {
-        return m + scalar;
-    }
-
-    // Subtract Scalar
-    Matrix2D operator-(float scalar) const {
-        Matrix2D result(cols, rows);
-        for (std::size_t i = 0; i < cols * rows; ++i) {
-            result.m[i] = m[i] - scalar;
-        }
-        return result;
-    }
-
     // Subtract scalar into this
     Matrix2D &operator-=(float scalar) {
         for (std::size_t i = 0; i < cols * rows; ++i) {
@@ -145,20 +223,6 @@ class Matrix2D {
         return *this;
     }
 
-    // Scalar subtraction
-    friend Matrix2D operator-(float scalar, const Matrix2D &m) {
-        return (m * -1.0f) += scalar;
-    }
-
-    // Multiply Scalar
-    Matrix2D operator*(float scalar) const {
-        Matrix2D result(cols, rows);
-        for (std::size_t i = 0; i < cols * rows; ++i) {
-            result.m[i] = m[i] * scalar;
-        }
-        return result;
-    }
-
     // Multiply scalar into this
     Matrix2D &operator*=(float scalar) {
         for (std::size_t i = 0; i < cols * rows; ++i) {
@@ -167,20 +231,6 @@ class Matrix2D {
         return *this;
     }
 
-    // Scalar multiplication
-    friend Matrix2D operator*(float scalar, const Matrix2D &m) {
-        return m * scalar;
-    }
-
-    // Divide Scalar
-    Matrix2D operator/(float scalar) const {
-        Matrix2D result(cols, rows);
-        for (std::size_t i = 0; i < cols * rows; ++i) {
-            result.m[i] = m[i] / scalar;
-        }
-        return result;
-    }
-
     // Divide scalar into this
     Matrix2D &operator/=(float scalar) {
         for (std::size_t i = 0; i < cols * rows; ++i) {
@@ -189,120 +239,174 @@ class Matrix2D {
         return *this;
     }
 
-    // Scalar division
-    friend Matrix2D operator/(float scalar, const Matrix2D &m) {
-        return (m * (1.0f / scalar));
-    }
-
-    // Add Matrix
-    Matrix2D operator+(const Matrix2D &other) const {
-        assert(cols == other.cols && rows == other.rows);
-        Matrix2D result(cols, rows);
+    // Add matrix (or element-wise expression) into this
+    template <typename E> Matrix2D &operator+=(const MatrixExpr<E> &other) {
+        const E &e = other.derived();
+        assert(cols == e.getCols() && rows == e.getRows());
         for (std::size_t i = 0; i < cols * rows; ++i) {
-            result.m[i] = m[i] + other.m[i];
+            m[i] += e.eval(i);
         }
-        return result;
+        return *this;
     }
 
-    // Add matrix into this
-    Matrix2D &operator+=(const Matrix2D &other) {
-        assert(cols == other.cols && rows == other.rows);
+    // Subtract matrix (or element-wise expression) into this
+    template <typename E> Matrix2D &operator-=(const MatrixExpr<E> &other) {
+        const E &e = other.derived();
+        assert(cols == e.getCols() && rows == e.getRows());
         for (std::size_t i = 0; i < cols * rows; ++i) {
-            m[i] += other.m[i];
+            m[i] -= e.eval(i);
         }
         return *this;
     }
 
-    // Subtract Matrix
-    Matrix2D operator-(const Matrix2D &other) const {
-        assert(cols == other.cols && rows == other.rows);
-        Matrix2D result(cols, rows);
-        for (std::size_t i = 0; i < cols * rows; ++i) {
-            result.m[i] = m[i] - other.m[i];
-        }
-        return result;
+    // Dot product written into this matrix:
+    // this = alpha * op(a) * op(b) + beta * this
+    // The storage of this matrix is reused, so once it has the right size no
+    // allocation happens. With beta == 0 the matrix is resized as needed.
+    Matrix2D &assign_dot(const Matrix2D &a, const Matrix2D &b,
+                         gemm::Op ta = gemm::Op::N, gemm::Op tb = gemm::Op::N,
+                         float alpha = 1.0f, float beta = 0.0f) {
+        assert(this != &a && this != &b);
+        return gemm_into(a, b.m.data(), b.cols, b.rows, ta, tb, alpha, beta);
+    }
+
+    // Same with a byte matrix as right operand: the bytes are converted
+    // while GEMM packs them and the 1 / scale is folded into alpha, so b is
+    // never expanded to floats
+    Matrix2D &assign_dot(const Matrix2D &a, const ByteMatrix &b,
+                         gemm::Op ta = gemm::Op::N, gemm::Op tb = gemm::Op::N,
+                         float alpha = 1.0f, float beta = 0.0f) {
+        assert(this != &a);
+        return gemm_into(a, b.data, b.cols, b.rows, ta, tb, alpha / b.scale,
+                         beta);
+    }
+
+    // Dot product with a GEMM epilogue (see Gemm.hpp) applied to each tile
+    // before it is stored: this = epilogue(op(a) * op(b)), e.g. a dense layer
+    // with its bias and activation in a single pass over this matrix
+    template <typename Epilogue>
+    Matrix2D &assign_dot(const Matrix2D &a, const Matrix2D &b,
+                         const Epilogue &epilogue, gemm::Op ta = gemm::Op::N,
+                         gemm::Op tb = gemm::Op::N) {
+        assert(this != &a && this != &b);
+        return gemm_into(a, b.m.data(), b.cols, b.rows, ta, tb, 1.0f, 0.0f,
+                         epilogue);
+    }
+    template <typename Epilogue>
+    Matrix2D &assign_dot(const Matrix2D &a, const ByteMatrix &b,
+                         const Epilogue &epilogue, gemm::Op ta = gemm::Op::N,
+                         gemm::Op tb = gemm::Op::N) {
+        assert(this != &a);
+        return gemm_into(a, b.data, b.cols, b.rows, ta, tb, 1.0f / b.scale,
+                         0.0f, epilogue);
+    }
+
+    // Rank-k update in place, this += alpha * x * y^T with x (cols x k) and
+    // y (rows x k): the SGD weight update with one sample per column, a
+    // single streaming pass over this matrix for small k (see
+    // gemm::rank_update)
+    Matrix2D &add_outer(float alpha, const Matrix2D &x, const Matrix2D &y) {
+        assert(this != &x && this != &y);
+        return rank_update_into(alpha, x, y.m.data(), y.cols, y.rows);
+    }
+    // Same with a byte matrix y, its 1 / scale folded into alpha
+    Matrix2D &add_outer(float alpha, const Matrix2D &x, const ByteMatrix &y) {
+        assert(this != &x);
+        return rank_update_into(alpha / y.scale, x, y.data, y.cols, y.rows);
+    }
+    // Same with a sparse y: only the rows of this matrix matching its active
+    // cols change, the others would get zero
+    template <typename Dense>
+    Matrix2D &add_outer(float alpha, const Matrix2D &x,
+                        const SparseInput<Dense> &y) {
+        assert(this != &x && cols == x.cols && rows == y.getCols() &&
+               x.rows == y.getRows());
+        auto [data, scale] = operand(y.values);
+        gemm::rank_update_sparse(cols, rows, y.blocks.data(), y.blocks.size(),
+                                 x.rows, alpha / scale, x.m.data(), x.rows,
+                                 data, y.getRows(), m.data(), rows);
+        return *this;
     }
 
-    // Subtract matrix into this
-    Matrix2D &operator-=(const Matrix2D &other) {
-        assert(cols == other.cols && rows == other.rows);
-        for (std::size_t i = 0; i < cols * rows; ++i) {
-            m[i] -= other.m[i];
-        }
+    // Same with a sparse right operand: only the rows of a matching its
+    // active cols are read
+    template <typename Dense, typename Epilogue>
+    Matrix2D &assign_dot(const Matrix2D &a, const SparseInput<Dense> &b,
+                         const Epilogue &epilogue) {
+        assert(this != &a && a.rows == b.getCols());
+        resize(a.cols, b.getRows());
+        auto [data, scale] = operand(b.values);
+        gemm::sgemm_sparse_k(cols, rows, a.rows, b.blocks.data(),
+                             b.blocks.size(), 1.0f / scale, a.m.data(), a.rows,
+                             data, rows, 0.0f, m.data(), rows, epilogue);
         return *this;
     }
 
     // Dot product the matrix with another matrix
     Matrix2D operator*(const Matrix2D &other) const {
         assert(rows == other.cols);
-        Matrix2D result(cols, other.rows);
-        for (std::size_t i = 0; i < cols; ++i) {
-            for (std::size_t j = 0; j < other.rows; ++j) {
-                float sum = 0.0f;
-                for (std::size_t k = 0; k < rows; ++k) {
-                    sum += m[i * rows + k] * other.m[k * other.rows + j];
-                }
-                result.m[i * other.rows + j] = sum;
-            }
-        }
+        Matrix2D result;
+        result.assign_dot(*this, other);
         return result;
     }
 
     // Dot product the matrix into this
     Matrix2D &operator*=(const Matrix2D &other) {
         assert(rows == other.cols);
-        for (std::size_t i = 0; i < cols; ++i) {
-            for (std::size_t j = 0; j < other.rows; ++j) {
-                float sum = 0.0f;
-                for (std::size_t k = 0; k < rows; ++k) {
-                    sum += m[i * rows + k] * other.m[k * other.rows + j];
-                }
-                m[i * other.rows + j] = sum;
-            }
-        }
+        *this = *this * other;
         return *this;
     }
 
-    // Multiply Matrix
-    Matrix2D multiply(const Matrix2D &other) const {
-        assert(cols == other.cols && rows == other.rows);
-        Matrix2D result(cols, rows);
-        for (std::size_t i = 0; i < cols * rows; ++i) {
-            result.m[i] = m[i] * other.m[i];
-        }
+    // Dot product of the transpose of this matrix with another matrix
+    // (this^T * other) without materializing the transpose
+    Matrix2D matmul_tn(const Matrix2D &other) const {
+        assert(cols == other.cols);
+        Matrix2D result;
+        result.assign_dot(*this, other, gemm::Op::T, gemm::Op::N);
         return result;
     }
 
-    // Apply a function to each element of the new temporary matrix
-    Matrix2D map(std::function<float(float)> f) const {
-        Matrix2D result(cols, rows);
-        for (std::size_t i = 0; i < cols * rows; ++i) {
-            result.m[i] = f(m[i]);
-        }
+    // Dot product of this matrix with the transpose of another matrix
+    // (this * other^T) without materializing the transpose
+    Matrix2D matmul_nt(const Matrix2D &other) const {
+        assert(rows == other.rows);
+        Matrix2D result;
+        result.assign_dot(*this, other, gemm::Op::N, gemm::Op::T);
         return result;
     }
 
-    // Apply a function to each element of this matrix
-    Matrix2D &apply(std::function<float(float)> f) {
-        for (std::size_t i = 0; i < cols * rows; ++i) {
-            m[i] = f(m[i]);
+    // Apply a function to each element of this matrix. Kernels with a block
+    // form f(in, out, n) (see Kernels.hpp) process the whole buffer at once
+    template <typename F> Matrix2D &apply(F &&f) {
+        if constexpr (std::is_invocable_v<F &, const float *, float *,
+                                          std::size_t>) {
+            f(m.data(), m.data(), m.size());
+        } else {
+            for (std::size_t i = 0; i < cols * rows; ++i) {
+                m[i] = f(m[i]);
+            }
         }
         return *this;
     }
 
-    // Reduce the matrix to a single value
-    template <typename T>
-    T reduce(T start, std::function<T(T, float)> f) const {
-        T result = start;
-        for (const float &e : m) {
-            result = f(result, e);
+    // Reduce the matrix to a single value. Kernels with a block form
+    // f(start, data, n) (see Kernels.hpp) process the whole buffer at once
+    template <typename T, typename F> T reduce(T start, F &&f) const {
+        if constexpr (std::is_invocable_r_v<T, F &, T, const float *,
+                                            std::size_t>) {
+            return f(start, m.data(), m.size());
+        } else {
+            T result = start;
+            for (const float &e : m) {
+                result = f(result, e);
+            }
+            return result;
         }
-        return result;
     }
 
     // Transpose the matrix
     Matrix2D transpose() const {
-        Matrix2D result(rows, cols);
+        Matrix2D result(rows, cols, uninitialized);
         for (std::size_t i = 0; i < cols; ++i) {
             for (std::size_t j = 0; j < rows; ++j) {
                 result.m[j * result.rows + i] = m[i * rows + j];
@@ -324,7 +428,7 @@ class Matrix2D {
     // Return the cofactor of the matrix at the given row and column
     float cofactor(std::size_t row, std::size_t col) const {
         assert(cols == rows);
-        Matrix2D minor(cols - 1, rows - 1);
+        Matrix2D minor(cols - 1, rows - 1, uninitialized);
         std::size_t minorRow = 0;
         std::size_t minorCol = 0;
         for (std::size_t i = 0; i < cols; ++i) {
@@ -362,11 +466,7 @@ class Matrix2D {
     }
 
     // Fill the matrix with a value
-    void fill(float value) {
-        for (std::size_t i = 0; i < cols * rows; ++i) {
-            m[i] = value;
-        }
-    }
+    void fill(float value) { std::fill_n(m.data(), m.size(), value); }
 
     // Writes the matrix to a stream
     friend std::ostream &operator<<(std::ostream &os, const Matrix2D &m) {
@@ -454,21 +554,27 @@ class Matrix2D {
     // Flatten the matrix into a new matrix, axis = 0 for Column Matrix, axis =
     // 1 for Row Matrix
     Matrix2D flatten(int axis) const {
+        Matrix2D result;
+        flatten(axis, result);
+        return result;
+    }
+
+    // Flatten the matrix into result, reusing its storage
+    void flatten(int axis, Matrix2D &result) const {
         assert(axis == 0 || axis == 1);
+        assert(&result != this);
         if (axis == 1) {
-            Matrix2D result(1, cols * rows);
+            result.resize(1, cols * rows);
             for (std::size_t i = 0; i < cols; ++i) {
                 for (std::size_t j = 0; j < rows; ++j) {
                     result.m[j * result.rows + i] = m[i * rows + j];
                 }
             }
-            return result;
         } else {
-            Matrix2D result(rows * cols, 1);
+            result.resize(rows * cols, 1);
             for (std::size_t i = 0; i < cols * rows; ++i) {
                 result.m[i] = m[i];
             }
-            return result;
         }
     }
 
@@ -506,7 +612,69 @@ class Matrix2D {
         unsigned char c;
         for(auto &v : m) {
             read(is, c);
-            v = (decltype(v))c / 255.0f;
+            v = c / 255.0f;
+        }
+    }
+
+  private:
+    // this = alpha * op(a) * op(b) + beta * this, b given by its storage
+    template <typename TB, typename Epilogue = gemm::NoEpilogue>
+    Matrix2D &gemm_into(const Matrix2D &a, const TB *b, std::size_t b_cols,
+                        std::size_t b_rows, gemm::Op ta, gemm::Op tb,
+                        float alpha, float beta,
+                        const Epilogue &epilogue = {}) {
+        std::size_t out_cols = ta == gemm::Op::N ? a.cols : a.rows;
+        std::size_t inner = ta == gemm::Op::N ? a.rows : a.cols;
+        std::size_t out_rows = tb == gemm::Op::N ? b_rows : b_cols;
+        assert(inner == (tb == gemm::Op::N ? b_cols : b_rows));
+        if (beta == 0.0f) {
+            resize(out_cols, out_rows);
+        }
+        assert(cols == out_cols && rows == out_rows);
+        gemm::sgemm(ta, tb, out_cols, out_rows, inner, alpha, a.m.data(),
+                    a.rows, b, b_rows, beta, m.data(), rows, epilogue);
+        return *this;
+    }
+
+    // Storage and scale (element = stored value / scale) of an operand
+    static std::pair<const float *, float> operand(const Matrix2D &b) {
+        return {b.m.data(), 1.0f};
+    }
+    static std::pair<const std::uint8_t *, float> operand(const ByteMatrix &b) {
+        return {b.data, b.scale};
+    }
+
+    // this += alpha * x * y^T, y given by its storage
+    template <typename TY>
+    Matrix2D &rank_update_into(float alpha, const Matrix2D &x, const TY *y,
+                               [[maybe_unused]] std::size_t y_cols,
+                               std::size_t y_rows) {
+        assert(cols == x.cols && rows == y_cols && x.rows == y_rows);
+        gemm::rank_update(cols, rows, x.rows, alpha, x.m.data(), x.rows, y,
+                          y_rows, m.data(), rows);
+        return *this;
+    }
+
+    // Element-wise evaluation loop shared by construction and assignment
+    template <typename E> void assign(const E &e) {
+        float *dst = m.data();
+        const std::size_t n = m.size();
+        for (std::size_t i = 0; i < n; ++i) {
+            dst[i] = e.eval(i);
         }
     }
 };
+
+// Dot product of element-wise expressions: the operands are evaluated first
+template <matrix_expr L, matrix_expr R>
+    requires(!(std::remove_cvref_t<L>::is_leaf &&
+               std::remove_cvref_t<R>::is_leaf))
+Matrix2D operator*(L &&lhs, R &&rhs) {
+    if constexpr (std::remove_cvref_t<L>::is_leaf) {
+        return lhs * Matrix2D(rhs);
+    } else if constexpr (std::remove_cvref_t<R>::is_leaf) {
+        return Matrix2D(lhs) * rhs;
+    } else {
+        return Matrix2D(lhs) * Matrix2D(rhs);
+    }
+}
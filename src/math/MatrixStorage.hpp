@@ -0,0 +1,131 @@
+#pragma once
+
+#include <algorithm>        // copy_n && fill_n && min
+#include <cstddef>          // size_t
+#include <initializer_list> // initializer_list
+#include <utility>          // exchange
+
+#include "../utils/MemoryPool.hpp"
+
+// Element storage of a Matrix2D.
+//
+// Owned storage comes from the memory pool: 64-byte aligned, recycled, and
+// left uninitialized when it grows. A storage can instead borrow memory that
+// outlives it, such as the weights of a memory-mapped model file: nothing is
+// copied or freed, and the borrowed memory is read and written in place
+// until the storage is resized, which moves it to owned memory: the memory
+// is then free to go, e.g. when the model file is closed. Copies are always
+// owned.
+class MatrixStorage {
+    float *elements = nullptr;
+    std::size_t count = 0;
+    std::size_t capacity = 0;
+    bool borrowed = false;
+
+    void release() noexcept {
+        if (!borrowed && elements != nullptr) {
+            memory_pool::deallocate(elements, capacity * sizeof(float));
+        }
+        elements = nullptr;
+        count = 0;
+        capacity = 0;
+        borrowed = false;
+    }
+
+  public:
+    MatrixStorage() = default;
+
+    // n elements with unspecified values
+    explicit MatrixStorage(std::size_t n) { resize(n); }
+
+    // Storage using the n floats at data, which must stay valid and
+    // writable for its lifetime
+    static MatrixStorage borrow(float *data, std::size_t n) {
+        MatrixStorage storage;
+        storage.elements = data;
+        storage.count = n;
+        storage.capacity = n;
+        storage.borrowed = true;
+        return storage;
+    }
+
+    MatrixStorage(const MatrixStorage &other) : MatrixStorage(other.count) {
+        std::copy_n(other.elements, count, elements);
+    }
+
+    MatrixStorage(MatrixStorage &&other) noexcept
+        : elements(std::exchange(other.elements, nullptr)),
+          count(std::exchange(other.count, 0)),
+          capacity(std::exchange(other.capacity, 0)),
+          borrowed(std::exchange(other.borrowed, false)) {}
+
+    MatrixStorage &operator=(const MatrixStorage &other) {
+        if (this != &other) {
+            if (borrowed) {
+                release();
+            }
+            resize(other.count);
+            std::copy_n(other.elements, count, elements);
+        }
+        return *this;
+    }
+
+    MatrixStorage &operator=(MatrixStorage &&other) noexcept {
+        if (this != &other) {
+            release();
+            elements = std::exchange(other.elements, nullptr);
+            count = std::exchange(other.count, 0);
+            capacity = std::exchange(other.capacity, 0);
+            borrowed = std::exchange(other.borrowed, false);
+        }
+        return *this;
+    }
+
+    ~MatrixStorage() { release(); }
+
+    std::size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    // Memory not owned by this storage
+    bool is_borrowed() const { return borrowed; }
+
+    float *data() { return elements; }
+    const float *data() const { return elements; }
+
+    float &operator[](std::size_t i) { return elements[i]; }
+    const float &operator[](std::size_t i) const { return elements[i]; }
+
+    float *begin() { return elements; }
+    float *end() { return elements + count; }
+    const float *begin() const { return elements; }
+    const float *end() const { return elements + count; }
+
+    // Changes the number of elements, keeping the first ones. Owned memory
+    // is kept when it is large enough, borrowed memory never is; new
+    // elements are unspecified
+    void resize(std::size_t n) {
+        if (n > capacity || borrowed) {
+            auto *grown =
+                static_cast<float *>(memory_pool::allocate(n * sizeof(float)));
+            std::copy_n(elements, std::min(count, n), grown);
+            release();
+            elements = grown;
+            capacity = n;
+        }
+        count = n;
+    }
+
+    // Same, new elements set to value
+    void resize(std::size_t n, float value) {
+        std::size_t old = count;
+        resize(n);
+        if (n > old) {
+            std::fill_n(elements + old, n - old, value);
+        }
+    }
+
+    void assign(std::initializer_list<float> values) {
+        resize(values.size());
+        std::copy_n(values.begin(), values.size(), elements);
+    }
+};
@@ -0,0 +1,9 @@
+#pragma once
+
+// SIMD configuration shared by the math kernels. NN_AVX2 is defined when the
+// translation unit is compiled for AVX2 + FMA (-mavx2 -mfma or /arch:AVX2,
+// which implies FMA on MSVC); otherwise the portable scalar code is used.
+#if defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER))
+#define NN_AVX2 1
+#include <immintrin.h>
+#endif
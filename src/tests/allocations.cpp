@@ -0,0 +1,133 @@
+#include "../deep_learning/NeuralNetwork.hpp"
+
+#include <atomic>   // atomic
+#include <cstdlib>  // malloc && aligned_alloc && free
+#include <iostream> // cout && clog && endl
+#include <new>      // bad_alloc && align_val_t
+#include <random>   // mt19937
+#include <vector>   // vector
+
+// Counts heap allocations, so the test can check allocation-free code paths.
+// Replacing the global operators is why this is an executable of its own
+static std::atomic<std::size_t> allocation_count{0};
+
+void *operator new(std::size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+// Over-aligned allocations (memory pool, GEMM packing buffers)
+#ifdef _MSC_VER
+static void *aligned_malloc(std::size_t size, std::size_t alignment) {
+    return _aligned_malloc(size, alignment);
+}
+static void aligned_free(void *p) { _aligned_free(p); }
+#else
+static void *aligned_malloc(std::size_t size, std::size_t alignment) {
+    return std::aligned_alloc(alignment,
+                              (size + alignment - 1) / alignment * alignment);
+}
+static void aligned_free(void *p) { std::free(p); }
+#endif
+
+void *operator new(std::size_t size, std::align_val_t align) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = aligned_malloc(size ? size : 1, std::size_t(align))) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p, std::align_val_t) noexcept { aligned_free(p); }
+
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept {
+    aligned_free(p);
+}
+
+// Counts the allocations of a call of step, after a first call that sizes
+// every buffer, and reports them
+template <typename F> bool allocation_free(const char *name, F &&step) {
+    step();
+    std::size_t before = allocation_count.load();
+    step();
+    std::size_t allocations = allocation_count.load() - before;
+    std::cout << name << ": " << allocations << " allocations"
+              << (allocations == 0 ? " (OK)" : " (FAILED)") << std::endl;
+    return allocations == 0;
+}
+
+// MNIST-like images: a few strokes on a blank background, so training takes
+// the sparse input path
+std::vector<Img> sparse_imgs(std::size_t count) {
+    std::mt19937 generator(42);
+    std::vector<Img> imgs(count);
+    for (Img &img : imgs) {
+        img.label = int(generator() % 10);
+        img.img_data = Matrix2D(28, 28);
+        MatrixStorage &pixels = img.img_data.getData();
+        for (int stroke = 0; stroke < 4; ++stroke) {
+            std::size_t start = 28 * (4 + generator() % 20) + 4 + generator() % 20;
+            for (std::size_t j = 0; j < 40 && start + j < pixels.size(); ++j) {
+                pixels[start + j] = float(1 + generator() % 255) / 256.0f;
+            }
+        }
+    }
+    return imgs;
+}
+
+int main() {
+    // Steady-state training epochs and inference must not touch the heap
+    std::vector<Img> dense(100);
+    for (std::size_t i = 0; i < dense.size(); ++i) {
+        dense[i].label = int(i % 10);
+        dense[i].img_data = Matrix2D(28, 28);
+        dense[i].img_data.randomize(0.0f, 1.0f);
+    }
+    std::vector<Img> imgs = sparse_imgs(600);
+    Dataset dataset(imgs);
+
+    // Progress bars are drawn on std::clog
+    std::clog.setstate(std::ios::failbit);
+
+    NeuralNetwork net(784, 300, 10, 0.1f);
+    NeuralNetwork adam(784, 300, 10, 0.01f);
+    adam.set_optimizer({OptimizerKind::Adam});
+    bool ok = true;
+    ok &= allocation_free("train_img, dense images", [&]() {
+        for (const Img &img : dense) {
+            net.train_img(img);
+        }
+    });
+    ok &= allocation_free("train_img, sparse images", [&]() {
+        for (const Img &img : imgs) {
+            net.train_img(img);
+        }
+    });
+    ok &= allocation_free("train_batch_imgs epoch",
+                          [&]() { net.train_batch_imgs(imgs); });
+    ok &= allocation_free("train_batch_imgs epoch, Dataset",
+                          [&]() { net.train_batch_imgs(dataset); });
+    ok &= allocation_free("train_minibatch epoch",
+                          [&]() { net.train_minibatch(imgs, 32); });
+    ok &= allocation_free("train_minibatch epoch, Dataset",
+                          [&]() { net.train_minibatch(dataset, 32); });
+    ok &= allocation_free("train_minibatch epoch, Adam",
+                          [&]() { adam.train_minibatch(dataset, 32); });
+
+    // Per-sample inference creates temporary matrices, which must be served
+    // by the memory pool once it has seen every shape
+    ok &= allocation_free("classify_img", [&]() {
+        for (const Img &img : dense) {
+            net.classify_img(img);
+        }
+    });
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,90 @@
+#include "../deep_learning/FixedNeuralNetwork.hpp"
+#include "../deep_learning/NeuralNetwork.hpp"
+
+#include <algorithm> // max
+#include <cmath>     // fabs
+#include <iostream>  // cout && clog && endl
+#include <vector>    // vector
+
+// Largest difference between the weights and biases of a and b
+float max_difference(const NeuralNetwork &a, const NeuralNetwork &b) {
+    float difference = 0.0f;
+    auto compare = [&difference](const Matrix2D &x, const Matrix2D &y) {
+        for (std::size_t i = 0; i < x.getData().size(); ++i) {
+            difference = std::max(difference,
+                                  std::fabs(x.getData()[i] - y.getData()[i]));
+        }
+    };
+    compare(a.getHiddenWeights(), b.getHiddenWeights());
+    compare(a.getOutputWeights(), b.getOutputWeights());
+    compare(a.getHiddenBias(), b.getHiddenBias());
+    compare(a.getOutputBias(), b.getOutputBias());
+    return difference;
+}
+
+bool check(const char *name, float difference, float tolerance) {
+    bool ok = difference <= tolerance;
+    std::cout << name << ": max difference " << difference
+              << (ok ? " (OK)" : " (FAILED)") << std::endl;
+    return ok;
+}
+
+int main() {
+    std::vector<Img> imgs(100);
+    for (std::size_t i = 0; i < imgs.size(); ++i) {
+        imgs[i].label = int(i % 10);
+        imgs[i].img_data = Matrix2D(28, 28);
+        imgs[i].img_data.randomize(0.0f, 1.0f);
+    }
+
+    // Progress bars are drawn on std::clog
+    std::clog.setstate(std::ios::failbit);
+
+    bool ok = true;
+    {
+        // A sample trained after mini-batches uses a single-sample workspace
+        NeuralNetwork net(784, 300, 10, 0.1f);
+        net.train_minibatch(imgs, 32);
+        NeuralNetwork reference(net.getLearningRate(), net.getHiddenWeights(),
+                                net.getOutputWeights(), net.getHiddenBias(),
+                                net.getOutputBias());
+        net.train_img(imgs[3]);
+        reference.train_img(imgs[3]);
+        ok &= check("train_img after train_minibatch",
+                    max_difference(net, reference), 0.0f);
+    }
+
+    {
+        // Data-parallel training sums the gradients of fixed shards in a
+        // fixed order, whatever the thread count, and matches the same
+        // mini-batches trained on one thread up to the summation order
+        NeuralNetwork reference(784, 300, 10, 0.1f);
+        NeuralNetwork one_thread = reference, three_threads = reference;
+        reference.train_minibatch(imgs, 32);
+        one_thread.train_parallel(imgs, 32, 1, 1);
+        three_threads.train_parallel(imgs, 32, 1, 3);
+        ok &= check("train_parallel on 1 and 3 threads",
+                    max_difference(one_thread, three_threads), 0.0f);
+        ok &= check("train_parallel against train_minibatch",
+                    max_difference(one_thread, reference), 1e-5f);
+    }
+
+    {
+        // The compile-time topology trains and classifies like the dynamic
+        // network it was copied from
+        NeuralNetwork net(784, 300, 10, 0.1f);
+        MnistNetwork fixed(net);
+        for (std::size_t i = 0; i < 50; ++i) {
+            net.train_img(imgs[i]);
+            fixed.train_img(imgs[i]);
+        }
+        ok &= check("MnistNetwork train_img against NeuralNetwork",
+                    max_difference(net, fixed.to_dynamic()), 1e-5f);
+        ok &= check("MnistNetwork classify_imgs against NeuralNetwork",
+                    float(std::fabs(fixed.classify_imgs(imgs) -
+                                    net.classify_imgs(imgs))),
+                    0.0f);
+    }
+
+    return ok ? 0 : 1;
+}
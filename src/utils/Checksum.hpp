@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef> // size_t
+#include <cstdint> // uint32_t && uint64_t
+#include <cstring> // memcpy
+
+// Fletcher-64 checksum of a byte stream, fed in pieces whose sizes are
+// multiples of 4 bytes. Two running sums over 32-bit words catch corrupted,
+// swapped and truncated data.
+//
+// The words of each piece are summed in 8 independent lanes, which the
+// compiler turns into vector adds, and the lanes are merged into the exact
+// sequential sums: for a piece of n words w_i,
+//   sum1 += sum(w_i)    sum2 += n * sum1 + sum((n - i) * w_i)
+// so large models are verified at memory speed.
+class Fletcher64 {
+    std::uint64_t sum1 = 0;
+    std::uint64_t sum2 = 0;
+
+    static constexpr std::uint64_t modulus = 0xFFFFFFFFu;
+    static constexpr std::size_t lanes = 8;
+    // Words per lane summed before merging, small enough that the lane sums
+    // cannot overflow
+    static constexpr std::size_t lane_words = 1 << 12;
+
+    static std::uint32_t load(const unsigned char *p) {
+        std::uint32_t word;
+        std::memcpy(&word, p, sizeof(word));
+        return word;
+    }
+
+    // n = lanes * m words
+    void update_lanes(const unsigned char *p, std::size_t m) {
+        std::uint64_t a[lanes] = {};
+        std::uint64_t b[lanes] = {};
+        for (std::size_t j = 0; j < m; ++j) {
+            for (std::size_t l = 0; l < lanes; ++l) {
+                a[l] += load(p + (j * lanes + l) * sizeof(std::uint32_t));
+                b[l] += a[l];
+            }
+        }
+        // Word l of group j has weight n - (lanes * j + l) =
+        // lanes * (m - j) - l, and b[l] = sum((m - j) * w)
+        const std::uint64_t n = lanes * m;
+        sum2 = (sum2 + n % modulus * sum1) % modulus;
+        for (std::size_t l = 0; l < lanes; ++l) {
+            sum2 = (sum2 + lanes * (b[l] % modulus) + modulus -
+                    l * (a[l] % modulus) % modulus) %
+                   modulus;
+            sum1 = (sum1 + a[l]) % modulus;
+        }
+    }
+
+  public:
+    void update(const void *data, std::size_t bytes) {
+        const auto *p = static_cast<const unsigned char *>(data);
+        std::size_t words = bytes / sizeof(std::uint32_t);
+        while (words >= lanes) {
+            const std::size_t m =
+                words / lanes < lane_words ? words / lanes : lane_words;
+            update_lanes(p, m);
+            p += lanes * m * sizeof(std::uint32_t);
+            words -= lanes * m;
+        }
+        for (std::size_t i = 0; i < words; ++i) {
+            sum1 = (sum1 + load(p + i * sizeof(std::uint32_t))) % modulus;
+            sum2 = (sum2 + sum1) % modulus;
+        }
+    }
+
+    std::uint64_t value() const { return sum2 << 32 | sum1; }
+};
@@ -0,0 +1,244 @@
+#include "CompressedDataset.hpp"
+
+#include <algorithm> // clamp && min
+#include <cmath>     // lround
+#include <cstring>   // memcpy && memset
+#include <fstream>   // ofstream
+#include <stdexcept> // runtime_error
+
+#include "MappedFile.hpp"
+#include "ThreadPool.hpp"
+
+using namespace compressed_format;
+using namespace file_format;
+
+namespace {
+
+constexpr std::size_t max_run = 128;
+constexpr std::uint8_t zero_run = 0x80;
+
+// Shortest zero run worth ending a literal run for: shorter ones cost no
+// more bytes inside the literal than as a run of their own
+constexpr std::size_t min_zero_run = 3;
+
+// Appends the encoding of n pixels to out
+void encode_image(const std::uint8_t *pixels, std::size_t n,
+                  std::vector<std::uint8_t> &out) {
+    std::size_t j = 0;
+    while (j < n) {
+        std::size_t run = 0;
+        while (j + run < n && run < max_run && pixels[j + run] == 0) {
+            ++run;
+        }
+        if (run > 0) {
+            out.push_back(std::uint8_t(zero_run + run - 1));
+            j += run;
+            continue;
+        }
+        // Literal run up to the next long enough zero run
+        std::size_t length = 0;
+        std::size_t zeros = 0;
+        while (j + length < n && length < max_run && zeros < min_zero_run) {
+            zeros = pixels[j + length] == 0 ? zeros + 1 : 0;
+            ++length;
+        }
+        if (zeros == min_zero_run || j + length == n) {
+            length -= zeros; // Trailing zeros go to the next zero run
+        }
+        out.push_back(std::uint8_t(length - 1));
+        out.insert(out.end(), pixels + j, pixels + j + length);
+        j += length;
+    }
+}
+
+// Runs are copied in whole 16-byte chunks, each one vector move, whenever
+// the chunks stay inside the image and the input; the bytes written past the
+// run are overwritten by the next runs
+constexpr std::size_t chunk = 16;
+
+std::size_t chunked(std::size_t length) {
+    return (length + chunk - 1) / chunk * chunk;
+}
+
+// Decodes one image of n pixels from [in, end) into out and returns the
+// start of the next one. Throws std::runtime_error on malformed data
+const std::uint8_t *decode_image(const std::uint8_t *in,
+                                 const std::uint8_t *end, std::uint8_t *out,
+                                 std::size_t n) {
+    std::size_t j = 0;
+    while (j < n) {
+        if (in == end) {
+            throw std::runtime_error("truncated block");
+        }
+        const std::uint8_t c = *in++;
+        if (c >= zero_run) {
+            const std::size_t run = std::size_t(c - zero_run) + 1;
+            if (run > n - j) {
+                throw std::runtime_error("run past the image");
+            }
+            if (chunked(run) <= n - j) {
+                for (std::size_t k = 0; k < run; k += chunk) {
+                    std::memset(out + j + k, 0, chunk);
+                }
+            } else {
+                std::memset(out + j, 0, run);
+            }
+            j += run;
+        } else {
+            const std::size_t length = std::size_t(c) + 1;
+            if (length > n - j || length > std::size_t(end - in)) {
+                throw std::runtime_error("run past the image");
+            }
+            if (chunked(length) <= n - j &&
+                chunked(length) <= std::size_t(end - in)) {
+                for (std::size_t k = 0; k < length; k += chunk) {
+                    std::memcpy(out + j + k, in + k, chunk);
+                }
+            } else {
+                std::memcpy(out + j, in, length);
+            }
+            in += length;
+            j += length;
+        }
+    }
+    return in;
+}
+
+} // namespace
+
+bool save_compressed_dataset(const std::string &file_string,
+                             const std::vector<Img> &imgs, float scale) {
+    std::ofstream file(file_string, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        return false;
+    }
+    const std::size_t cols = imgs.empty() ? 0 : imgs[0].img_data.getCols();
+    const std::size_t rows = imgs.empty() ? 0 : imgs[0].img_data.getRows();
+    const std::size_t pixels_per_img = cols * rows;
+    const std::size_t block_count =
+        (imgs.size() + block_images - 1) / block_images;
+
+    std::vector<std::int32_t> labels(imgs.size());
+    std::vector<std::uint64_t> index;
+    index.reserve(block_count + 1);
+    std::vector<std::uint8_t> data;
+    std::vector<std::uint8_t> bytes(pixels_per_img);
+    for (std::size_t i = 0; i < imgs.size(); ++i) {
+        const MatrixStorage &pixels = imgs[i].img_data.getData();
+        if (pixels.size() != pixels_per_img) {
+            return false; // Every image must have the same shape
+        }
+        if (i % block_images == 0) {
+            index.push_back(data.size());
+        }
+        for (std::size_t j = 0; j < pixels_per_img; ++j) {
+            bytes[j] = std::uint8_t(
+                std::clamp(std::lround(pixels[j] * scale), 0L, 255L));
+        }
+        encode_image(bytes.data(), pixels_per_img, data);
+        labels[i] = imgs[i].label;
+    }
+    index.push_back(data.size());
+
+    CompressedHeader header = {};
+    stamp_header(header, magic, version);
+    header.block_images = block_images;
+    header.count = imgs.size();
+    header.cols = std::uint32_t(cols);
+    header.rows = std::uint32_t(rows);
+    header.scale = scale;
+    header.block_count = std::uint32_t(block_count);
+    header.labels_offset = sizeof(CompressedHeader);
+    header.index_offset =
+        header.labels_offset + labels.size() * sizeof(std::int32_t);
+    header.data_offset =
+        header.index_offset + index.size() * sizeof(std::uint64_t);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(labels.data()),
+               std::streamsize(labels.size() * sizeof(std::int32_t)));
+    file.write(reinterpret_cast<const char *>(index.data()),
+               std::streamsize(index.size() * sizeof(std::uint64_t)));
+    file.write(reinterpret_cast<const char *>(data.data()),
+               std::streamsize(data.size()));
+    return bool(file);
+}
+
+Dataset load_compressed_dataset(const std::string &file_string,
+                                unsigned int threads) {
+    MappedFile file(file_string);
+    if (!file.is_open()) {
+        throw std::runtime_error("Cannot open dataset '" + file_string + "'");
+    }
+    auto invalid = [&file_string](const std::string &reason) {
+        return std::runtime_error("Invalid dataset '" + file_string +
+                                  "': " + reason);
+    };
+    if (file.size() < sizeof(CompressedHeader)) {
+        throw invalid("file too small");
+    }
+    CompressedHeader header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    check_header(header, magic, version, version, invalid);
+    const std::uint64_t count = header.count;
+    if (header.block_images == 0 ||
+        header.block_count !=
+            (count + header.block_images - 1) / header.block_images) {
+        throw invalid("bad block count");
+    }
+    if (!fits(header.labels_offset, count, sizeof(std::int32_t),
+              file.size()) ||
+        !fits(header.index_offset, std::uint64_t(header.block_count) + 1,
+              sizeof(std::uint64_t), file.size()) ||
+        header.data_offset > file.size()) {
+        throw invalid("truncated");
+    }
+    // The index is copied out since its offset is not necessarily aligned
+    std::vector<std::uint64_t> index(header.block_count + 1);
+    std::memcpy(index.data(), file.data() + header.index_offset,
+                index.size() * sizeof(std::uint64_t));
+    for (std::size_t b = 0; b < header.block_count; ++b) {
+        if (index[b] > index[b + 1]) {
+            throw invalid("bad block index");
+        }
+    }
+    if (!fits(header.data_offset, index.back(), 1, file.size())) {
+        throw invalid("truncated");
+    }
+    // A control byte covers at most max_run pixels, so the encoded size
+    // bounds the images before they are allocated
+    const std::uint64_t min_image_bytes =
+        (std::uint64_t(header.cols) * header.rows + max_run - 1) / max_run;
+    if (min_image_bytes != 0 && count > index.back() / min_image_bytes) {
+        throw invalid("sizes do not match the file");
+    }
+
+    Dataset dataset(header.cols, header.rows, count, header.scale);
+    for (std::size_t s = 0; s < count; ++s) {
+        std::memcpy(&dataset.getLabel(s),
+                    file.data() + header.labels_offset +
+                        s * sizeof(std::int32_t),
+                    sizeof(std::int32_t));
+    }
+    const auto *data = reinterpret_cast<const std::uint8_t *>(
+        file.data() + header.data_offset);
+    const std::size_t n = dataset.image_size();
+    ThreadPool pool(threads);
+    pool.parallel_for(header.block_count, [&](std::size_t b) {
+        const std::uint8_t *in = data + index[b];
+        const std::uint8_t *end = data + index[b + 1];
+        const std::size_t first = b * header.block_images;
+        const std::size_t last =
+            std::min<std::size_t>(count, first + header.block_images);
+        try {
+            for (std::size_t s = first; s < last; ++s) {
+                in = decode_image(in, end, dataset.getBytes(s), n);
+            }
+        } catch (const std::runtime_error &e) {
+            throw invalid(e.what());
+        }
+        if (in != end) {
+            throw invalid("bad block");
+        }
+    });
+    return dataset;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef> // size_t
+#include <cstdint> // uint32_t && uint64_t
+#include <string>  // string
+#include <vector>  // vector
+
+#include "Dataset.hpp"
+#include "FileFormat.hpp"
+#include "Img.hpp"
+
+// Compressed image dataset file, for storage and transfer.
+//
+// Layout (conventions in FileFormat.hpp):
+//   CompressedHeader                       64 bytes
+//   labels: int32_t[count]                 at labels_offset
+//   index:  uint64_t[block_count + 1]      at index_offset, start of each
+//           block relative to data_offset, then the end of the last one
+//   data:   encoded blocks                 at data_offset
+// Block b holds images [b * block_images, (b + 1) * block_images), each
+// encoded on its own and decoding to exactly cols * rows bytes, so blocks
+// decode in parallel. Pixels are bytes with pixel = byte / scale.
+//
+// Images are encoded with zero-run-length coding, suited to sparse images
+// (most MNIST pixels are 0). The stream is a sequence of runs, each
+// introduced by one control byte c:
+//   c >= 0x80   (c - 0x7F) zero pixels, 1 to 128
+//   c <  0x80   (c + 1) literal pixels, 1 to 128, packed after c
+namespace compressed_format {
+
+constexpr char magic[4] = {'N', 'N', 'D', 'Z'};
+constexpr std::uint32_t version = 1;
+// Images per block, small enough to spread a test set over every core
+constexpr std::uint32_t block_images = 1024;
+
+struct CompressedHeader {
+    char magic[4];
+    std::uint32_t version;
+    std::uint32_t endian_marker;
+    std::uint32_t block_images;
+    std::uint64_t count;
+    std::uint32_t cols;
+    std::uint32_t rows;
+    float scale;
+    std::uint32_t block_count;
+    std::uint64_t labels_offset;
+    std::uint64_t index_offset;
+    std::uint64_t data_offset;
+};
+static_assert(sizeof(CompressedHeader) == 64);
+
+} // namespace compressed_format
+
+// Writes imgs in the compressed format, pixels stored as
+// round(pixel * scale) like save_dataset
+bool save_compressed_dataset(const std::string &file_string,
+                             const std::vector<Img> &imgs,
+                             float scale = 256.0f);
+
+// Decodes a compressed file into a compact dataset, one block per task on
+// threads threads (0 = one per hardware core). Throws std::runtime_error
+// when the file is missing or malformed
+Dataset load_compressed_dataset(const std::string &file_string,
+                                unsigned int threads = 0);
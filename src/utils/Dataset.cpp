@@ -0,0 +1,170 @@
+#include "Dataset.hpp"
+
+#include <algorithm>    // copy_n
+#include <filesystem>   // file_size
+#include <fstream>      // ifstream
+#include <numeric>      // iota
+#include <random>       // mt19937_64 && shuffle
+#include <stdexcept>    // invalid_argument && runtime_error
+#include <system_error> // error_code
+
+#include "Serialization.hpp"
+
+namespace {
+
+// Images are padded to whole 64-byte lines
+std::size_t padded_stride(std::size_t n, std::size_t element_size) {
+    const std::size_t line = 64 / element_size;
+    return (n + line - 1) / line * line;
+}
+
+} // namespace
+
+Dataset::Dataset(std::size_t cols, std::size_t rows, std::size_t count,
+                 float byte_scale)
+    : cols(cols), rows(rows), scale(byte_scale), labels(count), order(count) {
+    if (is_compact()) {
+        stride = padded_stride(cols * rows, sizeof(std::uint8_t));
+        bytes.resize(count * stride);
+    } else {
+        stride = padded_stride(cols * rows, sizeof(float));
+        pixels.resize(count * stride);
+    }
+    std::iota(order.begin(), order.end(), std::size_t(0));
+}
+
+Dataset::Dataset(const std::vector<Img> &imgs)
+    : Dataset(imgs.empty() ? 0 : imgs[0].img_data.getCols(),
+              imgs.empty() ? 0 : imgs[0].img_data.getRows(), imgs.size()) {
+    for (std::size_t s = 0; s < imgs.size(); ++s) {
+        const MatrixStorage &data = imgs[s].img_data.getData();
+        if (data.size() != image_size()) {
+            throw std::invalid_argument(
+                "Dataset: every image must have the same shape");
+        }
+        std::copy_n(data.data(), data.size(), getPixels(s));
+        labels[s] = imgs[s].label;
+    }
+}
+
+Dataset::Dataset(const MappedDataset &mapped)
+    : Dataset(mapped.getCols(), mapped.getRows(), mapped.size(),
+              mapped.getPixelType() == dataset_format::PixelType::UInt8
+                  ? mapped.getScale()
+                  : 0.0f) {
+    for (std::size_t s = 0; s < mapped.size(); ++s) {
+        ImgView img = mapped[s];
+        if (is_compact()) {
+            std::copy_n(img.bytes, image_size(), getBytes(s));
+        } else {
+            img.copy_to(getPixels(s));
+        }
+        labels[s] = img.label;
+    }
+}
+
+void Dataset::resize(std::size_t count) {
+    if (is_compact()) {
+        bytes.resize(count * stride);
+    } else {
+        pixels.resize(count * stride);
+    }
+    labels.resize(count);
+    order.resize(count);
+    reset_order();
+}
+
+void Dataset::shuffle(std::uint64_t seed) {
+    std::mt19937_64 generator(seed);
+    std::shuffle(order.begin(), order.end(), generator);
+}
+
+void Dataset::reset_order() {
+    std::iota(order.begin(), order.end(), std::size_t(0));
+}
+
+void Dataset::gather(std::size_t first, std::size_t count, Matrix2D &inputs,
+                     Matrix2D &targets, std::size_t classes) const {
+    assert(first + count <= size());
+    inputs.resize(image_size(), count);
+    one_hot_columns([&](std::size_t i) { return labels[order[first + i]]; },
+                    count, classes, targets);
+    float *in = inputs.getData().data();
+    if (is_compact()) {
+        for (std::size_t i = 0; i < count; ++i) {
+            (*this)[first + i].copy_to(in + i, count);
+        }
+    } else {
+        gather_columns(
+            [&](std::size_t i) { return getPixels(order[first + i]); }, count,
+            image_size(), in);
+    }
+}
+
+void Dataset::gather_bytes(std::size_t first, std::size_t count,
+                           ByteStorage &inputs, Matrix2D &targets,
+                           std::size_t classes) const {
+    assert(is_compact() && first + count <= size());
+    inputs.resize(image_size() * count);
+    one_hot_columns([&](std::size_t i) { return labels[order[first + i]]; },
+                    count, classes, targets);
+    gather_columns([&](std::size_t i) { return getBytes(order[first + i]); },
+                   count, image_size(), inputs.data());
+}
+
+std::vector<Img> Dataset::to_imgs() const {
+    std::vector<Img> imgs;
+    imgs.reserve(size());
+    for (std::size_t i = 0; i < size(); ++i) {
+        imgs.push_back((*this)[i].to_img());
+    }
+    return imgs;
+}
+
+Dataset load_binary_compact_dataset(const std::string &file_string) {
+    std::ifstream file(file_string, std::ios::binary);
+    if (!file.is_open()) {
+        return {};
+    }
+    auto invalid = [&file_string](const char *reason) {
+        return std::runtime_error("Invalid dataset '" + file_string +
+                                  "': " + reason);
+    };
+    std::error_code error;
+    const std::uintmax_t file_size =
+        std::filesystem::file_size(file_string, error);
+    std::size_t size = 0;
+    read(file, size);
+    Dataset dataset;
+    for (std::size_t s = 0; s < size; ++s) {
+        int label;
+        std::size_t cols, rows;
+        read(file, label);
+        read(file, cols);
+        read(file, rows);
+        if (!file) {
+            throw invalid("truncated");
+        }
+        if (s == 0) {
+            // Every image takes its label, its shape and its pixels, so the
+            // file bounds the allocation (another file type fails here)
+            const std::uintmax_t header =
+                sizeof(label) + sizeof(cols) + sizeof(rows);
+            if (cols == 0 || rows == 0 || rows > file_size / cols ||
+                size > file_size / (header + cols * rows)) {
+                throw invalid("sizes do not match the file");
+            }
+            dataset = Dataset(cols, rows, size, 255.0f);
+        } else if (cols != dataset.getCols() || rows != dataset.getRows()) {
+            throw std::runtime_error("Dataset: every image must have the "
+                                     "same shape in '" + file_string + "'");
+        }
+        dataset.getLabel(s) = label;
+        file.read(reinterpret_cast<char *>(dataset.getBytes(s)),
+                  std::streamsize(cols * rows));
+        if (!file) {
+            throw invalid("truncated");
+        }
+    }
+    return dataset;
+}
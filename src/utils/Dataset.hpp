@@ -0,0 +1,171 @@
+#pragma once
+
+#include <cassert> // assert
+#include <cstddef> // size_t
+#include <cstdint> // uint64_t && uint8_t
+#include <vector>  // vector
+
+#include "../math/Matrix2D.hpp"
+#include "Img.hpp"
+#include "MappedDataset.hpp"
+
+// In-memory image dataset stored as structure of arrays.
+//
+// All pixels live in one contiguous 64-byte aligned buffer (image i at
+// i * stride elements, stride padded so that every image is aligned) and all
+// labels in another, instead of one heap matrix per image. Samples are
+// addressed through an index permutation: shuffle() only reorders indices,
+// never pixels. Iteration and the batch operations follow the current order.
+//
+// A compact dataset keeps its pixels as bytes (pixel = byte / scale), a
+// quarter of the float size; batches of it are gathered as bytes and fed to
+// the first layer without being expanded (see gather_bytes).
+class Dataset {
+    std::size_t cols = 0;
+    std::size_t rows = 0;
+    std::size_t stride = 0;
+    float scale = 0.0f; // 0 for float pixels
+    MatrixStorage pixels;
+    ByteStorage bytes;
+    std::vector<int> labels;
+    std::vector<std::size_t> order;
+
+  public:
+    // Consecutive samples [first, first + count) of a dataset, in its
+    // current order. Usable anywhere a dataset is
+    class Batch {
+        const Dataset *dataset;
+        std::size_t first;
+        std::size_t count;
+
+      public:
+        Batch(const Dataset &dataset, std::size_t first, std::size_t count)
+            : dataset(&dataset), first(first), count(count) {}
+
+        std::size_t size() const { return count; }
+
+        bool is_compact() const { return dataset->is_compact(); }
+
+        float getScale() const { return dataset->getScale(); }
+
+        ImgView operator[](std::size_t i) const {
+            return (*dataset)[first + i];
+        }
+
+        void gather(std::size_t offset, std::size_t n, Matrix2D &inputs,
+                    Matrix2D &targets, std::size_t classes) const {
+            dataset->gather(first + offset, n, inputs, targets, classes);
+        }
+
+        void gather_bytes(std::size_t offset, std::size_t n,
+                          ByteStorage &inputs, Matrix2D &targets,
+                          std::size_t classes) const {
+            dataset->gather_bytes(first + offset, n, inputs, targets, classes);
+        }
+    };
+
+    Dataset() = default;
+
+    // count images of cols x rows, with unspecified pixels and labels.
+    // byte_scale != 0 makes a compact dataset
+    Dataset(std::size_t cols, std::size_t rows, std::size_t count,
+            float byte_scale = 0.0f);
+
+    // Copies images, which must all have the same shape
+    explicit Dataset(const std::vector<Img> &imgs);
+
+    // Copies a mapped dataset, compact when its pixels are uint8
+    explicit Dataset(const MappedDataset &mapped);
+
+    std::size_t size() const { return order.size(); }
+
+    // getter
+    std::size_t getCols() const { return cols; }
+
+    // getter
+    std::size_t getRows() const { return rows; }
+
+    // Pixels per image
+    std::size_t image_size() const { return cols * rows; }
+
+    // Pixels stored as bytes
+    bool is_compact() const { return scale != 0.0f; }
+
+    // getter, pixel = byte / scale in a compact dataset
+    float getScale() const { return scale; }
+
+    // Sample i in the current order
+    ImgView operator[](std::size_t i) const {
+        std::size_t s = order[i];
+        ImgView view;
+        view.label = labels[s];
+        view.cols = cols;
+        view.rows = rows;
+        if (is_compact()) {
+            view.bytes = bytes.data() + s * stride;
+            view.scale = scale;
+        } else {
+            view.pixels = pixels.data() + s * stride;
+        }
+        return view;
+    }
+
+    // Float storage of image s, in storage order (ignores the permutation)
+    float *getPixels(std::size_t s) {
+        assert(!is_compact());
+        return pixels.data() + s * stride;
+    }
+    const float *getPixels(std::size_t s) const {
+        assert(!is_compact());
+        return pixels.data() + s * stride;
+    }
+
+    // Byte storage of image s of a compact dataset, in storage order
+    std::uint8_t *getBytes(std::size_t s) {
+        assert(is_compact());
+        return bytes.data() + s * stride;
+    }
+    const std::uint8_t *getBytes(std::size_t s) const {
+        assert(is_compact());
+        return bytes.data() + s * stride;
+    }
+
+    // Label of image s, in storage order (ignores the permutation)
+    int &getLabel(std::size_t s) { return labels[s]; }
+    int getLabel(std::size_t s) const { return labels[s]; }
+
+    // Changes the number of images, keeping the storage when it is large
+    // enough. Pixels and labels of new images are unspecified and the order
+    // is reset
+    void resize(std::size_t count);
+
+    // Random permutation of the samples, reproducible from the seed
+    void shuffle(std::uint64_t seed);
+
+    // Back to storage order
+    void reset_order();
+
+    Batch batch(std::size_t first, std::size_t count) const {
+        return Batch(*this, first, count);
+    }
+
+    // Copies samples [first, first + count) of the current order into the
+    // columns of inputs (image_size x count) and their one-hot labels into
+    // targets (classes x count), resizing both. Compact pixels are
+    // dequantized. A label outside [0, classes) throws std::out_of_range
+    void gather(std::size_t first, std::size_t count, Matrix2D &inputs,
+                Matrix2D &targets, std::size_t classes) const;
+
+    // Same for a compact dataset, keeping the pixels as bytes
+    void gather_bytes(std::size_t first, std::size_t count,
+                      ByteStorage &inputs, Matrix2D &targets,
+                      std::size_t classes) const;
+
+    // Owning copies of every image, in the current order
+    std::vector<Img> to_imgs() const;
+};
+
+// Loads a file written by save_binary_compact_imgs as a compact dataset,
+// without expanding the pixels to floats. Throws std::runtime_error when the
+// file is truncated or malformed
+Dataset load_binary_compact_dataset(const std::string &file_string);
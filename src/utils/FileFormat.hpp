@@ -0,0 +1,66 @@
+#pragma once
+
+#include <algorithm> // copy && equal
+#include <cstddef>   // size_t
+#include <cstdint>   // uint32_t && uint64_t
+#include <ostream>   // ostream
+
+// Conventions shared by the binary file formats (model_format,
+// quantized_format, dataset_format and compressed_format).
+//
+// Every file starts with a 64-byte header opening with magic[4], version
+// and endian_marker. Values are stored in host byte order; a file written on
+// a machine of the other byte order reads back a swapped endian_marker and is
+// rejected. Arrays that are used in place start on an alignment boundary,
+// with zero padding in between.
+namespace file_format {
+
+constexpr std::uint32_t endian_marker = 0x01020304;
+constexpr std::size_t alignment = 64;
+
+inline std::uint64_t align_up(std::uint64_t offset) {
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+// Writes zeros up to offset, which must not be behind the put position
+inline void pad_to(std::ostream &file, std::uint64_t offset) {
+    static const char zeros[alignment] = {};
+    const std::uint64_t pos = std::uint64_t(file.tellp());
+    file.write(zeros, std::streamsize(offset - pos));
+}
+
+// Whether count elements of size bytes at offset fit in file_size bytes,
+// without overflowing on crafted offsets and counts
+inline bool fits(std::uint64_t offset, std::uint64_t count, std::uint64_t size,
+                 std::uint64_t file_size) {
+    return offset <= file_size &&
+           (size == 0 || count <= (file_size - offset) / size);
+}
+
+// Fills the magic, version and endian_marker of a header being written
+template <class Header>
+void stamp_header(Header &header, const char (&magic)[4],
+                  std::uint32_t version) {
+    std::copy(std::begin(magic), std::end(magic), header.magic);
+    header.version = version;
+    header.endian_marker = endian_marker;
+}
+
+// Checks the magic, byte order and version (oldest to newest) of a header
+// being read, throwing invalid(reason) on a mismatch
+template <class Header, class Invalid>
+void check_header(const Header &header, const char (&magic)[4],
+                  std::uint32_t oldest, std::uint32_t newest,
+                  const Invalid &invalid) {
+    if (!std::equal(std::begin(magic), std::end(magic), header.magic)) {
+        throw invalid("bad magic");
+    }
+    if (header.endian_marker != endian_marker) {
+        throw invalid("written with a different byte order");
+    }
+    if (header.version < oldest || header.version > newest) {
+        throw invalid("unsupported version");
+    }
+}
+
+} // namespace file_format
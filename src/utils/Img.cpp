@@ -1,10 +1,42 @@
 #include "Img.hpp"
 
+#include <algorithm>    // max
+#include <charconv>     // from_chars
+#include <cstring>      // memchr
 #include <fstream>
 #include <iostream>
 #include <ranges>
+#include <stdexcept>    // invalid_argument && out_of_range
+#include <system_error> // errc
 
+#include "MappedFile.hpp"
 #include "Serialization.hpp"
+#include "ThreadPool.hpp"
+
+ImgView::ImgView(const Img &img)
+    : label(img.label), cols(img.img_data.getCols()),
+      rows(img.img_data.getRows()), pixels(img.img_data.getData().data()) {}
+
+void ImgView::copy_to(float *out, std::size_t stride) const {
+    const std::size_t n = size();
+    if (pixels != nullptr) {
+        for (std::size_t j = 0; j < n; ++j) {
+            out[j * stride] = pixels[j];
+        }
+    } else {
+        for (std::size_t j = 0; j < n; ++j) {
+            out[j * stride] = bytes[j] / scale;
+        }
+    }
+}
+
+Img ImgView::to_img() const {
+    Img img;
+    img.label = label;
+    img.img_data = Matrix2D(cols, rows, Matrix2D::uninitialized);
+    copy_to(img.img_data.getData().data());
+    return img;
+}
 
 std::string getColor(float value) {
     if (value <= 0) {
@@ -40,34 +72,128 @@ void Img::print() {
               << "\033[94m" << label << "\033[37m" << std::endl;
 }
 
-std::vector<Img> csv_to_imgs(const std::string &file_string,
-                             int number_of_imgs) {
-    std::ifstream file(file_string);
-    std::vector<Img> imgs;
-    imgs.reserve(number_of_imgs);
-    std::string line;
-    int i = 0;
-    while (std::getline(file, line)) {
-        i++;
-        if (i == 1 || line.empty()) {
-            continue; // skip header
+namespace {
+
+// Calls f(first, last) for every line of [begin, end), without the '\n'
+template <typename F>
+void for_each_line(const char *begin, const char *end, F &&f) {
+    while (begin < end) {
+        const char *eol = static_cast<const char *>(
+            std::memchr(begin, '\n', std::size_t(end - begin)));
+        if (eol == nullptr) {
+            eol = end;
         }
-        Img img;
-        img.img_data = std::move(Matrix2D(28, 28));
-        int j = 0;
-
-        std::istringstream s(line);
-        std::string field;
-        while (getline(s, field, ',')) {
-            if (j == 0) {
-                img.label = std::stoi(field);
-            } else {
-                img.img_data[j - 1] = std::stoi(field) / 256.0f;
-            }
-            j++;
+        f(begin, eol);
+        begin = eol + 1;
+    }
+}
+
+// Parses an integer field like std::stoi: leading whitespace and a '+' sign
+// are accepted, anything after the digits is ignored
+int parse_int(const char *first, const char *last) {
+    while (first < last && (*first == ' ' || *first == '\t' ||
+                            *first == '\r' || *first == '\v' ||
+                            *first == '\f')) {
+        ++first;
+    }
+    if (first < last && *first == '+') {
+        ++first;
+    }
+    int value = 0;
+    auto [ptr, ec] = std::from_chars(first, last, value);
+    if (ec == std::errc::invalid_argument) {
+        throw std::invalid_argument("csv_to_imgs: invalid number");
+    }
+    if (ec == std::errc::result_out_of_range) {
+        throw std::out_of_range("csv_to_imgs: number out of range");
+    }
+    return value;
+}
+
+// Parses one "label,pixel,pixel,..." row into img
+void parse_row(const char *first, const char *last, Img &img) {
+    img.img_data = Matrix2D(28, 28);
+    float *pixels = img.img_data.getData().data();
+    const std::size_t n_pixels = img.img_data.getData().size();
+    std::size_t j = 0;
+    while (first < last) {
+        const char *comma = static_cast<const char *>(
+            std::memchr(first, ',', std::size_t(last - first)));
+        if (comma == nullptr) {
+            comma = last;
         }
-        imgs.push_back(std::move(img));
+        int value = parse_int(first, comma);
+        if (j == 0) {
+            img.label = value;
+        } else if (j - 1 < n_pixels) {
+            pixels[j - 1] = value / 256.0f;
+        } else {
+            throw std::out_of_range("csv_to_imgs: too many pixels in a row");
+        }
+        j++;
+        first = comma + 1;
+    }
+}
+
+} // namespace
+
+std::vector<Img> csv_to_imgs(const std::string &file_string,
+                             int number_of_imgs, unsigned int threads) {
+    MappedFile file(file_string);
+    if (!file.is_open() || file.size() == 0) {
+        return {};
     }
+
+    // Skip header
+    const char *body = static_cast<const char *>(
+        std::memchr(file.begin(), '\n', file.size()));
+    if (body == nullptr) {
+        return {};
+    }
+    body++;
+
+    // Split the rows into chunks at line boundaries, a few per thread so
+    // that uneven chunks still balance
+    ThreadPool pool(threads);
+    const std::size_t n_chunks = std::size_t(pool.size()) * 4;
+    const std::size_t body_size = std::size_t(file.end() - body);
+    std::vector<const char *> bounds(n_chunks + 1, file.end());
+    bounds[0] = body;
+    for (std::size_t c = 1; c < n_chunks; ++c) {
+        const char *p = std::max(bounds[c - 1], body + body_size * c / n_chunks);
+        const char *eol = static_cast<const char *>(
+            std::memchr(p, '\n', std::size_t(file.end() - p)));
+        bounds[c] = eol == nullptr ? file.end() : eol + 1;
+    }
+
+    // First pass: count the rows of every chunk to know where its images go
+    std::vector<std::size_t> first_img(n_chunks + 1, 0);
+    pool.parallel_for(n_chunks, [&](std::size_t c) {
+        std::size_t rows = 0;
+        for_each_line(bounds[c], bounds[c + 1],
+                      [&rows](const char *first, const char *last) {
+                          rows += first != last;
+                      });
+        first_img[c + 1] = rows;
+    });
+    for (std::size_t c = 0; c < n_chunks; ++c) {
+        first_img[c + 1] += first_img[c];
+    }
+
+    // Second pass: parse every chunk straight into its images
+    std::vector<Img> imgs;
+    imgs.reserve(std::max(std::size_t(std::max(number_of_imgs, 0)),
+                          first_img[n_chunks]));
+    imgs.resize(first_img[n_chunks]);
+    pool.parallel_for(n_chunks, [&](std::size_t c) {
+        std::size_t i = first_img[c];
+        for_each_line(bounds[c], bounds[c + 1],
+                      [&](const char *first, const char *last) {
+                          if (first != last) {
+                              parse_row(first, last, imgs[i++]);
+                          }
+                      });
+    });
     return imgs;
 }
 
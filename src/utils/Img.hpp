@@ -1,5 +1,10 @@
 #pragma once
 
+#include <algorithm> // min
+#include <cstddef>   // size_t
+#include <cstdint>   // uint8_t
+#include <stdexcept> // out_of_range
+
 #include "../math/Matrix2D.hpp"
 
 struct Img {
@@ -9,8 +14,83 @@ struct Img {
     void print();
 };
 
+// Non-owning view of one image: either float pixels (an Img, a float
+// dataset) or quantized bytes where pixel = byte / scale (a uint8 dataset).
+// Views are cheap to copy and only valid while the images they point into
+// are alive.
+struct ImgView {
+    int label = 0;
+    std::size_t cols = 0;
+    std::size_t rows = 0;
+    const float *pixels = nullptr;
+    const std::uint8_t *bytes = nullptr;
+    float scale = 1.0f;
+
+    ImgView() = default;
+    ImgView(const Img &img);
+
+    std::size_t size() const { return cols * rows; }
+
+    float operator[](std::size_t i) const {
+        return pixels != nullptr ? pixels[i] : bytes[i] / scale;
+    }
+
+    // Writes pixel j to out[j * stride], e.g. a column of a batch matrix
+    void copy_to(float *out, std::size_t stride = 1) const;
+
+    // Owning copy of the image
+    Img to_img() const;
+};
+
+// Copies count images of n pixels into the columns of out (n x count):
+// out[j * count + i] = image(i)[j]. Transposes in tiles of 8 images x 64
+// pixels, so each image is read sequentially and each output row written as
+// a short contiguous run
+template <typename T, typename F>
+void gather_columns(F &&image, std::size_t count, std::size_t n, T *out) {
+    constexpr std::size_t tile_imgs = 8;
+    constexpr std::size_t tile_pixels = 64;
+    const T *src[tile_imgs];
+    for (std::size_t i0 = 0; i0 < count; i0 += tile_imgs) {
+        const std::size_t i1 = std::min(count, i0 + tile_imgs);
+        for (std::size_t i = i0; i < i1; ++i) {
+            src[i - i0] = image(i);
+        }
+        for (std::size_t j0 = 0; j0 < n; j0 += tile_pixels) {
+            const std::size_t j1 = std::min(n, j0 + tile_pixels);
+            for (std::size_t j = j0; j < j1; ++j) {
+                T *dst = out + j * count;
+                for (std::size_t i = i0; i < i1; ++i) {
+                    dst[i] = src[i - i0][j];
+                }
+            }
+        }
+    }
+}
+
+// Sets targets (classes x count) to the one-hot labels of count images,
+// label(i) in column i. Labels come from files, so one outside [0, classes)
+// throws std::out_of_range instead of being written outside targets
+template <typename F>
+void one_hot_columns(F &&label, std::size_t count, std::size_t classes,
+                     Matrix2D &targets) {
+    targets.resize(classes, count);
+    targets.fill(0.0f);
+    float *out = targets.getData().data();
+    for (std::size_t i = 0; i < count; ++i) {
+        const int l = label(i);
+        if (l < 0 || std::size_t(l) >= classes) {
+            throw std::out_of_range("Label out of range");
+        }
+        out[std::size_t(l) * count + i] = 1.0f;
+    }
+}
+
+// Parses a "label,pixel,..." CSV file (with a header line) into images.
+// The file is memory-mapped and parsed in parallel, threads = 0 uses one
+// thread per hardware core
 std::vector<Img> csv_to_imgs(const std::string &file_string,
-                             int number_of_imgs);
+                             int number_of_imgs, unsigned int threads = 0);
 
 bool save_binary_imgs(const std::string &file_string,
                       const std::vector<Img> &imgs);
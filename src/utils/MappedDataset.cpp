@@ -0,0 +1,152 @@
+#include "MappedDataset.hpp"
+
+#include <algorithm> // clamp
+#include <cmath>     // lround
+#include <cstring>   // memcpy
+#include <fstream>   // ofstream
+#include <stdexcept> // runtime_error
+
+using namespace dataset_format;
+using namespace file_format;
+
+namespace {
+
+std::size_t pixel_size(PixelType type) {
+    return type == PixelType::UInt8 ? sizeof(std::uint8_t) : sizeof(float);
+}
+
+} // namespace
+
+MappedDataset::MappedDataset(const std::string &file_string)
+    : file(file_string) {
+    if (!file.is_open()) {
+        throw std::runtime_error("Cannot open dataset '" + file_string + "'");
+    }
+    auto invalid = [&file_string](const char *reason) {
+        return std::runtime_error("Invalid dataset '" + file_string +
+                                  "': " + reason);
+    };
+    if (file.size() < sizeof(DatasetHeader)) {
+        throw invalid("file too small");
+    }
+    header = reinterpret_cast<const DatasetHeader *>(file.data());
+    check_header(*header, magic, version, version, invalid);
+    if (header->pixel_type != PixelType::Float32 &&
+        header->pixel_type != PixelType::UInt8) {
+        throw invalid("unknown pixel type");
+    }
+    // A zero scale would read as float pixels in training (NaN fails too)
+    if (header->pixel_type == PixelType::UInt8 && !(header->scale > 0.0f)) {
+        throw invalid("bad scale");
+    }
+    const std::uint64_t count = header->count;
+    const std::uint64_t image_bytes = std::uint64_t(header->cols) *
+                                      header->rows *
+                                      pixel_size(header->pixel_type);
+    if (header->labels_offset % alignment != 0 ||
+        header->pixels_offset % alignment != 0 ||
+        header->image_stride % alignment != 0 ||
+        header->image_stride < image_bytes) {
+        throw invalid("misaligned arrays");
+    }
+    if (!fits(header->labels_offset, count, sizeof(std::int32_t),
+              file.size()) ||
+        !fits(header->pixels_offset, count, header->image_stride,
+              file.size())) {
+        throw invalid("truncated");
+    }
+    labels = reinterpret_cast<const std::int32_t *>(file.data() +
+                                                    header->labels_offset);
+    pixels = file.data() + header->pixels_offset;
+}
+
+ImgView MappedDataset::operator[](std::size_t i) const {
+    ImgView view;
+    view.label = labels[i];
+    view.cols = header->cols;
+    view.rows = header->rows;
+    if (header->pixel_type == PixelType::UInt8) {
+        view.bytes = static_cast<const std::uint8_t *>(getPixels(i));
+        view.scale = header->scale;
+    } else {
+        view.pixels = static_cast<const float *>(getPixels(i));
+    }
+    return view;
+}
+
+void MappedDataset::gather_bytes(std::size_t first, std::size_t count,
+                                 ByteStorage &inputs, Matrix2D &targets,
+                                 std::size_t classes) const {
+    const std::size_t n = getCols() * getRows();
+    inputs.resize(n * count);
+    one_hot_columns([&](std::size_t i) { return labels[first + i]; }, count,
+                    classes, targets);
+    gather_columns(
+        [&](std::size_t i) {
+            return static_cast<const std::uint8_t *>(getPixels(first + i));
+        },
+        count, n, inputs.data());
+}
+
+std::vector<Img> MappedDataset::to_imgs() const {
+    std::vector<Img> imgs;
+    imgs.reserve(size());
+    for (std::size_t i = 0; i < size(); ++i) {
+        imgs.push_back((*this)[i].to_img());
+    }
+    return imgs;
+}
+
+bool save_dataset(const std::string &file_string, const std::vector<Img> &imgs,
+                  PixelType pixel_type, float scale) {
+    std::ofstream file(file_string, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        return false;
+    }
+    const std::size_t cols = imgs.empty() ? 0 : imgs[0].img_data.getCols();
+    const std::size_t rows = imgs.empty() ? 0 : imgs[0].img_data.getRows();
+    const std::size_t pixels_per_img = cols * rows;
+
+    DatasetHeader header = {};
+    stamp_header(header, magic, version);
+    header.pixel_type = pixel_type;
+    header.count = imgs.size();
+    header.cols = std::uint32_t(cols);
+    header.rows = std::uint32_t(rows);
+    header.scale = pixel_type == PixelType::UInt8 ? scale : 1.0f;
+    header.labels_offset = align_up(sizeof(DatasetHeader));
+    header.pixels_offset =
+        align_up(header.labels_offset + imgs.size() * sizeof(std::int32_t));
+    header.image_stride = align_up(pixels_per_img * pixel_size(pixel_type));
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    pad_to(file, header.labels_offset);
+    std::vector<std::int32_t> labels(imgs.size());
+    for (std::size_t i = 0; i < imgs.size(); ++i) {
+        labels[i] = imgs[i].label;
+    }
+    file.write(reinterpret_cast<const char *>(labels.data()),
+               std::streamsize(labels.size() * sizeof(std::int32_t)));
+
+    // One image per write, padded to the stride
+    pad_to(file, header.pixels_offset);
+    std::vector<char> buffer(header.image_stride, 0);
+    for (const Img &img : imgs) {
+        const MatrixStorage &data = img.img_data.getData();
+        if (data.size() != pixels_per_img) {
+            return false; // Every image must have the same shape
+        }
+        if (pixel_type == PixelType::UInt8) {
+            auto *bytes = reinterpret_cast<std::uint8_t *>(buffer.data());
+            for (std::size_t j = 0; j < pixels_per_img; ++j) {
+                bytes[j] = std::uint8_t(
+                    std::clamp(std::lround(data[j] * scale), 0L, 255L));
+            }
+        } else {
+            std::memcpy(buffer.data(), data.data(),
+                        pixels_per_img * sizeof(float));
+        }
+        file.write(buffer.data(), std::streamsize(buffer.size()));
+    }
+    return bool(file);
+}
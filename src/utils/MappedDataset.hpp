@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstddef> // size_t
+#include <cstdint> // uint32_t && uint64_t && int32_t && uint8_t
+#include <span>    // span
+#include <string>  // string
+#include <vector>  // vector
+
+#include "FileFormat.hpp"
+#include "Img.hpp"
+#include "MappedFile.hpp"
+
+// Image dataset file, designed to be memory-mapped and used in place.
+//
+// Layout (conventions in FileFormat.hpp):
+//   DatasetHeader                          64 bytes
+//   labels: int32_t[count]                 at labels_offset, 64-byte aligned
+//   pixels: count images of image_stride   at pixels_offset, 64-byte aligned
+//           bytes each, every image starts on a 64-byte boundary
+// Pixels are row-major like Matrix2D, either float or bytes with
+// pixel = byte / scale.
+namespace dataset_format {
+
+constexpr char magic[4] = {'N', 'N', 'D', 'S'};
+constexpr std::uint32_t version = 1;
+
+enum class PixelType : std::uint32_t { Float32 = 0, UInt8 = 1 };
+
+struct DatasetHeader {
+    char magic[4];
+    std::uint32_t version;
+    std::uint32_t endian_marker;
+    PixelType pixel_type;
+    std::uint64_t count;
+    std::uint32_t cols;
+    std::uint32_t rows;
+    float scale;
+    std::uint32_t reserved;
+    std::uint64_t labels_offset;
+    std::uint64_t pixels_offset;
+    std::uint64_t image_stride;
+};
+static_assert(sizeof(DatasetHeader) == 64);
+
+} // namespace dataset_format
+
+// Read-only dataset backed by a memory-mapped file.
+//
+// Opening only validates the header: no pixel is read or copied until it is
+// used, and the pages are shared with every other process mapping the file.
+// Images are handed out as ImgView pointing into the mapping.
+class MappedDataset {
+    MappedFile file;
+    const dataset_format::DatasetHeader *header = nullptr;
+    const std::int32_t *labels = nullptr;
+    const char *pixels = nullptr;
+
+  public:
+    // Throws std::runtime_error when the file is missing or malformed
+    explicit MappedDataset(const std::string &file_string);
+
+    std::size_t size() const { return std::size_t(header->count); }
+
+    // getter
+    std::size_t getCols() const { return header->cols; }
+
+    // getter
+    std::size_t getRows() const { return header->rows; }
+
+    // getter
+    dataset_format::PixelType getPixelType() const {
+        return header->pixel_type;
+    }
+
+    // getter
+    float getScale() const { return header->scale; }
+
+    // Pixels stored as bytes
+    bool is_compact() const {
+        return header->pixel_type == dataset_format::PixelType::UInt8;
+    }
+
+    // getter
+    std::span<const std::int32_t> getLabels() const {
+        return {labels, size()};
+    }
+
+    // Raw pixels of image i (float or bytes, see getPixelType)
+    const void *getPixels(std::size_t i) const {
+        return pixels + i * header->image_stride;
+    }
+
+    ImgView operator[](std::size_t i) const;
+
+    // Copies the bytes of images [first, first + count) of a compact dataset
+    // into the columns of inputs (image_size x count) and their one-hot
+    // labels into targets (classes x count), resizing both. Labels are not
+    // validated when opening: one outside [0, classes) throws
+    // std::out_of_range
+    void gather_bytes(std::size_t first, std::size_t count,
+                      ByteStorage &inputs, Matrix2D &targets,
+                      std::size_t classes) const;
+
+    // Owning copies of every image
+    std::vector<Img> to_imgs() const;
+};
+
+// Writes imgs in the dataset format. UInt8 pixels are stored as
+// round(pixel * scale), which is exact for CSV images (value / 256)
+bool save_dataset(const std::string &file_string, const std::vector<Img> &imgs,
+                  dataset_format::PixelType pixel_type =
+                      dataset_format::PixelType::UInt8,
+                  float scale = 256.0f);
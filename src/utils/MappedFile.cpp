@@ -0,0 +1,138 @@
+#include "MappedFile.hpp"
+
+#include <utility> // exchange
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>    // open
+#include <sys/mman.h> // mmap && munmap
+#include <sys/stat.h> // fstat
+#include <unistd.h>   // close
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string &path, Access access) {
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                              nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                              nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        return;
+    }
+    file_handle = file;
+    file_size = std::size_t(size.QuadPart);
+    opened = true;
+    if (file_size == 0) {
+        return; // Empty files cannot be mapped, there is nothing to read
+    }
+    const bool copy_on_write = access == Access::CopyOnWrite;
+    mapping_handle = CreateFileMappingA(
+        file, nullptr, copy_on_write ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0,
+        nullptr);
+    if (mapping_handle == nullptr) {
+        close();
+        return;
+    }
+    file_data = static_cast<char *>(MapViewOfFile(
+        mapping_handle, copy_on_write ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0,
+        0));
+    if (file_data == nullptr) {
+        close();
+    }
+}
+
+void MappedFile::close() noexcept {
+    if (file_data != nullptr) {
+        UnmapViewOfFile(file_data);
+    }
+    if (mapping_handle != nullptr) {
+        CloseHandle(mapping_handle);
+    }
+    if (file_handle != nullptr) {
+        CloseHandle(file_handle);
+    }
+    file_data = nullptr;
+    file_size = 0;
+    file_handle = nullptr;
+    mapping_handle = nullptr;
+    opened = false;
+}
+
+#else
+
+MappedFile::MappedFile(const std::string &path, Access access) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        return;
+    }
+    file_size = std::size_t(st.st_size);
+    opened = true;
+    if (file_size > 0) {
+        // Private mappings never write back, so a read-only descriptor is
+        // enough for copy-on-write
+        const int protection = access == Access::CopyOnWrite
+                                   ? PROT_READ | PROT_WRITE
+                                   : PROT_READ;
+        void *p = ::mmap(nullptr, file_size, protection, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            file_size = 0;
+            opened = false;
+        } else {
+            file_data = static_cast<char *>(p);
+        }
+    }
+    // The mapping keeps the file alive
+    ::close(fd);
+}
+
+void MappedFile::close() noexcept {
+    if (file_data != nullptr) {
+        ::munmap(file_data, file_size);
+    }
+    file_data = nullptr;
+    file_size = 0;
+    opened = false;
+}
+
+#endif
+
+MappedFile::~MappedFile() { close(); }
+
+MappedFile::MappedFile(MappedFile &&other) noexcept
+    : file_data(std::exchange(other.file_data, nullptr)),
+      file_size(std::exchange(other.file_size, 0)),
+      opened(std::exchange(other.opened, false))
+#ifdef _WIN32
+      ,
+      file_handle(std::exchange(other.file_handle, nullptr)),
+      mapping_handle(std::exchange(other.mapping_handle, nullptr))
+#endif
+{
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&other) noexcept {
+    if (this != &other) {
+        close();
+        file_data = std::exchange(other.file_data, nullptr);
+        file_size = std::exchange(other.file_size, 0);
+        opened = std::exchange(other.opened, false);
+#ifdef _WIN32
+        file_handle = std::exchange(other.file_handle, nullptr);
+        mapping_handle = std::exchange(other.mapping_handle, nullptr);
+#endif
+    }
+    return *this;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef> // size_t
+#include <string>  // string
+
+// Read-only memory mapping of a whole file.
+//
+// The file contents are accessed straight from the page cache, without
+// copying them into a buffer: pages are loaded on first access and shared
+// with every other process mapping the same file. Like std::ifstream, a file
+// that cannot be opened leaves the object closed (is_open() == false)
+// instead of throwing.
+//
+// A copy-on-write mapping can also be written: modified pages become private
+// copies and the file itself is never changed.
+class MappedFile {
+    char *file_data = nullptr;
+    std::size_t file_size = 0;
+    bool opened = false;
+#ifdef _WIN32
+    void *file_handle = nullptr;
+    void *mapping_handle = nullptr;
+#endif
+
+    void close() noexcept;
+
+  public:
+    enum class Access { ReadOnly, CopyOnWrite };
+
+    MappedFile() = default;
+    explicit MappedFile(const std::string &path,
+                        Access access = Access::ReadOnly);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    MappedFile(MappedFile &&other) noexcept;
+    MappedFile &operator=(MappedFile &&other) noexcept;
+
+    bool is_open() const { return opened; }
+
+    // getter
+    const char *data() const { return file_data; }
+
+    // Writable contents, only for an Access::CopyOnWrite mapping
+    char *writable_data() { return file_data; }
+
+    // getter
+    std::size_t size() const { return file_size; }
+
+    const char *begin() const { return file_data; }
+    const char *end() const { return file_data + file_size; }
+};
@@ -0,0 +1,128 @@
+#include "MemoryPool.hpp"
+
+#include <array>   // array
+#include <bit>     // bit_width
+#include <mutex>   // mutex && lock_guard
+#include <new>     // align_val_t
+
+namespace memory_pool {
+
+namespace {
+
+// Size classes 64 B, 128 B, ..., 64 MiB
+constexpr std::size_t min_shift = 6;
+constexpr std::size_t classes = 21;
+// Cap of cached bytes per class, beyond it freed blocks go to the system
+constexpr std::size_t max_cached_per_class = std::size_t(128) << 20;
+
+// Freed blocks are chained through their first bytes
+struct FreeBlock {
+    FreeBlock *next;
+};
+
+struct SizeClass {
+    std::mutex mutex;
+    FreeBlock *head = nullptr;
+    std::size_t count = 0;
+};
+
+struct Pool {
+    std::array<SizeClass, classes> size_classes;
+};
+
+// Never destroyed, so matrices with static storage duration can still
+// release their blocks during program exit
+Pool &pool() {
+    static Pool *instance = new Pool;
+    return *instance;
+}
+
+std::size_t class_index(std::size_t bytes) {
+    if (bytes <= (std::size_t(1) << min_shift)) {
+        return 0;
+    }
+    return std::size_t(std::bit_width(bytes - 1)) - min_shift;
+}
+
+std::size_t class_bytes(std::size_t index) {
+    return std::size_t(1) << (index + min_shift);
+}
+
+void *system_allocate(std::size_t bytes) {
+    return ::operator new(bytes, std::align_val_t(alignment));
+}
+
+void system_deallocate(void *p) noexcept {
+    ::operator delete(p, std::align_val_t(alignment));
+}
+
+} // namespace
+
+void *allocate(std::size_t bytes) {
+    std::size_t index = class_index(bytes);
+    if (index >= classes) {
+        return system_allocate(bytes);
+    }
+    SizeClass &sc = pool().size_classes[index];
+    {
+        std::lock_guard<std::mutex> lock(sc.mutex);
+        if (FreeBlock *block = sc.head) {
+            sc.head = block->next;
+            sc.count--;
+            return block;
+        }
+    }
+    return system_allocate(class_bytes(index));
+}
+
+void deallocate(void *p, std::size_t bytes) noexcept {
+    if (p == nullptr) {
+        return;
+    }
+    std::size_t index = class_index(bytes);
+    if (index >= classes) {
+        system_deallocate(p);
+        return;
+    }
+    SizeClass &sc = pool().size_classes[index];
+    {
+        std::lock_guard<std::mutex> lock(sc.mutex);
+        if ((sc.count + 1) * class_bytes(index) <= max_cached_per_class) {
+            FreeBlock *block = static_cast<FreeBlock *>(p);
+            block->next = sc.head;
+            sc.head = block;
+            sc.count++;
+            return;
+        }
+    }
+    system_deallocate(p);
+}
+
+void release() noexcept {
+    for (SizeClass &sc : pool().size_classes) {
+        FreeBlock *block;
+        {
+            std::lock_guard<std::mutex> lock(sc.mutex);
+            block = sc.head;
+            sc.head = nullptr;
+            sc.count = 0;
+        }
+        while (block != nullptr) {
+            FreeBlock *next = block->next;
+            system_deallocate(block);
+            block = next;
+        }
+    }
+}
+
+std::size_t cached_bytes() noexcept {
+    std::size_t total = 0;
+    for (std::size_t i = 0; i < classes; ++i) {
+        SizeClass &sc = pool().size_classes[i];
+        std::lock_guard<std::mutex> lock(sc.mutex);
+        total += sc.count * class_bytes(i);
+    }
+    return total;
+}
+
+} // namespace memory_pool
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef> // size_t
+#include <new>     // placement new
+#include <utility> // forward
+
+// Process-wide pool of 64-byte aligned blocks used for matrix storage.
+//
+// Requests are rounded up to a power of two size class (64 bytes and up).
+// Freed blocks go back to the free list of their class and are handed out
+// again by the next request of the same class, so code that keeps creating
+// and destroying matrices of the same shapes (per-sample training and
+// inference) stops calling the system allocator after the first iteration.
+// Blocks larger than the biggest class are not pooled.
+namespace memory_pool {
+
+// Alignment of every block, one cache line / one AVX-512 vector
+constexpr std::size_t alignment = 64;
+
+// Returns a block of at least bytes bytes, aligned to alignment
+void *allocate(std::size_t bytes);
+
+// Returns a block obtained from allocate(bytes) to the pool
+void deallocate(void *p, std::size_t bytes) noexcept;
+
+// Frees every cached block back to the system
+void release() noexcept;
+
+// Bytes currently held in the free lists
+std::size_t cached_bytes() noexcept;
+
+} // namespace memory_pool
+
+// Standard allocator backed by memory_pool.
+//
+// Elements are default-initialized instead of value-initialized, so
+// std::vector<float, PoolAllocator<float>>::resize leaves new floats
+// uninitialized rather than zero-filling them.
+template <typename T> struct PoolAllocator {
+    using value_type = T;
+
+    PoolAllocator() noexcept = default;
+    template <typename U> PoolAllocator(const PoolAllocator<U> &) noexcept {}
+
+    T *allocate(std::size_t n) {
+        return static_cast<T *>(memory_pool::allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, std::size_t n) noexcept {
+        memory_pool::deallocate(p, n * sizeof(T));
+    }
+
+    template <typename U> void construct(U *p) noexcept(
+        noexcept(::new (static_cast<void *>(p)) U)) {
+        ::new (static_cast<void *>(p)) U;
+    }
+
+    template <typename U, typename... Args>
+    void construct(U *p, Args &&...args) {
+        ::new (static_cast<void *>(p)) U(std::forward<Args>(args)...);
+    }
+
+    template <typename U>
+    friend bool operator==(const PoolAllocator &, const PoolAllocator<U> &) {
+        return true;
+    }
+};
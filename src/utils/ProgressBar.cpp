@@ -2,34 +2,37 @@
 #include <chrono>
 #include <iostream>
 
-ProgressBar::ProgressBar(std::string title, int max, int width)
-    : title(title), max(max), width(width), value(0), last_pct(0) {
+ProgressBar::ProgressBar(std::string_view title, int max, int width)
+    : max(max), width(width), value(0), last_pct(0) {
+    title_size = title.copy(this->title.data(), text_capacity);
     start = std::chrono::high_resolution_clock::now();
 }
 
-void ProgressBar::update() {
+bool ProgressBar::is_due(int value) const {
     int percent = value * 100 / max;
     if (percent == last_pct) {
         if(std::chrono::duration_cast<std::chrono::milliseconds>(
                 std::chrono::high_resolution_clock::now() - last_update).count() < 250) {
-            return;
+            return false;
         }
     }
-    std::string bar(width, ' ');
+    return true;
+}
 
-    // Calculate the progress bar
-    int pos = value * width / max;
-    for (int i = 0; i < width; i++) {
-        if (i < pos) {
-            bar.replace(i, 1, "=");
-        } else if (i == pos) {
-            bar.replace(i, 1, ">");
-        }
+void ProgressBar::update() {
+    if (!is_due(value)) {
+        return;
     }
+    int percent = value * 100 / max;
 
     // Print the progress bar
-    std::clog << "\r" << title << " [";
-    std::clog << bar;
+    std::clog << "\r";
+    std::clog.write(title.data(), std::streamsize(title_size));
+    std::clog << " [";
+    int pos = value * width / max;
+    for (int i = 0; i < width; i++) {
+        std::clog.put(i < pos ? '=' : i == pos ? '>' : ' ');
+    }
     std::clog << "] ";
 
     // Print the percentage
@@ -48,7 +51,8 @@ void ProgressBar::update() {
     }
 
     // Print the message
-    std::clog << message << " " << std::flush;
+    std::clog.write(message.data(), std::streamsize(message_size));
+    std::clog << " " << std::flush;
     last_update = std::chrono::high_resolution_clock::now();
     last_pct = percent;
 }
@@ -58,8 +62,8 @@ void ProgressBar::update(int value) {
     update();
 }
 
-void ProgressBar::update(int value, std::string message) {
+void ProgressBar::update(int value, std::string_view message) {
     this->value = value;
-    this->message = message;
+    message_size = message.copy(this->message.data(), text_capacity);
     update();
 }
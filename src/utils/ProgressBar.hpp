@@ -1,11 +1,32 @@
 #pragma once
 
-#include <string>
+#include <algorithm>
+#include <array>
 #include <chrono>
+#include <cstddef>
+#include <format>
+#include <string_view>
+#include <utility>
+
+// std::format into buffer, truncated to its size, without allocating: the
+// titles and messages of the progress bars drawn while training
+template <std::size_t N, typename... Args>
+std::string_view format_text(char (&buffer)[N],
+                             std::format_string<Args...> format,
+                             Args &&...args) {
+    auto result =
+        std::format_to_n(buffer, N, format, std::forward<Args>(args)...);
+    return {buffer, std::min<std::size_t>(std::size_t(result.size), N)};
+}
 
 class ProgressBar {
-    std::string title;
-    std::string message;
+    // Fixed buffers (longer text is truncated), so that drawing the bar
+    // does not allocate
+    static constexpr std::size_t text_capacity = 64;
+    std::array<char, text_capacity> title;
+    std::size_t title_size;
+    std::array<char, text_capacity> message;
+    std::size_t message_size = 0;
     int max;
     int width;
     int value;
@@ -13,7 +34,7 @@ class ProgressBar {
     std::chrono::time_point<std::chrono::high_resolution_clock> start;
     std::chrono::time_point<std::chrono::high_resolution_clock> last_update;
 public:
-    ProgressBar(std::string title, int max, int width = 50);
+    ProgressBar(std::string_view title, int max, int width = 50);
     ~ProgressBar()=default;
 
     void restart() {
@@ -21,7 +42,8 @@ public:
         value = 0;
         last_pct = 0;
     }
+    bool is_due(int value) const;
     void update();
     void update(int value);
-    void update(int value, std::string message);
+    void update(int value, std::string_view message);
 };
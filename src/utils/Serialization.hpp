@@ -1,7 +1,8 @@
 #pragma once
 
 #include <fstream>
-#include <vector>
+#include <ranges>
+#include <type_traits>
 
 /**
  * @brief Helper function to read data from a binary file
@@ -14,17 +15,25 @@ inline void read(std::istream &is, auto &t) {
 }
 
 /**
- * @brief Helper function to read a vector from a binary file
- * You must set the size of the vector before reading it!
- * @tparam T Type of the vector
+ * @brief Contiguous container of trivially copyable elements (std::vector,
+ * MatrixStorage...), read and written with a single stream call
+ */
+template <typename R>
+concept binary_block =
+    std::ranges::contiguous_range<R> && std::ranges::sized_range<R> &&
+    std::is_trivially_copyable_v<std::ranges::range_value_t<R>>;
+
+/**
+ * @brief Helper function to read a container from a binary file
+ * You must set the size of the container before reading it!
+ * @tparam R Type of the container
  * @param is Input stream to read from
- * @param v Vector to read into
+ * @param v Container to read into
  */
-template <typename T>
-inline void read(std::istream &is, std::vector<T> &v) {
-    for(auto &t : v) {
-        read(is, t);
-    }
+template <binary_block R> inline void read(std::istream &is, R &v) {
+    is.read(reinterpret_cast<char *>(std::ranges::data(v)),
+            std::streamsize(std::ranges::size(v) *
+                            sizeof(std::ranges::range_value_t<R>)));
 }
 
 /**
@@ -38,15 +47,14 @@ inline void write(std::ostream &os, const auto &t) {
 }
 
 /**
- * @brief Helper function to write a vector to a binary file
+ * @brief Helper function to write a container to a binary file
  *
- * @tparam T Type of the vector
+ * @tparam R Type of the container
  * @param os Output stream to write to
- * @param v Vector to write
+ * @param v Container to write
  */
-template <typename T>
-inline void write(std::ostream &os, const std::vector<T> &v) {
-    for (auto &t : v) {
-        write(os, t);
-    }
+template <binary_block R> inline void write(std::ostream &os, const R &v) {
+    os.write(reinterpret_cast<const char *>(std::ranges::data(v)),
+             std::streamsize(std::ranges::size(v) *
+                             sizeof(std::ranges::range_value_t<R>)));
 }
@@ -0,0 +1,184 @@
+#include "StreamingLoader.hpp"
+
+#include <algorithm> // copy_n && shuffle
+#include <cassert>   // assert
+#include <numeric>   // iota
+#include <random>    // mt19937_64 && uniform_int_distribution
+#include <stdexcept> // runtime_error
+#include <utility>   // exchange && move
+
+#include "MappedDataset.hpp"
+
+StreamingLoader::StreamingLoader(std::vector<std::string> shards,
+                                 std::size_t batch_size,
+                                 std::size_t shuffle_buffer,
+                                 std::uint64_t seed, std::size_t buffers)
+    : shards(std::move(shards)), batch_size(batch_size),
+      shuffle_buffer(shuffle_buffer), seed(seed) {
+    assert(batch_size > 0 && buffers > 0);
+    for (const std::string &shard : this->shards) {
+        MappedDataset mapped(shard);
+        if (&shard == &this->shards.front()) {
+            cols = mapped.getCols();
+            rows = mapped.getRows();
+        } else if (mapped.getCols() != cols || mapped.getRows() != rows) {
+            throw std::runtime_error("Shard '" + shard +
+                                     "' has a different image shape");
+        }
+        total += mapped.size();
+    }
+    slots.assign(buffers, Dataset(cols, rows, batch_size));
+}
+
+StreamingLoader::~StreamingLoader() { stop(); }
+
+void StreamingLoader::stop() {
+    if (producer.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        producer.join();
+    }
+}
+
+void StreamingLoader::start_epoch() {
+    stop();
+    free_slots.clear();
+    ready_slots.clear();
+    for (std::size_t s = 0; s < slots.size(); ++s) {
+        free_slots.push_back(s);
+    }
+    finished = false;
+    stopping = false;
+    error = nullptr;
+    producer = std::thread([this, epoch_seed = seed + epoch]() {
+        try {
+            produce(epoch_seed);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            error = std::current_exception();
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finished = true;
+        }
+        changed.notify_all();
+    });
+    epoch++;
+}
+
+StreamingLoader::Iterator StreamingLoader::begin() {
+    start_epoch();
+    return Iterator(this, next(npos));
+}
+
+std::size_t StreamingLoader::next(std::size_t slot) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (slot != npos) {
+        free_slots.push_back(slot);
+        changed.notify_all();
+    }
+    changed.wait(lock, [this]() { return !ready_slots.empty() || finished; });
+    if (!ready_slots.empty()) {
+        std::size_t ready = ready_slots.front();
+        ready_slots.pop_front();
+        return ready;
+    }
+    if (error) {
+        std::rethrow_exception(std::exchange(error, nullptr));
+    }
+    return npos;
+}
+
+void StreamingLoader::produce(std::uint64_t epoch_seed) {
+    std::mt19937_64 generator(epoch_seed);
+
+    // Batch currently being filled, npos when none is held
+    std::size_t slot = npos;
+    std::size_t filled = 0;
+
+    auto publish = [&]() {
+        slots[slot].resize(filled);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ready_slots.push_back(slot);
+        }
+        changed.notify_all();
+        slot = npos;
+        filled = 0;
+    };
+
+    // Copies one sample into the current batch. Returns false when the
+    // consumer asked to stop
+    auto emit = [&](const float *pixels, int label) {
+        if (slot == npos) {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock,
+                         [this]() { return !free_slots.empty() || stopping; });
+            if (stopping) {
+                return false;
+            }
+            slot = free_slots.front();
+            free_slots.pop_front();
+            lock.unlock();
+            slots[slot].resize(batch_size);
+        }
+        Dataset &batch = slots[slot];
+        std::copy_n(pixels, batch.image_size(), batch.getPixels(filled));
+        batch.getLabel(filled) = label;
+        if (++filled == batch_size) {
+            publish();
+        }
+        return true;
+    };
+
+    std::vector<std::size_t> shard_order(shards.size());
+    std::iota(shard_order.begin(), shard_order.end(), std::size_t(0));
+    Dataset reservoir(cols, rows, shuffle_buffer);
+    std::size_t reservoir_fill = 0;
+    if (shuffle_buffer > 0) {
+        std::shuffle(shard_order.begin(), shard_order.end(), generator);
+    }
+
+    Dataset staging(cols, rows, 1);
+    float *sample = staging.getPixels(0);
+    for (std::size_t shard : shard_order) {
+        MappedDataset mapped(shards[shard]);
+        for (std::size_t i = 0; i < mapped.size(); ++i) {
+            ImgView img = mapped[i];
+            if (shuffle_buffer == 0) {
+                img.copy_to(sample);
+                if (!emit(sample, img.label)) {
+                    return;
+                }
+            } else if (reservoir_fill < shuffle_buffer) {
+                img.copy_to(reservoir.getPixels(reservoir_fill));
+                reservoir.getLabel(reservoir_fill++) = img.label;
+            } else {
+                // Emit a random buffered sample and take its place
+                std::size_t r = std::uniform_int_distribution<std::size_t>(
+                    0, shuffle_buffer - 1)(generator);
+                if (!emit(reservoir.getPixels(r), reservoir.getLabel(r))) {
+                    return;
+                }
+                img.copy_to(reservoir.getPixels(r));
+                reservoir.getLabel(r) = img.label;
+            }
+        }
+    }
+
+    // Drain the shuffle buffer in random order
+    reservoir.resize(reservoir_fill);
+    reservoir.shuffle(generator());
+    for (std::size_t i = 0; i < reservoir.size(); ++i) {
+        ImgView img = reservoir[i];
+        if (!emit(img.pixels, img.label)) {
+            return;
+        }
+    }
+    if (slot != npos && filled > 0) {
+        publish();
+    }
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <condition_variable> // condition_variable
+#include <cstddef>            // size_t
+#include <cstdint>            // uint64_t
+#include <deque>              // deque
+#include <exception>          // exception_ptr
+#include <iterator>           // input_iterator_tag
+#include <mutex>              // mutex
+#include <string>             // string
+#include <thread>             // thread
+#include <vector>             // vector
+
+#include "Dataset.hpp"
+
+// Streams mini-batches from dataset shards (files in the MappedDataset
+// format) that together may not fit in memory.
+//
+// A background thread reads the shards and fills a small ring of batch
+// buffers (3 by default, triple buffering) while the training loop consumes
+// the previous ones, so I/O overlaps with compute. Iterating the loader runs
+// one epoch:
+//
+//     for (const Dataset &batch : loader) { ... }
+//
+// Each epoch visits the shards in a new random order and mixes the samples
+// through a shuffle buffer: incoming samples replace a random sample of the
+// buffer, which is emitted. Memory use is bounded by
+// (buffers * batch_size + shuffle_buffer) images, whatever the shard sizes.
+class StreamingLoader {
+    std::vector<std::string> shards;
+    std::size_t batch_size;
+    std::size_t shuffle_buffer;
+    std::uint64_t seed;
+    std::uint64_t epoch = 0;
+    std::size_t total = 0;
+    std::size_t cols = 0;
+    std::size_t rows = 0;
+
+    // Batch buffers, passed between the two threads by index
+    std::vector<Dataset> slots;
+    std::deque<std::size_t> free_slots;
+    std::deque<std::size_t> ready_slots;
+    std::mutex mutex;
+    std::condition_variable changed;
+    bool finished = false;
+    bool stopping = false;
+    std::exception_ptr error;
+    std::thread producer;
+
+    void produce(std::uint64_t epoch_seed);
+    void start_epoch();
+    void stop();
+
+    // Returns slot to the producer and waits for the next batch, npos at the
+    // end of the epoch
+    std::size_t next(std::size_t slot);
+
+  public:
+    static constexpr std::size_t npos = std::size_t(-1);
+
+    // Reads the shard headers; throws std::runtime_error when a shard is
+    // missing, malformed or has a different image shape.
+    // shuffle_buffer = 0 keeps the file order
+    StreamingLoader(std::vector<std::string> shards, std::size_t batch_size,
+                    std::size_t shuffle_buffer = 0, std::uint64_t seed = 0,
+                    std::size_t buffers = 3);
+    ~StreamingLoader();
+
+    StreamingLoader(const StreamingLoader &) = delete;
+    StreamingLoader &operator=(const StreamingLoader &) = delete;
+
+    // Samples in one epoch
+    std::size_t size() const { return total; }
+
+    // getter
+    std::size_t getBatchSize() const { return batch_size; }
+
+    class Iterator {
+        StreamingLoader *loader = nullptr;
+        std::size_t slot = npos;
+
+      public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = Dataset;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Dataset *;
+        using reference = const Dataset &;
+
+        Iterator() = default;
+        Iterator(StreamingLoader *loader, std::size_t slot)
+            : loader(loader), slot(slot) {}
+
+        const Dataset &operator*() const { return loader->slots[slot]; }
+        const Dataset *operator->() const { return &loader->slots[slot]; }
+
+        Iterator &operator++() {
+            slot = loader->next(slot);
+            return *this;
+        }
+
+        bool operator==(const Iterator &other) const {
+            return slot == other.slot;
+        }
+    };
+
+    // Starts a new epoch (stopping the previous one if unfinished) and
+    // returns its first batch
+    Iterator begin();
+    Iterator end() { return Iterator(this, npos); }
+};
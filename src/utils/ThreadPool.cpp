@@ -0,0 +1,93 @@
+#include "ThreadPool.hpp"
+
+#include <algorithm> // max
+#include <utility>   // exchange
+
+ThreadPool::ThreadPool(unsigned int threads) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    workers.reserve(threads - 1);
+    for (unsigned int i = 1; i < threads; ++i) {
+        workers.emplace_back([this]() { worker_loop(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work_ready.notify_all();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::run_tasks() {
+    for (;;) {
+        std::size_t i = next_index.fetch_add(1, std::memory_order_relaxed);
+        if (i >= task_count) {
+            return;
+        }
+        try {
+            (*task)(i);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+    }
+}
+
+void ThreadPool::worker_loop() {
+    std::uint64_t seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            work_ready.wait(lock, [&]() { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+        }
+        run_tasks();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--busy_workers == 0) {
+                work_done.notify_one();
+            }
+        }
+    }
+}
+
+void ThreadPool::parallel_for(std::size_t count,
+                              const std::function<void(std::size_t)> &task) {
+    if (count == 0) {
+        return;
+    }
+    if (workers.empty() || count == 1) {
+        for (std::size_t i = 0; i < count; ++i) {
+            task(i);
+        }
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->task = &task;
+        task_count = count;
+        next_index.store(0, std::memory_order_relaxed);
+        busy_workers = workers.size();
+        error = nullptr;
+        ++generation;
+    }
+    work_ready.notify_all();
+    run_tasks();
+    std::unique_lock<std::mutex> lock(mutex);
+    work_done.wait(lock, [this]() { return busy_workers == 0; });
+    this->task = nullptr;
+    if (error) {
+        std::rethrow_exception(std::exchange(error, nullptr));
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>             // atomic
+#include <condition_variable> // condition_variable
+#include <cstddef>            // size_t
+#include <cstdint>            // uint64_t
+#include <exception>          // exception_ptr
+#include <functional>         // function
+#include <mutex>              // mutex
+#include <thread>             // thread
+#include <vector>             // vector
+
+// Fixed-size pool of worker threads that run index-based parallel loops.
+// The calling thread takes part in the work, so a pool of size 1 has no
+// workers and runs everything inline.
+class ThreadPool {
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable work_ready;
+    std::condition_variable work_done;
+    const std::function<void(std::size_t)> *task = nullptr;
+    std::size_t task_count = 0;
+    std::atomic<std::size_t> next_index{0};
+    std::size_t busy_workers = 0;
+    std::uint64_t generation = 0;
+    std::exception_ptr error;
+    bool stopping = false;
+
+    void worker_loop();
+    void run_tasks();
+
+  public:
+    // threads = 0 uses one thread per hardware core
+    explicit ThreadPool(unsigned int threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // Number of threads taking part in a loop, including the caller
+    unsigned int size() const { return unsigned(workers.size()) + 1; }
+
+    // Runs task(i) for every i in [0, count) and waits for all of them.
+    // The first exception thrown by a task is rethrown here.
+    void parallel_for(std::size_t count,
+                      const std::function<void(std::size_t)> &task);
+};